@@ -6,9 +6,241 @@
 //  Copyright © 2018 Indi Kernick. All rights reserved.
 //
 
+#include <chrono>
+#include <iomanip>
+#include <fstream>
 #include <iostream>
+#include <STELA/llvm.hpp>
+#include <llvm/IR/Module.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Object/Archive.h>
+#include <llvm/ADT/SmallString.h>
+#include <STELA/code generation.hpp>
+#include <STELA/syntax analysis.hpp>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <STELA/semantic analysis.hpp>
 
-int main(int, const char *[]) {
-  std::cout << "The CLI is yet to be implemented\n";
-  return 0;
+namespace {
+
+namespace cl = llvm::cl;
+
+cl::OptionCategory category{"STELA options"};
+
+cl::list<std::string> inputPaths{
+  cl::Positional,
+  cl::OneOrMore,
+  cl::desc("<module files>"),
+  cl::cat(category)
+};
+
+cl::opt<std::string> outputPath{
+  "o",
+  cl::desc("Output file. An archive is written if the name ends with .a"),
+  cl::value_desc("filename"),
+  cl::cat(category)
+};
+
+cl::opt<stela::EmitKind> emitKind{
+  "emit",
+  cl::desc("Type of file to emit"),
+  cl::init(stela::EmitKind::object),
+  cl::values(
+    clEnumValN(stela::EmitKind::ir, "ir", "Optimized LLVM IR"),
+    clEnumValN(stela::EmitKind::assembly, "asm", "Native assembly"),
+    clEnumValN(stela::EmitKind::object, "obj", "Relocatable object")
+  ),
+  cl::cat(category)
+};
+
+cl::opt<bool> timePhases{
+  "time",
+  cl::desc("Print the time taken by each phase"),
+  cl::cat(category)
+};
+
+cl::opt<bool> noOpt{
+  "O0",
+  cl::desc("Disable optimizations"),
+  cl::cat(category)
+};
+
+cl::opt<stela::OptLevel> optLevel{
+  "opt-level",
+  cl::desc("Optimization preset"),
+  cl::init(stela::OptLevel::O3),
+  cl::values(
+    clEnumValN(stela::OptLevel::O1, "O1", "Optimize quickly"),
+    clEnumValN(stela::OptLevel::O2, "O2", "Optimize"),
+    clEnumValN(stela::OptLevel::O3, "O3", "Optimize aggressively"),
+    clEnumValN(stela::OptLevel::Os, "Os", "Optimize for size")
+  ),
+  cl::cat(category)
+};
+
+cl::opt<std::string> passPipeline{
+  "passes",
+  cl::desc("Pass pipeline to run instead of the preset"),
+  cl::value_desc("pipeline"),
+  cl::cat(category)
+};
+
+cl::opt<bool> timePasses{
+  "time-passes",
+  cl::desc("Print the time taken by each optimization pass"),
+  cl::cat(category)
+};
+
+cl::opt<std::string> targetCPU{
+  "mcpu",
+  cl::desc("Target a specific CPU instead of the host CPU"),
+  cl::value_desc("cpu-name"),
+  cl::cat(category)
+};
+
+cl::opt<std::string> targetFeatures{
+  "mattr",
+  cl::desc("Enable (+) or disable (-) target features"),
+  cl::value_desc("+a1,-a2,..."),
+  cl::cat(category)
+};
+
+class PhaseTimer {
+public:
+  PhaseTimer()
+    : start{Clock::now()} {}
+  
+  void lap(const char *phase) {
+    const Clock::time_point now = Clock::now();
+    if (timePhases) {
+      const std::chrono::duration<double, std::milli> time = now - start;
+      std::cerr << std::left << std::setw(24) << phase;
+      std::cerr << std::right << std::fixed << std::setprecision(3);
+      std::cerr << std::setw(12) << time.count() << " ms\n";
+    }
+    start = now;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start;
+};
+
+std::string defaultOutputPath() {
+  switch (emitKind) {
+    case stela::EmitKind::ir:
+      return "out.ll";
+    case stela::EmitKind::assembly:
+      return "out.s";
+    case stela::EmitKind::object:
+      return "out.o";
+  }
+  return "out";
+}
+
+bool readFile(const std::string &path, std::string &source) {
+  std::ifstream file{path};
+  if (!file.is_open()) {
+    return false;
+  }
+  source.assign(std::istreambuf_iterator<char>{file}, {});
+  return true;
+}
+
+bool writeArchive(const std::string &path, const llvm::StringRef object) {
+  const llvm::Triple triple{llvm::sys::getProcessTriple()};
+  llvm::NewArchiveMember member{llvm::MemoryBufferRef{object, "stela.o"}};
+  llvm::Error error = llvm::writeArchive(
+    path,
+    {std::move(member)},
+    true,
+    triple.isOSDarwin() ? llvm::object::Archive::K_DARWIN : llvm::object::Archive::K_GNU,
+    true,
+    false
+  );
+  if (error) {
+    std::cerr << llvm::toString(std::move(error)) << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool writeOutput(llvm::Module &module, stela::LogSink &sink, const stela::OptFlags opt) {
+  std::string path = outputPath.empty() ? defaultOutputPath() : outputPath.getValue();
+  
+  if (emitKind == stela::EmitKind::object && llvm::StringRef{path}.endswith(".a")) {
+    llvm::SmallString<0> object;
+    llvm::raw_svector_ostream stream{object};
+    stela::emitModule(module, stream, emitKind, sink, opt);
+    return writeArchive(path, object);
+  }
+  
+  std::error_code error;
+  const llvm::sys::fs::OpenFlags flags = emitKind == stela::EmitKind::object
+    ? llvm::sys::fs::F_None : llvm::sys::fs::F_Text;
+  llvm::raw_fd_ostream stream{path, error, flags};
+  if (error) {
+    std::cerr << "Failed to open \"" << path << "\": " << error.message() << '\n';
+    return false;
+  }
+  stela::emitModule(module, stream, emitKind, sink, opt);
+  return true;
+}
+
+int compile(stela::LogSink &sink) {
+  stela::OptFlags opt = noOpt ? stela::opt_none : stela::opt_all;
+  opt.level = optLevel;
+  opt.pipeline = passPipeline.empty() ? nullptr : passPipeline.c_str();
+  opt.timePasses = timePasses;
+  opt.cpu = targetCPU.empty() ? nullptr : targetCPU.c_str();
+  opt.features = targetFeatures.empty() ? nullptr : targetFeatures.c_str();
+  PhaseTimer timer;
+  
+  // The ASTs refer to the source strings so they must outlive the ASTs
+  std::vector<std::string> sources(inputPaths.size());
+  stela::ASTs asts;
+  for (size_t i = 0; i != inputPaths.size(); ++i) {
+    if (!readFile(inputPaths[i], sources[i])) {
+      std::cerr << "Failed to read \"" << inputPaths[i] << "\"\n";
+      return EXIT_FAILURE;
+    }
+    asts.push_back(stela::createAST(sources[i], sink));
+  }
+  timer.lap("Syntax analysis");
+  
+  stela::Symbols syms = stela::initModules(sink);
+  stela::compileModules(syms, asts, sink);
+  timer.lap("Semantic analysis");
+  
+  std::unique_ptr<llvm::Module> module = stela::generateIR(syms, sink);
+  timer.lap("Generate IR");
+  
+  stela::optimizeForHost(*module, sink, opt);
+  timer.lap("Optimize IR");
+  
+  if (!writeOutput(*module, sink, opt)) {
+    return EXIT_FAILURE;
+  }
+  timer.lap("Emit");
+  
+  return EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, const char *argv[]) {
+  cl::HideUnrelatedOptions(category);
+  cl::ParseCommandLineOptions(argc, argv, "STELA compiler\n");
+  
+  stela::ColorSink color;
+  stela::FilterSink sink{color, stela::LogPri::warning};
+  stela::initLLVM();
+  int status = EXIT_FAILURE;
+  try {
+    status = compile(sink);
+  } catch (stela::FatalError &) {}
+  stela::quitLLVM();
+  return status;
 }
@@ -0,0 +1,177 @@
+//
+//  allocator.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_allocator_hpp
+#define stela_allocator_hpp
+
+#include <cstddef>
+#include <utility>
+#include <cstdlib>
+
+namespace stela {
+
+/// A table of functions that allocate memory for arrays, closures and other
+/// objects shared with compiled code. The first parameter of both functions
+/// is self. alloc returns null when out of memory and free must accept null
+struct Allocator {
+  void *(*alloc)(void *, size_t);
+  void (*free)(void *, void *);
+  void *self;
+};
+
+namespace detail {
+
+inline thread_local const Allocator *host_allocator = nullptr;
+
+}
+
+/// Memory that the host allocates and frees (such as with makeArray or by
+/// releasing a retain_ptr) goes through the allocator while the scope is
+/// alive. Code generated inside a scope uses its allocator when
+/// OptFlags::allocator is null. Generating code for a different allocator
+/// inside a scope is an error
+class AllocatorScope {
+public:
+  explicit AllocatorScope(const Allocator &allocator) noexcept
+    : prev{std::exchange(detail::host_allocator, &allocator)} {}
+  ~AllocatorScope() noexcept {
+    detail::host_allocator = prev;
+  }
+  
+  AllocatorScope(const AllocatorScope &) = delete;
+  AllocatorScope &operator=(const AllocatorScope &) = delete;
+  
+private:
+  const Allocator *prev;
+};
+
+/// The allocator of the current AllocatorScope or null if there isn't one
+inline const Allocator *currentAllocator() noexcept {
+  return detail::host_allocator;
+}
+
+/// Allocate with the allocator of the current AllocatorScope or with malloc
+inline void *allocBytes(const size_t size) noexcept {
+  if (const Allocator *allocator = detail::host_allocator) {
+    return allocator->alloc(allocator->self, size);
+  } else {
+    return std::malloc(size);
+  }
+}
+
+/// Free with the allocator of the current AllocatorScope or with free
+inline void deallocBytes(void *const ptr) noexcept {
+  if (const Allocator *allocator = detail::host_allocator) {
+    allocator->free(allocator->self, ptr);
+  } else {
+    std::free(ptr);
+  }
+}
+
+/// Allocate array storage or closure data. The block comes from the allocator
+/// if it isn't null or from the free lists of the calling thread. Compiled
+/// code allocates objects this way. Returns null when out of memory
+void *objectAlloc(const Allocator *, size_t) noexcept;
+/// Free a block from objectAlloc. The block is given back to the allocator
+/// that it came from or to the free lists of the calling thread, so it may be
+/// freed by a different thread or under a different AllocatorScope
+void objectFree(void *) noexcept;
+/// Give the blocks in the free lists of the calling thread back to free. This
+/// is done automatically when the thread exits
+void flushObjectFreeLists() noexcept;
+
+/// Allocate array storage or closure data with the allocator of the current
+/// AllocatorScope or from the free lists of the calling thread
+inline void *allocObject(const size_t size) noexcept {
+  return objectAlloc(detail::host_allocator, size);
+}
+
+/// Free array storage or closure data with the allocator that it came from
+inline void deallocObject(void *const ptr) noexcept {
+  objectFree(ptr);
+}
+
+/// Bump pointer allocator. Freeing does nothing and reset releases everything
+/// at once. Every object allocated from the arena must be dead before it is
+/// reset. An arena should only be used by one thread at a time
+class ArenaAllocator {
+public:
+  /// Memory is requested from malloc in blocks of this many bytes
+  explicit ArenaAllocator(size_t = 64 * 1024);
+  ~ArenaAllocator();
+  
+  ArenaAllocator(const ArenaAllocator &) = delete;
+  ArenaAllocator &operator=(const ArenaAllocator &) = delete;
+  
+  /// The table to put in OptFlags::allocator or an AllocatorScope
+  const Allocator &table() const noexcept {
+    return tab;
+  }
+  
+  void *alloc(size_t) noexcept;
+  /// Release everything allocated from the arena. The first block is kept
+  void reset() noexcept;
+  /// Bytes allocated since the last reset
+  size_t used() const noexcept {
+    return usedBytes;
+  }
+  
+private:
+  struct Block;
+  
+  Allocator tab;
+  size_t blockSize;
+  size_t usedBytes = 0;
+  Block *head = nullptr;
+  char *pos = nullptr;
+  char *end = nullptr;
+  
+  bool grow(size_t) noexcept;
+};
+
+/// Recycles blocks through a free list for each size class. Allocations of up
+/// to max_size bytes are rounded up to a multiple of 16 bytes and carved from
+/// larger slabs. Bigger allocations use malloc. A pool should only be used by
+/// one thread at a time
+class PoolAllocator {
+public:
+  static constexpr size_t granularity = 16;
+  static constexpr size_t max_size = 256;
+  
+  PoolAllocator();
+  ~PoolAllocator();
+  
+  PoolAllocator(const PoolAllocator &) = delete;
+  PoolAllocator &operator=(const PoolAllocator &) = delete;
+  
+  /// The table to put in OptFlags::allocator or an AllocatorScope
+  const Allocator &table() const noexcept {
+    return tab;
+  }
+  
+  void *alloc(size_t) noexcept;
+  void free(void *) noexcept;
+  
+private:
+  static constexpr size_t class_count = max_size / granularity;
+  
+  struct Node;
+  struct Slab;
+  
+  Allocator tab;
+  Node *freeLists[class_count] = {};
+  Slab *slabs = nullptr;
+  char *pos = nullptr;
+  char *end = nullptr;
+  
+  bool grow() noexcept;
+};
+
+}
+
+#endif
@@ -41,10 +41,14 @@ class Visitor;
 //---------------------------------- Base --------------------------------------
 
 struct Node : ref_count {
+  Node();
   virtual ~Node();
   virtual void accept(Visitor &) = 0;
   
   Loc loc;
+  
+  // the number of nodes that have been created on the calling thread
+  static uint64_t created();
 };
 using NodePtr = retain_ptr<Node>;
 
@@ -380,7 +384,11 @@ struct Func final : Declaration {
   bool external = false;
   
   sym::Func *symbol = nullptr;
+  // set by semantic analysis if the function is ever converted to a closure
+  bool closure = false;
   llvm::Function *llvmFunc = nullptr;
+  // adapts llvmFunc to the closure calling convention
+  llvm::Function *llvmThunk = nullptr;
   
   void accept(Visitor &) override;
 };
@@ -20,12 +20,22 @@ namespace llvm {
 
 class ExecutionEngine;
 
+namespace orc {
+
+class LLJIT;
+
+}
+
 }
 
 namespace stela {
 
+class TieredEngine;
+class HotSwapEngine;
+
 /// A wrapper around a compiled stela function. Acts as an ABI adapter to call
-/// Stela functions using the Stela ABI
+/// Stela functions using the Stela ABI. Methods and regular functions share
+/// an ABI so Method is only kept for symmetry with reflection
 template <typename Fun, bool Method = false>
 class Function;
 
@@ -44,26 +54,14 @@ class Function<Ret(Params...), Method> {
     if constexpr (param_ret) {
       std::aligned_storage_t<sizeof(Ret), alignof(Ret)> retStorage;
       Ret *retPtr = reinterpret_cast<Ret *>(&retStorage);
-      if constexpr (Method) {
-        ptr(unwrap<Params, Indicies>(params)..., retPtr);
-      } else {
-        ptr(nullptr, unwrap<Params, Indicies>(params)..., retPtr);
-      }
+      ptr(unwrap<Params, Indicies>(params)..., retPtr);
       Ret retObj{std::move(*retPtr)};
       retPtr->~Ret();
       return retObj;
     } else if constexpr (std::is_void_v<Ret>) {
-      if constexpr (Method) {
-        ptr(unwrap<Params, Indicies>(params)...);
-      } else {
-        ptr(nullptr, unwrap<Params, Indicies>(params)...);
-      }
+      ptr(unwrap<Params, Indicies>(params)...);
     } else {
-      if constexpr (Method) {
-        return pass_traits<Ret>::wrap(ptr(unwrap<Params, Indicies>(params)...));
-      } else {
-        return pass_traits<Ret>::wrap(ptr(nullptr, unwrap<Params, Indicies>(params)...));
-      }
+      return pass_traits<Ret>::wrap(ptr(unwrap<Params, Indicies>(params)...));
     }
   }
 
@@ -71,17 +69,9 @@ public:
   static constexpr bool param_ret = pass_traits<Ret>::nontrivial;
 
   using type = std::conditional_t<
-    Method,
-    std::conditional_t<
-      param_ret,
-      void(pass_type<Params>..., Ret *) noexcept,
-      pass_type<Ret>(pass_type<Params>...) noexcept
-    >,
-    std::conditional_t<
-      param_ret,
-      void(void *, pass_type<Params>..., Ret *) noexcept,
-      pass_type<Ret>(void *, pass_type<Params>...) noexcept
-    >
+    param_ret,
+    void(pass_type<Params>..., Ret *) noexcept,
+    pass_type<Ret>(pass_type<Params>...) noexcept
   >;
   
   explicit Function(const uint64_t addr) noexcept
@@ -120,16 +110,22 @@ private:
 };
 
 uint64_t getFunctionAddress(llvm::ExecutionEngine *, const std::string &);
+uint64_t getFunctionAddress(llvm::orc::LLJIT *, const std::string &);
+uint64_t getFunctionAddress(TieredEngine *, const std::string &);
+uint64_t getFunctionAddress(HotSwapEngine *, const std::string &);
 
-template <typename Sig, bool Method = false>
-auto getFunc(llvm::ExecutionEngine *engine, const std::string &name) {
+template <typename Sig, bool Method = false, typename Engine>
+auto getFunc(Engine *engine, const std::string &name) {
   return Function<Sig, Method>{getFunctionAddress(engine, name)};
 }
 
 uint64_t getGlobalAddress(llvm::ExecutionEngine *, const std::string &);
+uint64_t getGlobalAddress(llvm::orc::LLJIT *, const std::string &);
+uint64_t getGlobalAddress(TieredEngine *, const std::string &);
+uint64_t getGlobalAddress(HotSwapEngine *, const std::string &);
 
-template <typename Type>
-auto getGlobal(llvm::ExecutionEngine *engine, const std::string &name) {
+template <typename Type, typename Engine>
+auto getGlobal(Engine *engine, const std::string &name) {
   return Global<Type>{getGlobalAddress(engine, name)};
 }
 
@@ -15,26 +15,120 @@
 namespace llvm {
 
 class ExecutionEngine;
+class LLVMContext;
 class Module;
+class raw_pwrite_stream;
+
+namespace orc {
+
+class LLLazyJIT;
+
+}
 
 }
 
 namespace stela {
 
+struct Allocator;
+
+/// Optimization pipeline presets
+enum class OptLevel : uint8_t {
+  O1,
+  O2,
+  O3,
+  Os
+};
+
 struct OptFlags {
   bool inliner = true;
   bool vectorize = true;
   bool optimizeIR = true;
   bool optimizeASM = true;
+  /// The optimized module is split into this many partitions that are
+  /// compiled concurrently. The lazy JIT uses this many compile threads
+  unsigned codegenThreads = 1;
+  /// Instrument the program to count how often each branch is taken. Call
+  /// writeProfile after a representative run. The program is instrumented
+  /// even if optimizeIR is false. The counters are updated atomically if
+  /// atomicRefs is true
+  bool profileGen = false;
+  /// Path of a profile written by writeProfile. The profile guides inlining,
+  /// block layout and hot/cold splitting
+  const char *profileUse = nullptr;
+  /// The preset pipeline used by optimizeIR
+  OptLevel level = OptLevel::O3;
+  /// A pipeline in the format accepted by opt -passes. This replaces the
+  /// preset pipeline. For example, "function(sroa,instcombine,simplify-cfg)"
+  const char *pipeline = nullptr;
+  /// Print the time taken by each pass to stderr
+  bool timePasses = false;
+  /// Generate code for this CPU instead of the host CPU. For example, "haswell"
+  const char *cpu = nullptr;
+  /// Features to enable or disable on top of the features of the host CPU.
+  /// For example, "+avx2,-avx512f"
+  const char *features = nullptr;
+  /// Let Linux perf symbolize the compiled code. Compiled functions are listed
+  /// under their Stela names and signatures in /tmp/perf-<pid>.map and in a
+  /// jitdump file for perf inject
+  bool perf = false;
+  /// Emit line tables that map the compiled code back to lines in the Stela
+  /// source. Each Stela module is a file named after the module. This is read
+  /// by generateIR
+  bool debugInfo = false;
+  /// Update reference counts atomically so that arrays and closures can be
+  /// shared between threads as SharedArray and SharedClosure. This is read by
+  /// generateIR
+  bool atomicRefs = false;
+  /// Compiled code allocates memory with this allocator instead of malloc.
+  /// The table is read on every call so its functions can be changed between
+  /// calls. The table is referenced through a symbol that is resolved when
+  /// the code is linked so it must outlive the code. If this is null, the
+  /// allocator of the current AllocatorScope is used. It must match the
+  /// AllocatorScope if there is one. This is read by generateIR
+  const Allocator *allocator = nullptr;
 };
 
 constexpr OptFlags opt_all = {};
 constexpr OptFlags opt_none = {false, false, false, false};
 
-std::unique_ptr<llvm::Module> generateIR(const Symbols &, LogSink &);
+enum class EmitKind : uint8_t {
+  ir,
+  assembly,
+  object
+};
+
+std::unique_ptr<llvm::Module> generateIR(const Symbols &, LogSink &, OptFlags = opt_all);
+/// Generate IR in the given context. Modules generated in different contexts
+/// can be generated, optimized and compiled on different threads at the same
+/// time. The Symbols must only ever be given to one context
+std::unique_ptr<llvm::Module> generateIR(const Symbols &, LogSink &, llvm::LLVMContext &, OptFlags = opt_all);
 llvm::ExecutionEngine *generateCode(std::unique_ptr<llvm::Module>, LogSink &, OptFlags = opt_all);
 llvm::ExecutionEngine *generateCode(const Symbols &, LogSink &, OptFlags = opt_all);
 
+/// Look for a compiled object in the cache directory before optimizing and
+/// compiling the module. Newly compiled objects are written to the directory.
+/// The module is compiled as one object so OptFlags::codegenThreads is
+/// ignored
+llvm::ExecutionEngine *generateCode(std::unique_ptr<llvm::Module>, LogSink &, const std::string &, OptFlags = opt_all);
+llvm::ExecutionEngine *generateCode(const Symbols &, LogSink &, const std::string &, OptFlags = opt_all);
+
+/// Optimize the module for the host machine
+void optimizeForHost(llvm::Module &, LogSink &, OptFlags = opt_all);
+/// Write the module as textual IR, assembly or a relocatable object for the
+/// host machine. Extern functions are exported under their own names so the
+/// object can be linked into the host executable
+void emitModule(llvm::Module &, llvm::raw_pwrite_stream &, EmitKind, LogSink &, OptFlags = opt_all);
+
+/// Write the counters of a program compiled with profileGen to a file
+void writeProfile(llvm::ExecutionEngine *, const std::string &, LogSink &);
+
+/// Generate IR in a fresh context and hand it to an ORC JIT that compiles each
+/// function the first time it is called. The addresses returned by getFunc
+/// are lazy stubs. The Symbols must not have been given to generateIR. Errors
+/// that happen while compiling a function are written to the LogSink so it
+/// must outlive the JIT. Calling a function that failed to compile aborts
+std::unique_ptr<llvm::orc::LLLazyJIT> generateLazyCode(const Symbols &, LogSink &, OptFlags = opt_all);
+
 }
 
 #endif
@@ -0,0 +1,84 @@
+//
+//  compile stats.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_compile_stats_hpp
+#define stela_compile_stats_hpp
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <iosfwd>
+#include "log.hpp"
+
+namespace stela {
+
+/// One run of a phase of the compiler
+struct PhaseStats {
+  /// "lexical", "syntax", "semantic", "generate", "optimize" or "codegen"
+  const char *name;
+  /// Microseconds from the creation of the CompileStats to the start of the
+  /// phase
+  uint64_t start;
+  /// Wall time of the phase in microseconds
+  uint64_t duration;
+  /// Peak resident memory of the process at the end of the phase in bytes.
+  /// This is 0 on platforms that don't report it
+  uint64_t peakMemory;
+};
+
+/// Statistics collected by the phases of the compiler. Phases that run more
+/// than once (such as compiling several modules) add to the counts
+struct CompileStats {
+  CompileStats();
+  
+  std::vector<PhaseStats> phases;
+  /// Tokens created by tokenize
+  uint64_t tokens = 0;
+  /// AST nodes created by createAST
+  uint64_t astNodes = 0;
+  /// IR instructions given to optimizeModule
+  uint64_t irBeforeOpt = 0;
+  /// IR instructions left by optimizeModule
+  uint64_t irAfterOpt = 0;
+  /// Bytes of machine code loaded by generateCode
+  uint64_t machineCode = 0;
+  /// Objects that generateCode loaded from the object cache instead of
+  /// compiling
+  uint64_t cachedObjects = 0;
+  /// Functions compiled by the JIT of generateLazyCode. Functions are added
+  /// when they are compiled (the first time they or their callers are called)
+  std::vector<std::string> lazyFunctions;
+  
+  std::chrono::steady_clock::time_point epoch;
+  
+  /// The total wall time of a phase in microseconds
+  uint64_t time(std::string_view) const;
+  /// Write the statistics in the Chrome trace format. The file can be opened
+  /// in chrome://tracing or Perfetto
+  void writeTrace(std::ostream &) const;
+};
+
+/// Record statistics and forward log messages to another sink. A StatsSink
+/// should only be used by one thread at a time
+class StatsSink final : public LogSink {
+public:
+  StatsSink(LogSink &, CompileStats &);
+  
+  bool writeHead(const LogInfo &) override;
+  std::streambuf *getBuf(const LogInfo &) override;
+  void writeTail(const LogInfo &) override;
+  CompileStats *stats() override;
+
+private:
+  LogSink &child;
+  CompileStats &compileStats;
+};
+
+}
+
+#endif
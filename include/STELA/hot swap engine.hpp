@@ -0,0 +1,101 @@
+//
+//  hot swap engine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_hot_swap_engine_hpp
+#define stela_hot_swap_engine_hpp
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "llvm.hpp"
+#include <unordered_map>
+#include "code generation.hpp"
+
+namespace stela {
+
+/// Calls extern functions through a table of slots so that the program can be
+/// reloaded without invalidating the Function objects that refer to it. Each
+/// reload compiles the new version of the program into its own engine and
+/// then swaps the slots. Global variables are defined by the original engine
+/// or by the HotSwapEngine itself so a version only uses them. Calls that are
+/// already running finish in the old code so the code of a replaced version
+/// is kept until collect is called. The original engine is kept until the
+/// HotSwapEngine is destroyed because it holds the slots and the original
+/// global variables
+class HotSwapEngine {
+public:
+  HotSwapEngine(const Symbols &, LogSink &, OptFlags);
+  ~HotSwapEngine();
+  
+  /// Compile a new version of the program and swap every extern function for
+  /// the new version. Functions and global variables are matched by the name
+  /// of their module, their own name and their type. Matching global
+  /// variables keep their values. Other global variables are initialized so a
+  /// variable whose type changes starts again from its initial value. An
+  /// extern function whose signature changes is a new function and the old
+  /// one keeps calling the version that last defined it. If the new version
+  /// fails to compile, the old version keeps running
+  void reload(const Symbols &, LogSink &);
+  /// Free the versions that no slot refers to. Global variables that are no
+  /// longer used by a version in memory are destroyed. This must only be
+  /// called when no calls into a replaced version are running and no closures
+  /// created by a replaced version are alive. Calling this after each reload
+  /// keeps at most one replaced version for each extern function that was
+  /// removed from the program
+  void collect();
+  
+  uint64_t getFunctionAddress(const std::string &) const;
+  uint64_t getGlobalAddress(const std::string &) const;
+  /// The number of times that the program has been reloaded
+  size_t reloads() const;
+  /// The number of reloaded versions that are still in memory
+  size_t retained() const;
+
+private:
+  struct Version;
+  struct Entry {
+    uint64_t stub;
+    std::atomic<void *> *slot;
+    /// The version that the slot points to or null for the original engine
+    Version *impl;
+  };
+  struct Global {
+    void *addr;
+    size_t align;
+    /// The number of versions in memory that use the variable. Variables of
+    /// the original engine are not counted
+    size_t users;
+    bool added;
+  };
+
+  std::unique_ptr<llvm::LLVMContext> baseContext;
+  std::unique_ptr<llvm::ExecutionEngine> baseEngine;
+  // trampolines of the functions that were added by a reload
+  std::unique_ptr<llvm::LLVMContext> stubContext;
+  std::vector<std::unique_ptr<llvm::ExecutionEngine>> stubEngines;
+  // keyed by module name, name and type
+  std::unordered_map<std::string, Entry> entries;
+  std::unordered_map<std::string, Global> globals;
+  // names in the current version
+  std::unordered_map<std::string, const Entry *> funcNames;
+  std::unordered_map<std::string, const Global *> varNames;
+  std::vector<std::unique_ptr<Version>> versions;
+  size_t reloadCount = 0;
+  OptFlags opt;
+  mutable std::mutex mutex;
+  
+  void release(Version &);
+  void destroy(const std::string &, uint64_t);
+};
+
+/// Generate IR and give it to a HotSwapEngine
+std::unique_ptr<HotSwapEngine> generateHotSwapCode(const Symbols &, LogSink &, OptFlags = opt_all);
+
+}
+
+#endif
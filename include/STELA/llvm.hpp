@@ -9,6 +9,9 @@
 #ifndef stela_llvm_hpp
 #define stela_llvm_hpp
 
+#include <memory>
+#include <cstddef>
+
 namespace llvm {
 
 class LLVMContext;
@@ -22,6 +25,38 @@ void quitLLVM();
 [[nodiscard]] llvm::LLVMContext &getLLVM();
 [[nodiscard]] bool hasLLVM();
 
+/// Borrows a context from a pool of contexts. Compilations that use different
+/// contexts can run on different threads at the same time. The context goes
+/// back to the pool when the lease is destroyed so everything that was created
+/// in the context (modules, engines) must be destroyed before the lease.
+/// A context keeps every type and constant created in it so a context is
+/// destroyed instead of being pooled after it has been leased max_uses times
+/// or when the pool already holds max_pooled contexts
+class ContextLease {
+public:
+  static constexpr size_t max_pooled = 8;
+  static constexpr size_t max_uses = 32;
+  
+  ContextLease();
+  ~ContextLease();
+  ContextLease(ContextLease &&) noexcept;
+  ContextLease &operator=(ContextLease &&) noexcept;
+  
+  [[nodiscard]] llvm::LLVMContext &operator*() const noexcept {
+    return *context;
+  }
+  [[nodiscard]] llvm::LLVMContext *get() const noexcept {
+    return context.get();
+  }
+  
+  /// The number of contexts waiting in the pool
+  [[nodiscard]] static size_t pooled();
+  
+private:
+  std::unique_ptr<llvm::LLVMContext> context;
+  size_t uses = 0;
+};
+
 }
 
 #endif
@@ -16,6 +16,8 @@
 
 namespace stela {
 
+struct CompileStats;
+
 /// Logging category
 enum class LogCat : uint8_t {
   lexical,
@@ -65,6 +67,13 @@ public:
   virtual bool writeHead(const LogInfo &) = 0;
   virtual std::streambuf *getBuf(const LogInfo &) = 0;
   virtual void writeTail(const LogInfo &) = 0;
+  
+  /// Whether messages of this category and priority are written. This lets
+  /// the compiler skip work that only produces messages (the default is true)
+  virtual bool enabled(LogCat, LogPri);
+  /// The statistics that each phase of the compiler records to. Statistics
+  /// are not recorded if this is null (the default)
+  virtual CompileStats *stats();
 };
 
 /// Write to a stream
@@ -97,6 +106,7 @@ public:
   bool writeHead(const LogInfo &) override;
   std::streambuf *getBuf(const LogInfo &) override;
   void writeTail(const LogInfo &) override;
+  bool enabled(LogCat, LogPri) override;
 };
 
 class FilterSink final : public LogSink {
@@ -108,6 +118,8 @@ public:
   bool writeHead(const LogInfo &) override;
   std::streambuf *getBuf(const LogInfo &) override;
   void writeTail(const LogInfo &) override;
+  bool enabled(LogCat, LogPri) override;
+  CompileStats *stats() override;
 
 private:
   LogSink &child;
@@ -0,0 +1,48 @@
+//
+//  module linker.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_module_linker_hpp
+#define stela_module_linker_hpp
+
+#include "program.hpp"
+
+namespace stela {
+
+class ObjectMap;
+
+/// Compiles each module of a program to its own object and keeps the objects
+/// in memory. This is only a cache of objects. Each link still generates IR
+/// for the whole program and creates a new Program that runs every global
+/// constructor again, so global variables are not carried over. Only the
+/// optimization and machine code generation of unchanged modules is skipped.
+/// Modules are optimized separately so calls between modules are not inlined.
+/// Use generateCode to compile the whole program for a release build and
+/// HotSwapEngine to keep the state of a running program
+class ModuleLinker {
+public:
+  explicit ModuleLinker(OptFlags = opt_all);
+  ~ModuleLinker();
+  
+  /// Generate a module for each module in the Symbols, compile the modules
+  /// that have changed since the last link and link all of them into a new
+  /// Program. The Symbols must not have been given to generateIR and the
+  /// source they were created from must outlive them
+  Program link(const Symbols &, LogSink &);
+  
+  /// The number of modules that were compiled by the last link
+  size_t compiled() const;
+
+private:
+  std::unique_ptr<ObjectMap> objects;
+  OptFlags opt;
+  size_t compiledModules = 0;
+};
+
+}
+
+#endif
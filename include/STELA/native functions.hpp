@@ -22,7 +22,19 @@ Array<Elem> makeEmptyArray() noexcept {
 
 template <typename Elem>
 Array<Elem> makeArray(const Uint size) noexcept {
-  return make_retain<ArrayStorage<Elem>>(size);
+  using Storage = ArrayStorage<Elem>;
+  if (size > Storage::inline_cap) {
+    return make_retain<Storage>(size);
+  }
+  // The storage and the elements share one allocation
+  Storage *storage = static_cast<Storage *>(
+    allocObject(sizeof(Storage) + sizeof(Elem) * size)
+  );
+  new (storage) Storage{};
+  storage->cap = size;
+  storage->len = size;
+  storage->dat = storage->inlineDat();
+  return Array<Elem>{storage};
 }
 
 template <typename Elem, typename... Args>
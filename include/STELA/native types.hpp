@@ -16,13 +16,24 @@ namespace stela {
 
 template <typename Elem>
 struct ArrayStorage : ref_count {
+  /// Arrays with this many elements or fewer may store them directly after
+  /// the storage
+  static constexpr Uint inline_cap = 16 / sizeof(Elem);
+  static constexpr bool pooled = true;
+  
   ArrayStorage()
     : ref_count{} {}
   explicit ArrayStorage(const Uint len)
     : ref_count{}, cap{len}, len{len}, dat{alloc<Elem>(len)} {}
   ~ArrayStorage() {
     std::destroy_n(dat, len);
-    dealloc(dat);
+    if (dat != inlineDat()) {
+      dealloc(dat);
+    }
+  }
+  
+  Elem *inlineDat() noexcept {
+    return reinterpret_cast<Elem *>(this + 1);
   }
 
   // uint64_t ref
@@ -34,7 +45,13 @@ struct ArrayStorage : ref_count {
 template <typename Elem>
 using Array = retain_ptr<ArrayStorage<Elem>>;
 
+/// An array that can be shared between threads. Requires OptFlags::atomicRefs
+template <typename Elem>
+using SharedArray = atomic_retain_ptr<ArrayStorage<Elem>>;
+
 struct ClosureData : ref_count {
+  static constexpr bool pooled = true;
+  
   ~ClosureData() {
     dtor(this);
   }
@@ -46,11 +63,11 @@ struct ClosureData : ref_count {
 template <typename Fun, bool Method>
 class Function;
 
-template <typename Fun>
+template <typename Fun, bool Atomic = false>
 struct Closure;
 
-template <typename Ret, typename... Params>
-struct Closure<Ret(Params...)> {
+template <typename Ret, typename... Params, bool Atomic>
+struct Closure<Ret(Params...), Atomic> {
   using Func = Function<Ret(ClosureData *, Params...), true>;
   
   template <typename... Args>
@@ -63,9 +80,13 @@ struct Closure<Ret(Params...)> {
     : fun{fun}, dat{nullptr} {}
   
   typename Func::type *fun;
-  retain_ptr<ClosureData> dat;
+  retain_ptr<ClosureData, Atomic> dat;
 };
 
+/// A closure that can be shared between threads. Requires OptFlags::atomicRefs
+template <typename Sig>
+using SharedClosure = Closure<Sig, true>;
+
 }
 
 #endif
@@ -9,16 +9,160 @@
 #ifndef stela_pass_traits_hpp
 #define stela_pass_traits_hpp
 
+#include <utility>
+#include <type_traits>
 #include "native types.hpp"
 
 namespace stela {
 
+/// Small structs are passed in registers when the C++ ABI does the same
+/// thing. This is only implemented for x86-64 System V at the moment
+#if defined(__x86_64__) && !defined(_WIN32)
+constexpr bool register_structs = true;
+#else
+constexpr bool register_structs = false;
+#endif
+
+template <typename, typename>
+struct reflect;
+
+namespace bnd {
+
+template <typename, typename...>
+struct Class;
+
+}
+
+namespace detail {
+
+template <typename T>
+constexpr bool is_bnd_class = false;
+
+template <typename Type, typename... MemTypes>
+constexpr bool is_bnd_class<bnd::Class<Type, MemTypes...>> = true;
+
+template <typename T>
+using reflected_type_t = std::remove_cv_t<std::remove_reference_t<
+  decltype(reflect<T, void>::reflected_type)
+>>;
+
+/// Classes reflected with bnd::Class, either intrusively or by specializing
+/// reflect. Classes reflected as primitives are not opaque
+template <typename T, typename = void>
+constexpr bool is_reflected_class = false;
+
+template <typename T>
+constexpr bool is_reflected_class<T, std::void_t<reflected_type_t<T>>> =
+  is_bnd_class<reflected_type_t<T>>;
+
+template <typename T>
+constexpr bool class_in_registers();
+
+/// Builtin types and structs of builtin types
+template <typename F>
+constexpr bool field_in_registers() {
+  if constexpr (std::is_class_v<F>) {
+    return class_in_registers<F>();
+  } else if constexpr (std::is_enum_v<F>) {
+    return field_in_registers<std::underlying_type_t<F>>();
+  } else {
+    return std::is_same_v<F, Opaq>
+      || std::is_same_v<F, Bool>
+      || std::is_same_v<F, Byte>
+      || std::is_same_v<F, Char>
+      || std::is_same_v<F, Real>
+      || std::is_same_v<F, Sint>
+      || std::is_same_v<F, Uint>;
+  }
+}
+
+/// Converts to any field. Used to count the fields of an aggregate
+struct any_field {
+  template <typename F>
+  operator F() const;
+};
+
+/// Only converts to fields that can be passed in registers. The deleted
+/// conversion stops brace elision from skipping over the other fields
+struct register_field {
+  template <typename F, std::enable_if_t<field_in_registers<F>(), int> = 0>
+  operator F() const;
+  template <typename F, std::enable_if_t<!field_in_registers<F>(), int> = 0>
+  operator F() const = delete;
+};
+
+template <typename T, typename Field, typename Indices, typename = void>
+constexpr bool init_from = false;
+
+template <typename T, typename Field, size_t... Is>
+constexpr bool init_from<
+  T, Field, std::index_sequence<Is...>, std::void_t<decltype(T{(void(Is), Field{})...})>
+> = true;
+
+template <typename T, size_t Count = 0>
+constexpr size_t field_count() {
+  if constexpr (Count <= sizeof(T) && init_from<T, any_field, std::make_index_sequence<Count + 1>>) {
+    return field_count<T, Count + 1>();
+  } else {
+    return Count;
+  }
+}
+
+/// The fields of aggregates are checked recursively. Other classes cannot be
+/// inspected so only the class itself is checked
+template <typename T>
+constexpr bool fields_in_registers() {
+  if constexpr (std::is_aggregate_v<T>) {
+    return init_from<T, register_field, std::make_index_sequence<field_count<T>()>>;
+  } else {
+    return true;
+  }
+}
+
+template <typename T>
+constexpr bool class_in_registers() {
+  if constexpr (register_structs
+    && std::is_class_v<T>
+    && std::is_trivially_copyable_v<T>
+    && !std::is_empty_v<T>
+    && sizeof(T) <= 16
+    && !is_reflected_class<T>
+  ) {
+    return fields_in_registers<T>();
+  } else {
+    return false;
+  }
+}
+
+}
+
+/// Stela structs of builtin types that are no larger than 16 bytes. Reflected
+/// classes are opaque to Stela so they are always passed by pointer, as is any
+/// struct that contains one
+template <typename T>
+constexpr bool pass_in_registers = detail::class_in_registers<T>();
+
 template <typename, typename = void>
 struct pass_traits;
 
+/// Small classes
+template <typename T>
+struct pass_traits<T, std::enable_if_t<pass_in_registers<T>>> {
+  using type = T;
+  
+  static type unwrap(const T &arg) noexcept {
+    return arg;
+  }
+  static T wrap(const type arg) noexcept {
+    return arg;
+  }
+  
+  static constexpr bool nontrivial = false;
+};
+
 /// Classes
 template <typename T>
-struct pass_traits<T, std::enable_if_t<std::is_class_v<T>>> {
+struct pass_traits<T, std::enable_if_t<std::is_class_v<T> && !pass_in_registers<T>>> {
   using type = const T *;
   
   static type unwrap(const T &arg) noexcept {
@@ -0,0 +1,59 @@
+//
+//  program.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_program_hpp
+#define stela_program_hpp
+
+#include "llvm.hpp"
+#include "code generation.hpp"
+
+namespace stela {
+
+/// Owns an ExecutionEngine created by generateCode and the context it was
+/// created in. When the Program is destroyed, the destructors of global
+/// variables are called, the code and data sections of the engine are freed
+/// and then the context is destroyed
+class Program {
+public:
+  Program() noexcept = default;
+  explicit Program(llvm::ExecutionEngine *) noexcept;
+  /// The engine was created in the context
+  Program(llvm::ExecutionEngine *, std::unique_ptr<llvm::LLVMContext>) noexcept;
+  ~Program();
+  
+  Program(Program &&) noexcept;
+  Program &operator=(Program &&) noexcept;
+  
+  [[nodiscard]] llvm::ExecutionEngine *get() const noexcept {
+    return engine;
+  }
+  [[nodiscard]] llvm::ExecutionEngine *operator->() const noexcept {
+    return engine;
+  }
+  explicit operator bool() const noexcept {
+    return engine != nullptr;
+  }
+  
+  /// Call the global destructors and destroy the engine
+  void reset() noexcept;
+
+private:
+  // destroyed after the engine
+  std::unique_ptr<llvm::LLVMContext> context;
+  llvm::ExecutionEngine *engine = nullptr;
+};
+
+/// Generate IR in a new context and compile it. The context is destroyed with
+/// the Program so memory doesn't grow as programs are reloaded. Programs can
+/// be generated on different threads at the same time
+Program generateProgram(const Symbols &, LogSink &, OptFlags = opt_all);
+Program generateProgram(std::unique_ptr<llvm::Module>, LogSink &, OptFlags = opt_all);
+
+}
+
+#endif
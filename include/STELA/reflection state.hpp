@@ -18,10 +18,10 @@ namespace stela {
 std::string mangledName(std::string_view);
 std::string mangledName(const std::string &);
 
+/// Specialized for reflectible types. The primary template is left undefined
+/// so that pass_traits can detect whether a type has been reflected
 template <typename Type, typename = void>
-struct reflect {
-  static_assert(sizeof(Type) == 0, "Type is not reflectible");
-};
+struct reflect;
 
 namespace detail {
 
@@ -20,14 +20,14 @@ struct reflect<Type, std::void_t<detail::basic_reflectible<Type>>> : detail::wit
   static inline const auto &reflected_type = Type::reflected_type;
 };
 
-template <typename Elem>
-struct reflect<Array<Elem>> {
+template <typename Elem, bool Atomic>
+struct reflect<retain_ptr<ArrayStorage<Elem>, Atomic>> {
   static constexpr std::string_view reflected_name = "";
   static inline const auto reflected_type = bnd::Array<Elem>{};
 };
 
-template <typename Sig>
-struct reflect<Closure<Sig>> {
+template <typename Sig, bool Atomic>
+struct reflect<Closure<Sig, Atomic>> {
   static constexpr std::string_view reflected_name = "";
   static inline const auto reflected_type = bnd::Closure<Sig>{};
 };
@@ -13,7 +13,7 @@
 #include <cstdint>
 #include <utility>
 #include <cassert>
-#include <cstdlib>
+#include "allocator.hpp"
 
 /* LCOV_EXCL_START */
 
@@ -21,31 +21,92 @@ namespace stela {
 
 template <typename T>
 T *alloc(const size_t count = 1) noexcept {
-  return static_cast<T *>(std::malloc(sizeof(T) * count));
+  return static_cast<T *>(allocBytes(sizeof(T) * count));
 }
 
 inline void dealloc(void *const ptr) noexcept {
-  std::free(ptr);
+  deallocBytes(ptr);
 }
 
-template <typename T>
+template <typename T, bool Atomic = false>
 class retain_ptr;
 
 struct ref_count {
-  template <typename T>
+  template <typename T, bool Atomic>
   friend class retain_ptr;
   
+  /// Types shared with compiled code set this to true so that they are
+  /// allocated with allocObject instead of allocBytes
+  static constexpr bool pooled = false;
+  
 protected:
   ref_count() = default;
 
 private:
   uint64_t count = 1;
+  
+  template <bool Atomic>
+  uint64_t load() const noexcept {
+    if constexpr (Atomic) {
+      return __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+    } else {
+      return count;
+    }
+  }
+  
+  template <bool Atomic>
+  void retain() noexcept {
+    if constexpr (Atomic) {
+      __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+    } else {
+      ++count;
+    }
+  }
+  
+  /// Returns true if the last reference was released
+  template <bool Atomic>
+  bool release() noexcept {
+    if constexpr (Atomic) {
+      // The sole owner doesn't need to synchronize with anyone
+      if (__atomic_load_n(&count, __ATOMIC_ACQUIRE) == 1) {
+        return true;
+      }
+      if (__atomic_sub_fetch(&count, 1, __ATOMIC_RELEASE) == 0) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return true;
+      }
+      return false;
+    } else {
+      return --count == 0;
+    }
+  }
 };
 
+template <typename T>
+T *allocRef() noexcept {
+  if constexpr (T::pooled) {
+    return static_cast<T *>(allocObject(sizeof(T)));
+  } else {
+    return alloc<T>();
+  }
+}
+
+template <typename T>
+void deallocRef(T *const ptr) noexcept {
+  if constexpr (T::pooled) {
+    deallocObject(ptr);
+  } else {
+    dealloc(ptr);
+  }
+}
+
 struct retain_t {};
 constexpr retain_t retain {};
 
-template <typename T>
+/// Shared ownership of an object derived from ref_count. The reference count
+/// is updated atomically if Atomic is true. Use atomic_retain_ptr for objects
+/// that are shared between threads
+template <typename T, bool Atomic>
 class retain_ptr {
 public:
   using element_type = T;
@@ -75,41 +136,41 @@ public:
   
   // Move constructors
   template <typename U>
-  retain_ptr(retain_ptr<U> &&other) noexcept
+  retain_ptr(retain_ptr<U, Atomic> &&other) noexcept
     : ptr{other.detach()} {}
-  retain_ptr(retain_ptr<T> &&other) noexcept
+  retain_ptr(retain_ptr &&other) noexcept
     : ptr{other.detach()} {}
   
   // Move assignment
   template <typename U>
-  retain_ptr &operator=(retain_ptr<U> &&other) noexcept {
+  retain_ptr &operator=(retain_ptr<U, Atomic> &&other) noexcept {
     reset(other.detach());
     return *this;
   }
-  retain_ptr &operator=(retain_ptr<T> &&other) noexcept {
+  retain_ptr &operator=(retain_ptr &&other) noexcept {
     reset(other.detach());
     return *this;
   }
   
   // Copy constructors
   template <typename U>
-  retain_ptr(const retain_ptr<U> &other) noexcept
+  retain_ptr(const retain_ptr<U, Atomic> &other) noexcept
     : ptr{other.get()} {
     incr();
   }
-  retain_ptr(const retain_ptr<T> &other) noexcept
+  retain_ptr(const retain_ptr &other) noexcept
     : ptr{other.get()} {
     incr();
   }
   
   // Copy assignment
   template <typename U>
-  retain_ptr &operator=(const retain_ptr<U> &other) noexcept {
+  retain_ptr &operator=(const retain_ptr<U, Atomic> &other) noexcept {
     reset(other.get());
     incr();
     return *this;
   }
-  retain_ptr &operator=(const retain_ptr<T> &other) noexcept {
+  retain_ptr &operator=(const retain_ptr &other) noexcept {
     reset(other.get());
     incr();
     return *this;
@@ -127,7 +188,7 @@ public:
     incr();
   }
   
-  void swap(retain_ptr<T> &other) noexcept {
+  void swap(retain_ptr &other) noexcept {
     std::swap(ptr, other.ptr);
   }
   [[nodiscard]] pointer detach() noexcept {
@@ -152,7 +213,7 @@ public:
   uint64_t use_count() const noexcept {
     if (ptr) {
       ref_count *const refPtr = ptr;
-      return refPtr->count;
+      return refPtr->load<Atomic>();
     } else {
       return 0;
     }
@@ -161,60 +222,60 @@ public:
     return use_count() == 1;
   }
   
-  bool operator==(const retain_ptr<T> &rhs) const noexcept {
+  bool operator==(const retain_ptr &rhs) const noexcept {
     return ptr == rhs.ptr;
   }
-  bool operator!=(const retain_ptr<T> &rhs) const noexcept {
+  bool operator!=(const retain_ptr &rhs) const noexcept {
     return ptr != rhs.ptr;
   }
-  bool operator<(const retain_ptr<T> &rhs) const noexcept {
+  bool operator<(const retain_ptr &rhs) const noexcept {
     return ptr < rhs.ptr;
   }
-  bool operator>(const retain_ptr<T> &rhs) const noexcept {
+  bool operator>(const retain_ptr &rhs) const noexcept {
     return ptr > rhs.ptr;
   }
-  bool operator<=(const retain_ptr<T> &rhs) const noexcept {
+  bool operator<=(const retain_ptr &rhs) const noexcept {
     return ptr <= rhs.ptr;
   }
-  bool operator>=(const retain_ptr<T> &rhs) const noexcept {
+  bool operator>=(const retain_ptr &rhs) const noexcept {
     return ptr >= rhs.ptr;
   }
   
-  friend bool operator==(const retain_ptr<T> &lhs, std::nullptr_t) noexcept {
+  friend bool operator==(const retain_ptr &lhs, std::nullptr_t) noexcept {
     return lhs.ptr == nullptr;
   }
-  friend bool operator!=(const retain_ptr<T> &lhs, std::nullptr_t) noexcept {
+  friend bool operator!=(const retain_ptr &lhs, std::nullptr_t) noexcept {
     return lhs.ptr != nullptr;
   }
-  friend bool operator<(const retain_ptr<T> &lhs, std::nullptr_t) noexcept {
+  friend bool operator<(const retain_ptr &lhs, std::nullptr_t) noexcept {
     return lhs.ptr < nullptr;
   }
-  friend bool operator>(const retain_ptr<T> &lhs, std::nullptr_t) noexcept {
+  friend bool operator>(const retain_ptr &lhs, std::nullptr_t) noexcept {
     return lhs.ptr > nullptr;
   }
-  friend bool operator<=(const retain_ptr<T> &lhs, std::nullptr_t) noexcept {
+  friend bool operator<=(const retain_ptr &lhs, std::nullptr_t) noexcept {
     return lhs.ptr <= nullptr;
   }
-  friend bool operator>=(const retain_ptr<T> &lhs, std::nullptr_t) noexcept {
+  friend bool operator>=(const retain_ptr &lhs, std::nullptr_t) noexcept {
     return lhs.ptr >= nullptr;
   }
   
-  friend bool operator==(std::nullptr_t, const retain_ptr<T> &rhs) noexcept {
+  friend bool operator==(std::nullptr_t, const retain_ptr &rhs) noexcept {
     return nullptr == rhs.ptr;
   }
-  friend bool operator!=(std::nullptr_t, const retain_ptr<T> &rhs) noexcept {
+  friend bool operator!=(std::nullptr_t, const retain_ptr &rhs) noexcept {
     return nullptr != rhs.ptr;
   }
-  friend bool operator<(std::nullptr_t, const retain_ptr<T> &rhs) noexcept {
+  friend bool operator<(std::nullptr_t, const retain_ptr &rhs) noexcept {
     return nullptr < rhs.ptr;
   }
-  friend bool operator>(std::nullptr_t, const retain_ptr<T> &rhs) noexcept {
+  friend bool operator>(std::nullptr_t, const retain_ptr &rhs) noexcept {
     return nullptr > rhs.ptr;
   }
-  friend bool operator<=(std::nullptr_t, const retain_ptr<T> &rhs) noexcept {
+  friend bool operator<=(std::nullptr_t, const retain_ptr &rhs) noexcept {
     return nullptr <= rhs.ptr;
   }
-  friend bool operator>=(std::nullptr_t, const retain_ptr<T> &rhs) noexcept {
+  friend bool operator>=(std::nullptr_t, const retain_ptr &rhs) noexcept {
     return nullptr >= rhs.ptr;
   }
 
@@ -224,18 +285,18 @@ private:
   void incr() const noexcept {
     if (ptr) {
       ref_count *const refPtr = ptr;
-      assert(refPtr->count != ~uint64_t{});
-      ++refPtr->count;
+      assert(refPtr->load<Atomic>() != ~uint64_t{});
+      refPtr->retain<Atomic>();
     }
   }
   
   void decr() const noexcept {
     if (ptr) {
       ref_count *const refPtr = ptr;
-      assert(refPtr->count != 0);
-      if (--refPtr->count == 0) {
+      assert(refPtr->load<Atomic>() != 0);
+      if (refPtr->release<Atomic>()) {
         ptr->~T();
-        dealloc(ptr);
+        deallocRef(ptr);
       }
     }
   }
@@ -248,42 +309,45 @@ template <typename T>
 retain_ptr(retain_t, T *) -> retain_ptr<T>;
 
 template <typename T>
-void swap(retain_ptr<T> &a, retain_ptr<T> &b) {
+using atomic_retain_ptr = retain_ptr<T, true>;
+
+template <typename T, bool Atomic>
+void swap(retain_ptr<T, Atomic> &a, retain_ptr<T, Atomic> &b) {
   a.swap(b);
 }
 
 template <typename T, typename... Args>
 retain_ptr<T> make_retain(Args &&... args) noexcept {
-  T *ptr = alloc<T>();
+  T *ptr = allocRef<T>();
   new (ptr) T{std::forward<Args>(args)...};
   return retain_ptr<T>{ptr};
 }
 
-template <typename Dst, typename Src>
-retain_ptr<Dst> static_pointer_cast(const retain_ptr<Src> &src) noexcept {
-  return retain_ptr{retain, static_cast<Dst *>(src.get())};
+template <typename Dst, bool Atomic, typename Src>
+retain_ptr<Dst, Atomic> static_pointer_cast(const retain_ptr<Src, Atomic> &src) noexcept {
+  return retain_ptr<Dst, Atomic>{retain, static_cast<Dst *>(src.get())};
 }
 
-template <typename Dst, typename Src>
-retain_ptr<Dst> static_pointer_cast(retain_ptr<Src> &&src) noexcept {
-  return retain_ptr{static_cast<Dst *>(src.detach())};
+template <typename Dst, bool Atomic, typename Src>
+retain_ptr<Dst, Atomic> static_pointer_cast(retain_ptr<Src, Atomic> &&src) noexcept {
+  return retain_ptr<Dst, Atomic>{static_cast<Dst *>(src.detach())};
 }
 
-template <typename Derived, typename Base>
-retain_ptr<Derived> dynamic_pointer_cast(const retain_ptr<Base> &base) noexcept {
-  return retain_ptr{retain, dynamic_cast<Derived *>(base.get())};
+template <typename Derived, bool Atomic, typename Base>
+retain_ptr<Derived, Atomic> dynamic_pointer_cast(const retain_ptr<Base, Atomic> &base) noexcept {
+  return retain_ptr<Derived, Atomic>{retain, dynamic_cast<Derived *>(base.get())};
 }
 
-template <typename Derived, typename Base>
-retain_ptr<Derived> dynamic_pointer_cast(retain_ptr<Base> &&base) noexcept {
-  return retain_ptr{dynamic_cast<Derived *>(base.detach())};
+template <typename Derived, bool Atomic, typename Base>
+retain_ptr<Derived, Atomic> dynamic_pointer_cast(retain_ptr<Base, Atomic> &&base) noexcept {
+  return retain_ptr<Derived, Atomic>{dynamic_cast<Derived *>(base.detach())};
 }
 
 }
 
-template <typename T>
-struct std::hash<stela::retain_ptr<T>> {
-  size_t operator()(const stela::retain_ptr<T> &ptr) const noexcept {
+template <typename T, bool Atomic>
+struct std::hash<stela::retain_ptr<T, Atomic>> {
+  size_t operator()(const stela::retain_ptr<T, Atomic> &ptr) const noexcept {
     return reinterpret_cast<size_t>(ptr.get());
   }
 };
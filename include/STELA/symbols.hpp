@@ -173,8 +173,16 @@ struct Builtins {
 
 namespace stela {
 
+/// A module that has been compiled into a Symbols
+struct ModuleDecls {
+  std::string name;
+  /// One past the last declaration of the module in Symbols::decls
+  size_t end;
+};
+
 struct Symbols {
   ast::Decls decls;
+  std::vector<ModuleDecls> modules;
   sym::Scopes scopes;
   sym::Builtins builtins;
   sym::Scope *global;
@@ -0,0 +1,79 @@
+//
+//  tiered engine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_tiered_engine_hpp
+#define stela_tiered_engine_hpp
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "code generation.hpp"
+#include <condition_variable>
+
+namespace llvm {
+
+class LLVMContext;
+
+}
+
+namespace stela {
+
+/// Compiles the program quickly without optimizations and counts calls to each
+/// extern function. Functions that are called often enough are swapped for
+/// versions compiled with optimizations on a background thread. Calls between
+/// extern functions are counted too. Other functions are only optimized as
+/// part of the extern functions that call them. Errors on the background
+/// thread are written to the LogSink so it must outlive the engine
+class TieredEngine {
+public:
+  TieredEngine(std::unique_ptr<llvm::Module>, LogSink &, uint64_t, OptFlags);
+  ~TieredEngine();
+  
+  uint64_t getFunctionAddress(const std::string &) const;
+  uint64_t getGlobalAddress(const std::string &) const;
+  /// The number of functions that have been swapped for optimized versions
+  size_t optimized() const;
+
+private:
+  struct Entry {
+    std::string name;
+    std::atomic<uint64_t> *count;
+    std::atomic<void *> *slot;
+    bool swapped;
+  };
+
+  std::unique_ptr<llvm::ExecutionEngine> baseEngine;
+  std::unique_ptr<llvm::LLVMContext> optContext;
+  std::unique_ptr<llvm::ExecutionEngine> optEngine;
+  std::vector<Entry> entries;
+  std::string bitcode;
+  LogSink &sink;
+  uint64_t threshold;
+  OptFlags opt;
+  std::atomic<size_t> swapped;
+  std::mutex mutex;
+  std::condition_variable wake;
+  /// The number of functions that have reached the threshold
+  size_t hot;
+  bool stop;
+  std::thread thread;
+  
+  static void notifyHot(void *);
+  void run();
+  bool wait(size_t &);
+  bool compileOptimized();
+};
+
+/// Generate IR and give it to a TieredEngine. Functions are optimized after
+/// they have been called the given number of times
+std::unique_ptr<TieredEngine> generateTieredCode(const Symbols &, LogSink &, uint64_t = 1000, OptFlags = opt_all);
+
+}
+
+#endif
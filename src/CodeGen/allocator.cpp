@@ -0,0 +1,287 @@
+//
+//  allocator.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "allocator.hpp"
+
+#include <algorithm>
+
+using namespace stela;
+
+namespace {
+
+constexpr size_t max_align = alignof(std::max_align_t);
+
+size_t roundUp(const size_t size) {
+  return (std::max(size, size_t{1}) + max_align - 1) & ~(max_align - 1);
+}
+
+/// Stored before each block allocated from a PoolAllocator
+struct alignas(std::max_align_t) PoolHeader {
+  size_t sizeClass;
+};
+
+constexpr size_t slab_size = 64 * 1024;
+
+/// Stored before each block allocated by objectAlloc
+struct alignas(std::max_align_t) ObjectHeader {
+  /// The allocator that the block came from or null if it came from malloc
+  const Allocator *origin;
+  size_t sizeClass;
+};
+
+ObjectHeader *headerOf(void *const ptr) noexcept {
+  return static_cast<ObjectHeader *>(ptr) - 1;
+}
+
+// Set when the free lists of the thread are destroyed. Objects may still be
+// released by the destructors of other thread local objects after that
+thread_local bool freeListsDestroyed = false;
+
+/// Thread local free lists used by objectAlloc and objectFree. Blocks are
+/// allocated individually so that they outlive the thread that allocated
+/// them. The blocks are given back to malloc when the thread exits. After
+/// that, blocks are allocated and freed with malloc and free
+class ObjectFreeLists {
+public:
+  static constexpr size_t granularity = PoolAllocator::granularity;
+  static constexpr size_t max_size = PoolAllocator::max_size;
+  /// Free lists longer than this give their blocks back to free
+  static constexpr size_t max_cached = 1024;
+  
+  ObjectFreeLists() = default;
+  ~ObjectFreeLists() {
+    flush();
+    freeListsDestroyed = true;
+  }
+  
+  ObjectFreeLists(const ObjectFreeLists &) = delete;
+  ObjectFreeLists &operator=(const ObjectFreeLists &) = delete;
+  
+  void *alloc(const size_t size) noexcept {
+    // Blocks that are not in a size class are never put in the free lists
+    const size_t sizeClass = size > max_size || freeListsDestroyed ? class_count : classOf(size);
+    if (sizeClass != class_count) {
+      if (Node *node = freeLists[sizeClass]) {
+        freeLists[sizeClass] = node->next;
+        --lengths[sizeClass];
+        return node;
+      }
+    }
+    const size_t bytes = sizeClass == class_count ? size : (sizeClass + 1) * granularity;
+    auto *header = static_cast<ObjectHeader *>(std::malloc(sizeof(ObjectHeader) + bytes));
+    if (!header) {
+      return nullptr;
+    }
+    header->origin = nullptr;
+    header->sizeClass = sizeClass;
+    return header + 1;
+  }
+  
+  void free(void *const ptr) noexcept {
+    ObjectHeader *header = headerOf(ptr);
+    const size_t sizeClass = header->sizeClass;
+    if (freeListsDestroyed || sizeClass == class_count || lengths[sizeClass] == max_cached) {
+      std::free(header);
+      return;
+    }
+    Node *node = static_cast<Node *>(ptr);
+    node->next = freeLists[sizeClass];
+    freeLists[sizeClass] = node;
+    ++lengths[sizeClass];
+  }
+  
+  void flush() noexcept {
+    for (size_t c = 0; c != class_count; ++c) {
+      while (freeLists[c]) {
+        std::free(headerOf(std::exchange(freeLists[c], freeLists[c]->next)));
+      }
+      lengths[c] = 0;
+    }
+  }
+  
+private:
+  static constexpr size_t class_count = max_size / granularity;
+  
+  struct Node {
+    Node *next;
+  };
+  
+  Node *freeLists[class_count] = {};
+  size_t lengths[class_count] = {};
+  
+  static size_t classOf(const size_t size) noexcept {
+    return size == 0 ? 0 : (size - 1) / granularity;
+  }
+};
+
+thread_local ObjectFreeLists objectFreeLists;
+
+}
+
+void *stela::objectAlloc(const Allocator *allocator, const size_t size) noexcept {
+  if (!allocator) {
+    return objectFreeLists.alloc(size);
+  }
+  void *block = allocator->alloc(allocator->self, sizeof(ObjectHeader) + size);
+  if (!block) {
+    return nullptr;
+  }
+  auto *header = static_cast<ObjectHeader *>(block);
+  header->origin = allocator;
+  return header + 1;
+}
+
+void stela::objectFree(void *const ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  ObjectHeader *header = headerOf(ptr);
+  if (const Allocator *origin = header->origin) {
+    origin->free(origin->self, header);
+  } else {
+    objectFreeLists.free(ptr);
+  }
+}
+
+void stela::flushObjectFreeLists() noexcept {
+  objectFreeLists.flush();
+}
+
+struct alignas(std::max_align_t) ArenaAllocator::Block {
+  Block *next;
+  size_t size;
+};
+
+ArenaAllocator::ArenaAllocator(const size_t blockSize)
+  : tab{
+      [](void *self, const size_t size) {
+        return static_cast<ArenaAllocator *>(self)->alloc(size);
+      },
+      [](void *, void *) {},
+      this
+    },
+    blockSize{blockSize} {}
+
+ArenaAllocator::~ArenaAllocator() {
+  while (head) {
+    std::free(std::exchange(head, head->next));
+  }
+}
+
+void *ArenaAllocator::alloc(size_t size) noexcept {
+  // Rounding keeps every block aligned and stops two blocks from being
+  // adjacent, which the inline storage of arrays relies on
+  size = roundUp(size);
+  if (static_cast<size_t>(end - pos) < size && !grow(size)) {
+    return nullptr;
+  }
+  usedBytes += size;
+  return std::exchange(pos, pos + size);
+}
+
+void ArenaAllocator::reset() noexcept {
+  if (!head) {
+    return;
+  }
+  // The oldest block is at the end of the list
+  while (head->next) {
+    std::free(std::exchange(head, head->next));
+  }
+  pos = reinterpret_cast<char *>(head + 1);
+  end = pos + head->size;
+  usedBytes = 0;
+}
+
+bool ArenaAllocator::grow(const size_t size) noexcept {
+  const size_t bytes = std::max(size, blockSize);
+  Block *block = static_cast<Block *>(std::malloc(sizeof(Block) + bytes));
+  if (!block) {
+    return false;
+  }
+  block->next = head;
+  block->size = bytes;
+  head = block;
+  pos = reinterpret_cast<char *>(block + 1);
+  end = pos + bytes;
+  return true;
+}
+
+struct PoolAllocator::Node {
+  Node *next;
+};
+
+struct alignas(std::max_align_t) PoolAllocator::Slab {
+  Slab *next;
+};
+
+PoolAllocator::PoolAllocator()
+  : tab{
+      [](void *self, const size_t size) {
+        return static_cast<PoolAllocator *>(self)->alloc(size);
+      },
+      [](void *self, void *ptr) {
+        static_cast<PoolAllocator *>(self)->free(ptr);
+      },
+      this
+    } {}
+
+PoolAllocator::~PoolAllocator() {
+  while (slabs) {
+    std::free(std::exchange(slabs, slabs->next));
+  }
+}
+
+void *PoolAllocator::alloc(const size_t size) noexcept {
+  if (size > max_size) {
+    auto *header = static_cast<PoolHeader *>(std::malloc(sizeof(PoolHeader) + size));
+    if (!header) {
+      return nullptr;
+    }
+    header->sizeClass = class_count;
+    return header + 1;
+  }
+  
+  const size_t sizeClass = size == 0 ? 0 : (size - 1) / granularity;
+  if (Node *node = freeLists[sizeClass]) {
+    freeLists[sizeClass] = node->next;
+    return node;
+  }
+  const size_t bytes = sizeof(PoolHeader) + (sizeClass + 1) * granularity;
+  if (static_cast<size_t>(end - pos) < bytes && !grow()) {
+    return nullptr;
+  }
+  auto *header = reinterpret_cast<PoolHeader *>(std::exchange(pos, pos + bytes));
+  header->sizeClass = sizeClass;
+  return header + 1;
+}
+
+void PoolAllocator::free(void *const ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  PoolHeader *header = static_cast<PoolHeader *>(ptr) - 1;
+  if (header->sizeClass == class_count) {
+    std::free(header);
+    return;
+  }
+  Node *node = static_cast<Node *>(ptr);
+  node->next = freeLists[header->sizeClass];
+  freeLists[header->sizeClass] = node;
+}
+
+bool PoolAllocator::grow() noexcept {
+  Slab *slab = static_cast<Slab *>(std::malloc(sizeof(Slab) + slab_size));
+  if (!slab) {
+    return false;
+  }
+  slab->next = slabs;
+  slabs = slab;
+  pos = reinterpret_cast<char *>(slab + 1);
+  end = pos + slab_size;
+  return true;
+}
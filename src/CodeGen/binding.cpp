@@ -8,12 +8,52 @@
 
 #include "binding.hpp"
 
+#include "tiered engine.hpp"
+#include "hot swap engine.hpp"
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 
+namespace {
+
+uint64_t lookupAddress(llvm::orc::LLJIT *jit, const std::string &name) {
+  if (auto symbol = jit->lookup(name)) {
+    return symbol->getAddress();
+  } else {
+    llvm::consumeError(symbol.takeError());
+    return 0;
+  }
+}
+
+}
+
 uint64_t stela::getFunctionAddress(llvm::ExecutionEngine *engine, const std::string &name) {
   return engine->getFunctionAddress(name);
 }
 
+uint64_t stela::getFunctionAddress(llvm::orc::LLJIT *jit, const std::string &name) {
+  return lookupAddress(jit, name);
+}
+
+uint64_t stela::getFunctionAddress(TieredEngine *engine, const std::string &name) {
+  return engine->getFunctionAddress(name);
+}
+
+uint64_t stela::getFunctionAddress(HotSwapEngine *engine, const std::string &name) {
+  return engine->getFunctionAddress(name);
+}
+
 uint64_t stela::getGlobalAddress(llvm::ExecutionEngine *engine, const std::string &name) {
   return engine->getGlobalValueAddress(name);
 }
+
+uint64_t stela::getGlobalAddress(llvm::orc::LLJIT *jit, const std::string &name) {
+  return lookupAddress(jit, name);
+}
+
+uint64_t stela::getGlobalAddress(TieredEngine *engine, const std::string &name) {
+  return engine->getGlobalAddress(name);
+}
+
+uint64_t stela::getGlobalAddress(HotSwapEngine *engine, const std::string &name) {
+  return engine->getGlobalAddress(name);
+}
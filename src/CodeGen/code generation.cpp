@@ -8,68 +8,218 @@
 
 #include "code generation.hpp"
 
+#include <cstdlib>
+#include <optional>
 #include "llvm.hpp"
-#include "generate decl.hpp"
+#include "perf map.hpp"
+#include "host machine.hpp"
+#include "object cache.hpp"
 #include "Log/log output.hpp"
-#include <llvm/IR/Verifier.h>
+#include "generate module.hpp"
 #include "optimize module.hpp"
+#include "Log/phase timer.hpp"
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/CodeGen/ParallelCG.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
 
-std::unique_ptr<llvm::Module> stela::generateIR(const Symbols &syms, LogSink &sink) {
+using namespace stela;
+
+std::unique_ptr<llvm::Module> stela::generateIR(
+  const Symbols &syms,
+  LogSink &sink,
+  const OptFlags opt
+) {
   Log log{sink, LogCat::generate};
-  log.status() << "Generating code" << endlog;
-  
-  auto module = std::make_unique<llvm::Module>("", getLLVM());
-  // @TODO how do we get the native target machine object?
-  // module->setTargetTriple(machine->getTargetTriple().str());
-  // module->setDataLayout(machine->createDataLayout());
-  FuncInst inst{module.get()};
-  gen::Ctx ctx {module->getContext(), module.get(), inst, log};
-  generateDecl(ctx, module.get(), syms.decls);
-  
-  std::string str;
-  llvm::raw_string_ostream strStream(str);
-  if (llvm::verifyModule(*module, &strStream)) {
-    strStream.flush();
-    log.error() << str << fatal;
-  }
-  
-  return module;
+  PhaseTimer timer{sink.stats(), "generate"};
+  return generateModule(getLLVM(), syms, log, nullptr, opt);
+}
+
+std::unique_ptr<llvm::Module> stela::generateIR(
+  const Symbols &syms,
+  LogSink &sink,
+  llvm::LLVMContext &context,
+  const OptFlags opt
+) {
+  Log log{sink, LogCat::generate};
+  PhaseTimer timer{sink.stats(), "generate"};
+  return generateModule(context, syms, log, nullptr, opt);
 }
 
 namespace {
 
-llvm::CodeGenOpt::Level codeGenOpt(const bool optimize) {
-  return optimize ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None;
+template <typename Value>
+Value check(Log &log, llvm::Expected<Value> value) {
+  if (!value) {
+    log.error() << llvm::toString(value.takeError()) << fatal;
+  }
+  return std::move(*value);
 }
 
+void check(Log &log, llvm::Error error) {
+  if (error) {
+    log.error() << llvm::toString(std::move(error)) << fatal;
+  }
 }
 
-llvm::ExecutionEngine *stela::generateCode(
+llvm::CodeGenOpt::Level codeGenOpt(const bool optimize) {
+  return optimize ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None;
+}
+
+llvm::ExecutionEngine *createEngine(
   std::unique_ptr<llvm::Module> module,
-  LogSink &sink,
+  Log &log,
   const OptFlags opt
 ) {
-  Log log{sink, LogCat::generate};
-  
   std::string str;
-  llvm::Module *modulePtr = module.get();
+  const llvm::Module &mod = *module;
   auto engine = llvm::EngineBuilder(std::move(module))
                 .setErrorStr(&str)
                 .setOptLevel(codeGenOpt(opt.optimizeASM))
                 .setEngineKind(llvm::EngineKind::JIT)
+                .setMCPU(hostCPU(opt))
+                .setMAttrs(hostFeatures(opt))
                 .create();
   if (engine == nullptr) {
     log.error() << str << fatal;
   }
+  if (opt.perf) {
+    registerPerfListeners(engine, mod);
+  }
+  return engine;
+}
+
+// Times code generation and adds up the size of the code sections of the
+// objects that the engine loads in the meantime
+class CodegenStats final : public llvm::JITEventListener {
+public:
+  CodegenStats(llvm::ExecutionEngine *engine, CompileStats *stats)
+    : engine{engine}, stats{stats}, timer{stats, "codegen"} {
+    if (stats) {
+      engine->RegisterJITEventListener(this);
+    }
+  }
+  ~CodegenStats() {
+    if (stats) {
+      engine->UnregisterJITEventListener(this);
+    }
+  }
   
-  if (opt.optimizeIR) {
-    optimizeModule(engine->getTargetMachine(), modulePtr, opt);
+  void notifyObjectLoaded(
+    ObjectKey,
+    const llvm::object::ObjectFile &obj,
+    const llvm::RuntimeDyld::LoadedObjectInfo &
+  ) override {
+    for (const llvm::object::SectionRef &section : obj.sections()) {
+      if (section.isText()) {
+        stats->machineCode += section.getSize();
+      }
+    }
   }
+  
+private:
+  llvm::ExecutionEngine *engine;
+  CompileStats *stats;
+  PhaseTimer timer;
+};
+
+void finalize(llvm::ExecutionEngine *engine, CompileStats *stats) {
+  CodegenStats codegen{engine, stats};
   engine->finalizeObject();
+}
+
+void lowerCtorLists(llvm::Module *module) {
+  lowerCtorList(module, "llvm.global_ctors", "stela.ctors");
+  lowerCtorList(module, "llvm.global_dtors", "stela.dtors");
+}
+
+void runCtors(llvm::ExecutionEngine *engine) {
+  // stela.dtors is called by Program
+  using Ctors = void() noexcept;
+  reinterpret_cast<Ctors *>(engine->getFunctionAddress("stela.ctors"))();
+}
+
+llvm::ExecutionEngine *generateParallelCode(
+  std::unique_ptr<llvm::Module> module,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  Log log{sink, LogCat::generate};
+  
+  // The engine is given an empty module and the objects are added to it
+  llvm::ExecutionEngine *engine = createEngine(
+    std::make_unique<llvm::Module>("", module->getContext()), log, opt
+  );
+  
+  lowerCtorLists(module.get());
+  if (shouldOptimize(opt)) {
+    check(log, optimizeModule(engine->getTargetMachine(), module.get(), opt, &sink));
+  }
+  
+  std::optional<CodegenStats> codegen{std::in_place, engine, sink.stats()};
+  std::vector<llvm::SmallString<0>> objects(opt.codegenThreads);
+  std::vector<std::unique_ptr<llvm::raw_svector_ostream>> streams;
+  std::vector<llvm::raw_pwrite_stream *> streamPtrs;
+  for (llvm::SmallString<0> &object : objects) {
+    streams.push_back(std::make_unique<llvm::raw_svector_ostream>(object));
+    streamPtrs.push_back(streams.back().get());
+  }
+  
+  // Each partition is compiled on its own thread by a target machine that is
+  // configured in the same way as the one MCJIT uses
+  const llvm::CodeGenOpt::Level level = codeGenOpt(opt.optimizeASM);
+  const std::string cpu = hostCPU(opt);
+  const std::vector<std::string> features = hostFeatures(opt);
+  llvm::splitCodeGen(std::move(module), streamPtrs, {}, [&] {
+    return std::unique_ptr<llvm::TargetMachine>{llvm::EngineBuilder{}
+      .setOptLevel(level)
+      .setMCPU(cpu)
+      .setMAttrs(features)
+      .selectTarget()
+    };
+  });
+  streams.clear();
+  
+  for (const llvm::SmallString<0> &object : objects) {
+    std::unique_ptr<llvm::MemoryBuffer> buffer = llvm::MemoryBuffer::getMemBufferCopy(object);
+    auto file = llvm::object::ObjectFile::createObjectFile(buffer->getMemBufferRef());
+    if (!file) {
+      log.error() << llvm::toString(file.takeError()) << fatal;
+    }
+    engine->addObjectFile({std::move(*file), std::move(buffer)});
+  }
+  engine->finalizeObject();
+  codegen.reset();
+  runCtors(engine);
+  
+  return engine;
+}
+
+}
+
+llvm::ExecutionEngine *stela::generateCode(
+  std::unique_ptr<llvm::Module> module,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  Log log{sink, LogCat::generate};
   
-  // @TODO don't forget to call destructors
-  engine->runStaticConstructorsDestructors(false);
+  if (opt.codegenThreads > 1) {
+    return generateParallelCode(std::move(module), sink, opt);
+  }
+  
+  llvm::Module *modulePtr = module.get();
+  lowerCtorLists(modulePtr);
+  llvm::ExecutionEngine *engine = createEngine(std::move(module), log, opt);
+  
+  if (shouldOptimize(opt)) {
+    check(log, optimizeModule(engine->getTargetMachine(), modulePtr, opt, &sink));
+  }
+  finalize(engine, sink.stats());
+  runCtors(engine);
   
   return engine;
 }
@@ -79,5 +229,157 @@ llvm::ExecutionEngine *stela::generateCode(
   LogSink &sink,
   const OptFlags flags
 ) {
-  return generateCode(generateIR(syms, sink), sink, flags);
+  return generateCode(generateIR(syms, sink, flags), sink, flags);
+}
+
+llvm::ExecutionEngine *stela::generateCode(
+  std::unique_ptr<llvm::Module> module,
+  LogSink &sink,
+  const std::string &cacheDir,
+  const OptFlags opt
+) {
+  Log log{sink, LogCat::generate};
+  
+  llvm::Module *modulePtr = module.get();
+  lowerCtorLists(modulePtr);
+  llvm::ExecutionEngine *engine = createEngine(std::move(module), log, opt);
+  
+  // The unoptimized module along with the flags and the target determine the
+  // object so the optimizer only needs to run when the object isn't cached
+  ObjectCache cache{cacheDir};
+  const std::string key = cache.key(*modulePtr, *engine->getTargetMachine(), opt);
+  if (!cache.has(key) && shouldOptimize(opt)) {
+    check(log, optimizeModule(engine->getTargetMachine(), modulePtr, opt, &sink));
+  }
+  modulePtr->setModuleIdentifier(key);
+  
+  // MCJIT asks the cache for the object before compiling the module
+  engine->setObjectCache(&cache);
+  finalize(engine, sink.stats());
+  engine->setObjectCache(nullptr);
+  if (cache.hits()) {
+    log.status() << "Loaded cached object " << key << endlog;
+  }
+  if (CompileStats *stats = sink.stats()) {
+    stats->cachedObjects += cache.hits();
+  }
+  runCtors(engine);
+  
+  return engine;
+}
+
+llvm::ExecutionEngine *stela::generateCode(
+  const Symbols &syms,
+  LogSink &sink,
+  const std::string &cacheDir,
+  const OptFlags flags
+) {
+  return generateCode(generateIR(syms, sink, flags), sink, cacheDir, flags);
+}
+
+namespace {
+
+// The lazy call-through stubs jump here if a function fails to compile. The
+// error has already been reported to the LogSink and there is no value that
+// could be returned to the caller
+[[noreturn]] void lazyCompileFailed() {
+  std::abort();
+}
+
+// Local functions are promoted to hidden when the module is first partitioned
+bool isHelper(const llvm::Function &func) {
+  return func.hasLocalLinkage() || func.hasHiddenVisibility();
+}
+
+using GlobalValueSet = llvm::orc::CompileOnDemandLayer::GlobalValueSet;
+
+// Compile the requested functions along with the helpers they reference so
+// that the optimizer is able to inline helpers into their callers
+
+llvm::Optional<GlobalValueSet> partitionWithHelpers(GlobalValueSet requested) {
+  std::vector<const llvm::Function *> stack;
+  for (const llvm::GlobalValue *value : requested) {
+    if (auto *func = llvm::dyn_cast<llvm::Function>(value)) {
+      stack.push_back(func);
+    }
+  }
+  while (!stack.empty()) {
+    const llvm::Function *func = stack.back();
+    stack.pop_back();
+    for (const llvm::Instruction &inst : llvm::instructions(func)) {
+      for (const llvm::Value *operand : inst.operand_values()) {
+        auto *callee = llvm::dyn_cast<llvm::Function>(operand->stripPointerCasts());
+        if (callee && !callee->isDeclaration() && isHelper(*callee)) {
+          if (requested.insert(callee).second) {
+            stack.push_back(callee);
+          }
+        }
+      }
+    }
+  }
+  return requested;
+}
+
+}
+
+std::unique_ptr<llvm::orc::LLLazyJIT> stela::generateLazyCode(
+  const Symbols &syms,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  Log log{sink, LogCat::generate};
+  
+  auto context = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> module = generateModule(*context, syms, log, nullptr, opt);
+  
+  auto builder = check(log, llvm::orc::JITTargetMachineBuilder::detectHost());
+  builder.setCodeGenOptLevel(codeGenOpt(opt.optimizeASM));
+  builder.setCPU(hostCPU(opt));
+  builder.addFeatures(hostFeatures(opt));
+  std::shared_ptr<llvm::TargetMachine> machine = check(log, builder.createTargetMachine());
+  const llvm::DataLayout layout = machine->createDataLayout();
+  
+  std::unique_ptr<llvm::orc::LLLazyJIT> jit = check(log, llvm::orc::LLLazyJIT::Create(
+    std::move(builder),
+    layout,
+    llvm::pointerToJITTargetAddress(&lazyCompileFailed),
+    opt.codegenThreads > 1 ? opt.codegenThreads : 0
+  ));
+  jit->getMainJITDylib().setGenerator(check(
+    log, llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(layout)
+  ));
+  jit->getExecutionSession().setErrorReporter([&sink](llvm::Error err) {
+    Log log{sink, LogCat::generate};
+    log.error() << "Failed to compile function: " << llvm::toString(std::move(err)) << endlog;
+  });
+  jit->setPartitionFunction(&partitionWithHelpers);
+  // Each partition would define its own profile table
+  OptFlags partitionOpt = opt;
+  partitionOpt.profileGen = false;
+  jit->setLazyCompileTransform([machine, opt = partitionOpt, stats = sink.stats()](
+    llvm::orc::ThreadSafeModule partition,
+    const llvm::orc::MaterializationResponsibility &
+  ) -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+    // Every partition shares the context so the lock also guards the stats
+    llvm::orc::ThreadSafeContext::Lock lock = partition.getContext().getLock();
+    llvm::Module *module = partition.getModule();
+    if (stats) {
+      for (const llvm::Function &func : *module) {
+        if (!func.isDeclaration()) {
+          stats->lazyFunctions.push_back(func.getName().str());
+        }
+      }
+    }
+    if (opt.optimizeIR) {
+      if (llvm::Error err = optimizeModule(machine.get(), module, opt)) {
+        return std::move(err);
+      }
+    }
+    return std::move(partition);
+  });
+  
+  check(log, jit->addLazyIRModule({std::move(module), std::move(context)}));
+  check(log, jit->runConstructors());
+  
+  return jit;
 }
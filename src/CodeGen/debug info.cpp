@@ -0,0 +1,62 @@
+//
+//  debug info.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "debug info.hpp"
+
+#include <llvm/IR/Module.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+
+using namespace stela;
+
+DebugInfo::DebugInfo(llvm::Module &module)
+  : builder{module} {
+  file = builder.createFile("stela", "");
+  // There is no DWARF language code for Stela and C is the closest
+  unit = builder.createCompileUnit(
+    llvm::dwarf::DW_LANG_C,
+    file,
+    "STELA",
+    false,
+    "",
+    0,
+    "",
+    llvm::DICompileUnit::LineTablesOnly
+  );
+  funcType = builder.createSubroutineType(builder.getOrCreateTypeArray({}));
+  module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+  module.addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+}
+
+void DebugInfo::setFile(const std::string &name) {
+  file = builder.createFile(name, "");
+}
+
+void DebugInfo::define(llvm::Function *func, const Loc loc) {
+  func->setSubprogram(builder.createFunction(
+    file,
+    func->getName(),
+    func->getName(),
+    file,
+    loc.l,
+    funcType,
+    loc.l,
+    llvm::DINode::FlagZero,
+    llvm::DISubprogram::SPFlagDefinition
+  ));
+}
+
+void DebugInfo::finalize() {
+  builder.finalize();
+}
+
+void stela::setDebugLoc(llvm::IRBuilder<> &ir, const Loc loc) {
+  llvm::Function *func = ir.GetInsertBlock()->getParent();
+  if (llvm::DISubprogram *subprogram = func->getSubprogram()) {
+    ir.SetCurrentDebugLocation(llvm::DebugLoc::get(loc.l, loc.c, subprogram));
+  }
+}
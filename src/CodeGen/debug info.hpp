@@ -0,0 +1,43 @@
+//
+//  debug info.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_debug_info_hpp
+#define stela_debug_info_hpp
+
+#include "location.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/DIBuilder.h>
+
+namespace stela {
+
+/// Line table debug info for a module. Each Stela module is a file
+class DebugInfo {
+public:
+  explicit DebugInfo(llvm::Module &);
+  
+  /// Functions defined after this are in the file of the given Stela module
+  void setFile(const std::string &);
+  /// Attach a subprogram to a function that is defined at the location
+  void define(llvm::Function *, Loc);
+  /// Must be called after every function has been generated
+  void finalize();
+
+private:
+  llvm::DIBuilder builder;
+  llvm::DICompileUnit *unit;
+  llvm::DIFile *file;
+  llvm::DISubroutineType *funcType;
+};
+
+/// Attach the location to the instructions that the builder creates from now
+/// on. This does nothing if the function being built doesn't have a subprogram
+void setDebugLoc(llvm::IRBuilder<> &, Loc);
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+//
+//  emit module.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "code generation.hpp"
+
+#include "host machine.hpp"
+#include <llvm/IR/Module.h>
+#include "Log/log output.hpp"
+#include "optimize module.hpp"
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Target/TargetMachine.h>
+
+using namespace stela;
+
+namespace {
+
+llvm::TargetMachine::CodeGenFileType fileType(const EmitKind kind) {
+  if (kind == EmitKind::assembly) {
+    return llvm::TargetMachine::CGFT_AssemblyFile;
+  } else {
+    return llvm::TargetMachine::CGFT_ObjectFile;
+  }
+}
+
+}
+
+void stela::optimizeForHost(llvm::Module &module, LogSink &sink, const OptFlags opt) {
+  Log log{sink, LogCat::generate};
+  if (shouldOptimize(opt)) {
+    std::unique_ptr<llvm::TargetMachine> machine = createHostMachine(log, opt, llvm::Reloc::PIC_);
+    if (llvm::Error err = optimizeModule(machine.get(), &module, opt, &sink)) {
+      log.error() << llvm::toString(std::move(err)) << fatal;
+    }
+  }
+}
+
+void stela::emitModule(
+  llvm::Module &module,
+  llvm::raw_pwrite_stream &stream,
+  const EmitKind kind,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  Log log{sink, LogCat::generate};
+  
+  // Objects are linked into the host executable so they need to be position
+  // independent
+  std::unique_ptr<llvm::TargetMachine> machine = createHostMachine(log, opt, llvm::Reloc::PIC_);
+  module.setTargetTriple(machine->getTargetTriple().str());
+  module.setDataLayout(machine->createDataLayout());
+  
+  if (kind == EmitKind::ir) {
+    module.print(stream, nullptr);
+    return;
+  }
+  
+  llvm::legacy::PassManager passes;
+  if (machine->addPassesToEmitFile(passes, stream, nullptr, fileType(kind))) {
+    log.error() << "Target machine cannot emit this type of file" << fatal;
+  }
+  passes.run(module);
+}
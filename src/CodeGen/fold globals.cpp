@@ -0,0 +1,100 @@
+//
+//  fold globals.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "fold globals.hpp"
+
+#include <vector>
+#include <llvm/IR/Module.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Transforms/Utils/Evaluator.h>
+
+using namespace stela;
+
+namespace {
+
+// addr is a constant GEP into an aggregate global. The indices after the
+// first are followed down to the element that is replaced by val
+llvm::Constant *storeInto(
+  llvm::Constant *init,
+  llvm::Constant *val,
+  llvm::ConstantExpr *addr,
+  const unsigned index
+) {
+  if (index == addr->getNumOperands()) {
+    return val;
+  }
+  std::vector<llvm::Constant *> elems;
+  for (unsigned e = 0; llvm::Constant *elem = init->getAggregateElement(e); ++e) {
+    elems.push_back(elem);
+  }
+  const uint64_t e = llvm::cast<llvm::ConstantInt>(addr->getOperand(index))->getZExtValue();
+  elems[e] = storeInto(elems[e], val, addr, index + 1);
+  if (auto *srt = llvm::dyn_cast<llvm::StructType>(init->getType())) {
+    return llvm::ConstantStruct::get(srt, elems);
+  }
+  return llvm::ConstantArray::get(llvm::cast<llvm::ArrayType>(init->getType()), elems);
+}
+
+void commitStore(llvm::Constant *addr, llvm::Constant *val) {
+  if (auto *global = llvm::dyn_cast<llvm::GlobalVariable>(addr)) {
+    global->setInitializer(val);
+    return;
+  }
+  auto *gep = llvm::cast<llvm::ConstantExpr>(addr);
+  auto *global = llvm::cast<llvm::GlobalVariable>(gep->getOperand(0));
+  global->setInitializer(storeInto(global->getInitializer(), val, gep, 2));
+}
+
+}
+
+bool stela::foldGlobalCtor(llvm::Function *ctor) {
+  llvm::Module *module = ctor->getParent();
+  llvm::TargetLibraryInfoImpl libInfo{llvm::Triple{module->getTargetTriple()}};
+  llvm::TargetLibraryInfo lib{libInfo};
+  // The evaluator gives up on anything with side effects outside of the
+  // globals such as allocating memory
+  llvm::Evaluator eval{module->getDataLayout(), &lib};
+  llvm::Constant *ret;
+  llvm::SmallVector<llvm::Constant *, 0> args;
+  if (!eval.EvaluateFunction(ctor, ret, args)) {
+    return false;
+  }
+  // Stores to a whole global replace the initializer so they must be
+  // committed before the stores to elements of that global. The mutated
+  // memory is a DenseMap so the stores are not in any particular order
+  std::vector<std::pair<llvm::Constant *, llvm::Constant *>> elemStores;
+  for (const auto &store : eval.getMutatedMemory()) {
+    if (llvm::isa<llvm::GlobalVariable>(store.first)) {
+      commitStore(store.first, store.second);
+    } else {
+      elemStores.push_back(store);
+    }
+  }
+  for (const auto &store : elemStores) {
+    commitStore(store.first, store.second);
+  }
+  return true;
+}
+
+bool stela::isEmptyFunc(llvm::Function *func) {
+  for (llvm::BasicBlock &block : *func) {
+    for (llvm::Instruction &inst : block) {
+      if (llvm::isa<llvm::ReturnInst>(inst)) {
+        continue;
+      }
+      auto *branch = llvm::dyn_cast<llvm::BranchInst>(&inst);
+      if (!branch || branch->isConditional()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+//
+//  fold globals.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_fold_globals_hpp
+#define stela_fold_globals_hpp
+
+namespace llvm {
+
+class Function;
+
+}
+
+namespace stela {
+
+/// Evaluate the constructor of a global variable at compile time. If every
+/// instruction can be evaluated, the values that it stores become the
+/// initializers of the globals that it stores to and true is returned. The
+/// constructor itself is not modified
+bool foldGlobalCtor(llvm::Function *);
+
+/// Determine whether a function does nothing but branch and return
+bool isEmptyFunc(llvm::Function *);
+
+}
+
+#endif
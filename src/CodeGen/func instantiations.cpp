@@ -13,8 +13,11 @@
 
 using namespace stela;
 
-FuncInst::FuncInst(llvm::Module *module)
-  : module{module} {
+FuncInst::FuncInst(
+  llvm::Module *module,
+  const bool atomic,
+  const Allocator *alloc
+) : module{module}, atomic{atomic}, alloc{alloc} {
   fns.fill(nullptr);
   for (FuncMap &map : paramFns) {
     map.reserve(16);
@@ -21,9 +21,20 @@ class Type;
 
 namespace stela {
 
+struct Allocator;
+
 class FuncInst {
 public:
-  explicit FuncInst(llvm::Module *);
+  explicit FuncInst(llvm::Module *, bool = false, const Allocator * = nullptr);
+  
+  /// Whether reference counts are updated atomically
+  bool atomicRefs() const {
+    return atomic;
+  }
+  /// Null if malloc and free are used
+  const Allocator *allocator() const {
+    return alloc;
+  }
   
   template <FGI Fn>
   llvm::Function *get() {
@@ -53,6 +64,8 @@ private:
   using FuncMap = std::unordered_map<llvm::Type *, llvm::Function *>;
 
   llvm::Module *module;
+  bool atomic;
+  const Allocator *alloc;
   std::array<llvm::Function *, static_cast<size_t>(FGI::count_)> fns;
   std::array<FuncMap, static_cast<size_t>(PFGI::count_)> paramFns;
   
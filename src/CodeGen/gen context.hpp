@@ -19,6 +19,12 @@ class Module;
 
 }
 
+namespace stela {
+
+class DebugInfo;
+
+}
+
 namespace stela::gen {
 
 struct Ctx {
@@ -26,6 +32,8 @@ struct Ctx {
   llvm::Module *mod;
   FuncInst &inst;
   Log &log;
+  /// Null unless debug info is enabled
+  DebugInfo *debug = nullptr;
 };
 
 }
@@ -9,6 +9,7 @@
 #include "gen helpers.hpp"
 
 #include "gen types.hpp"
+#include "function builder.hpp"
 #include "Utils/unreachable.hpp"
 
 using namespace stela;
@@ -151,6 +152,72 @@ void stela::setNull(llvm::IRBuilder<> &ir, llvm::Value *ptrToPtr) {
   ir.CreateStore(null, ptrToPtr);
 }
 
+namespace {
+
+unsigned structAlign(llvm::IRBuilder<> &ir, llvm::Value *addr) {
+  const llvm::DataLayout &layout = ir.GetInsertBlock()->getModule()->getDataLayout();
+  return layout.getABITypeAlignment(addr->getType()->getPointerElementType());
+}
+
+/// The registers that a struct is passed in may be larger than the struct.
+/// {float, float, float} is passed in {<2 x float>, float} which is 16 bytes.
+/// Returns the size of the struct if a temporary is needed to load or store
+/// the registers without touching memory past the end of the struct
+uint64_t coercedCopySize(llvm::IRBuilder<> &ir, llvm::Type *regType, llvm::Value *addr) {
+  const llvm::DataLayout &layout = ir.GetInsertBlock()->getModule()->getDataLayout();
+  const uint64_t objSize = layout.getTypeAllocSize(addr->getType()->getPointerElementType());
+  const uint64_t regSize = layout.getTypeStoreSize(regType);
+  return regSize > objSize ? objSize : 0;
+}
+
+/// Insert an alloca for the registers at the start of the entry block
+llvm::Value *coercedTemp(llvm::IRBuilder<> &ir, llvm::Type *regType, const unsigned align) {
+  llvm::BasicBlock &entry = ir.GetInsertBlock()->getParent()->getEntryBlock();
+  llvm::IRBuilder<> entryIr{&entry, entry.getFirstInsertionPt()};
+  llvm::AllocaInst *temp = entryIr.CreateAlloca(regType);
+  const llvm::DataLayout &layout = entry.getModule()->getDataLayout();
+  temp->setAlignment(std::max<unsigned>(align, layout.getABITypeAlignment(regType)));
+  return temp;
+}
+
+}
+
+llvm::Value *stela::loadCoerced(llvm::IRBuilder<> &ir, llvm::Type *type, llvm::Value *addr) {
+  const unsigned align = structAlign(ir, addr);
+  if (const uint64_t size = coercedCopySize(ir, type, addr)) {
+    llvm::Value *temp = coercedTemp(ir, type, align);
+    ir.CreateMemCpy(temp, align, addr, align, size);
+    return ir.CreateAlignedLoad(temp, align);
+  }
+  llvm::Value *regAddr = ir.CreatePointerCast(addr, type->getPointerTo());
+  return ir.CreateAlignedLoad(regAddr, align);
+}
+
+void stela::storeCoerced(llvm::IRBuilder<> &ir, llvm::Value *value, llvm::Value *addr) {
+  const unsigned align = structAlign(ir, addr);
+  if (const uint64_t size = coercedCopySize(ir, value->getType(), addr)) {
+    llvm::Value *temp = coercedTemp(ir, value->getType(), align);
+    ir.CreateAlignedStore(value, temp, align);
+    ir.CreateMemCpy(addr, align, temp, align, size);
+    return;
+  }
+  llvm::Value *regAddr = ir.CreatePointerCast(addr, value->getType()->getPointerTo());
+  ir.CreateAlignedStore(value, regAddr, align);
+}
+
+void stela::coerceArgs(
+  llvm::IRBuilder<> &ir,
+  llvm::FunctionType *type,
+  std::vector<llvm::Value *> &args
+) {
+  for (unsigned a = 0; a != args.size(); ++a) {
+    llvm::Type *paramType = type->getParamType(a);
+    if (args[a]->getType() != paramType && !paramType->isPointerTy()) {
+      args[a] = loadCoerced(ir, paramType, args[a]);
+    }
+  }
+}
+
 void stela::likely(llvm::BranchInst *branch) {
   llvm::LLVMContext &ctx = branch->getContext();
   llvm::IntegerType *i32 = llvm::IntegerType::getInt32Ty(ctx);
@@ -187,6 +254,113 @@ void stela::callFree(llvm::IRBuilder<> &ir, llvm::Function *free, llvm::Value *p
   ir.CreateCall(free, ir.CreatePointerCast(ptr, voidPtrTy(ptr->getContext())));
 }
 
+namespace {
+
+uint64_t inlineCapacity(llvm::Module *module, llvm::Type *elemTy) {
+  const uint64_t size = module->getDataLayout().getTypeAllocSize(elemTy);
+  return size == 0 ? 0 : array_inline_bytes / size;
+}
+
+llvm::Value *inlineArrayDat(llvm::IRBuilder<> &ir, llvm::Value *storage) {
+  llvm::Type *datTy = storage->getType()->getPointerElementType()->getStructElementType(array_idx_dat);
+  return ir.CreatePointerCast(ir.CreateConstInBoundsGEP1_64(storage, 1), datTy);
+}
+
+}
+
+llvm::Value *stela::allocArray(
+  FuncBuilder &builder,
+  llvm::Function *objAlloc,
+  llvm::Function *alloc,
+  llvm::Type *storageTy,
+  llvm::Value *cap
+) {
+  llvm::Type *elemTy = storageTy->getStructElementType(array_idx_dat)->getPointerElementType();
+  const uint64_t inlineCap = inlineCapacity(alloc->getParent(), elemTy);
+  
+  if (inlineCap == 0) {
+    llvm::Value *obj = callAlloc(builder.ir, objAlloc, storageTy);
+    builder.ir.CreateStore(cap, builder.ir.CreateStructGEP(obj, array_idx_cap));
+    llvm::Value *dat = callAlloc(builder.ir, alloc, elemTy, cap);
+    builder.ir.CreateStore(dat, builder.ir.CreateStructGEP(obj, array_idx_dat));
+    return obj;
+  }
+  
+  /*
+  if cap <= inlineCap
+    obj = obj_alloc(sizeof(storage) + cap * sizeof(elem))
+    obj.dat = obj + 1
+  else
+    obj = obj_alloc
+    obj.dat = malloc(cap)
+  obj.cap = cap
+  */
+  
+  llvm::BasicBlock *inlineBlock = builder.makeBlock();
+  llvm::BasicBlock *heapBlock = builder.makeBlock();
+  llvm::BasicBlock *doneBlock = builder.makeBlock();
+  llvm::Value *small = builder.ir.CreateICmpULE(cap, constantFor(cap, inlineCap));
+  builder.ir.CreateCondBr(small, inlineBlock, heapBlock);
+  
+  builder.setCurr(inlineBlock);
+  llvm::Type *sizeTy = getType<size_t>(alloc->getContext());
+  llvm::Constant *storageSize = llvm::ConstantExpr::getIntegerCast(
+    llvm::ConstantExpr::getSizeOf(storageTy), sizeTy, false
+  );
+  llvm::Constant *elemSize = llvm::ConstantExpr::getIntegerCast(
+    llvm::ConstantExpr::getSizeOf(elemTy), sizeTy, false
+  );
+  llvm::Value *elemBytes = builder.ir.CreateMul(elemSize, builder.ir.CreateIntCast(cap, sizeTy, false));
+  llvm::Value *bytes = builder.ir.CreateAdd(storageSize, elemBytes);
+  llvm::Value *inlineMem = builder.ir.CreateCall(objAlloc, {bytes});
+  llvm::Value *inlineObj = builder.ir.CreatePointerCast(inlineMem, storageTy->getPointerTo());
+  llvm::Value *inlineDat = inlineArrayDat(builder.ir, inlineObj);
+  builder.ir.CreateStore(inlineDat, builder.ir.CreateStructGEP(inlineObj, array_idx_dat));
+  builder.ir.CreateBr(doneBlock);
+  
+  builder.setCurr(heapBlock);
+  llvm::Value *heapObj = callAlloc(builder.ir, objAlloc, storageTy);
+  llvm::Value *heapDat = callAlloc(builder.ir, alloc, elemTy, cap);
+  builder.ir.CreateStore(heapDat, builder.ir.CreateStructGEP(heapObj, array_idx_dat));
+  builder.ir.CreateBr(doneBlock);
+  
+  builder.setCurr(doneBlock);
+  llvm::PHINode *obj = builder.ir.CreatePHI(storageTy->getPointerTo(), 2);
+  obj->addIncoming(inlineObj, inlineBlock);
+  obj->addIncoming(heapObj, heapBlock);
+  builder.ir.CreateStore(cap, builder.ir.CreateStructGEP(obj, array_idx_cap));
+  return obj;
+}
+
+void stela::freeArrayDat(
+  FuncBuilder &builder,
+  llvm::Function *free,
+  llvm::Value *storage,
+  llvm::Value *dat
+) {
+  llvm::Type *elemTy = dat->getType()->getPointerElementType();
+  if (inlineCapacity(free->getParent(), elemTy) == 0) {
+    callFree(builder.ir, free, dat);
+    return;
+  }
+  
+  /*
+  if dat != storage + 1
+    free(dat)
+  */
+  
+  llvm::BasicBlock *freeBlock = builder.makeBlock();
+  llvm::BasicBlock *doneBlock = builder.makeBlock();
+  llvm::Value *onHeap = builder.ir.CreateICmpNE(dat, inlineArrayDat(builder.ir, storage));
+  builder.ir.CreateCondBr(onHeap, freeBlock, doneBlock);
+  
+  builder.setCurr(freeBlock);
+  callFree(builder.ir, free, dat);
+  builder.ir.CreateBr(doneBlock);
+  
+  builder.setCurr(doneBlock);
+}
+
 gen::Expr stela::lvalue(llvm::Value *obj) {
   return {obj, ValueCat::lvalue};
 }
@@ -211,3 +385,12 @@ void stela::initRefCount(llvm::IRBuilder<> &ir, llvm::Value *ptr) {
   llvm::Value *refPtr = ir.CreatePointerCast(ptr, refPtrTy(ir.getContext()));
   ir.CreateStore(constantForPtr(refPtr, 1), refPtr);
 }
+
+llvm::Value *stela::loadRefCount(llvm::IRBuilder<> &ir, llvm::Value *ptr, const bool atomic) {
+  llvm::LoadInst *ref = ir.CreateLoad(ir.CreatePointerCast(ptr, refPtrTy(ir.getContext())));
+  if (atomic) {
+    ref->setAlignment(alignof(uint64_t));
+    ref->setAtomic(llvm::AtomicOrdering::Acquire);
+  }
+  return ref;
+}
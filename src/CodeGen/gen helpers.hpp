@@ -18,6 +18,11 @@ namespace stela {
 constexpr unsigned array_idx_cap = 1;
 constexpr unsigned array_idx_len = 2;
 constexpr unsigned array_idx_dat = 3;
+/// Arrays with at most this many bytes of elements store them directly after
+/// the storage so that they only need one allocation
+constexpr uint64_t array_inline_bytes = 16;
+
+class FuncBuilder;
 
 enum class Inline {
   never,
@@ -54,10 +59,24 @@ llvm::Value *arrayIndex(llvm::IRBuilder<> &, llvm::Value *, llvm::Value *);
 void setNull(llvm::IRBuilder<> &, llvm::Value *);
 void likely(llvm::BranchInst *);
 
+/// Load a struct as the registers that it is passed in
+llvm::Value *loadCoerced(llvm::IRBuilder<> &, llvm::Type *, llvm::Value *);
+/// Store the registers that a struct is passed in to memory
+void storeCoerced(llvm::IRBuilder<> &, llvm::Value *, llvm::Value *);
+/// Load pointers to structs that the function expects to be passed in
+/// registers
+void coerceArgs(llvm::IRBuilder<> &, llvm::FunctionType *, std::vector<llvm::Value *> &);
+
 void callPanic(llvm::IRBuilder<> &, llvm::Function *, std::string_view);
 llvm::Value *callAlloc(llvm::IRBuilder<> &, llvm::Function *, llvm::Type *, llvm::Value *);
 llvm::Value *callAlloc(llvm::IRBuilder<> &, llvm::Function *, llvm::Type *);
 void callFree(llvm::IRBuilder<> &, llvm::Function *, llvm::Value *);
+/// Allocate array storage with room for the given number of elements. The
+/// capacity and elements are stored in the storage. The storage is allocated
+/// with the first function (FGI::obj_alloc) and the elements with the second
+llvm::Value *allocArray(FuncBuilder &, llvm::Function *, llvm::Function *, llvm::Type *, llvm::Value *);
+/// Free the elements of an array unless they are stored inline
+void freeArrayDat(FuncBuilder &, llvm::Function *, llvm::Value *, llvm::Value *);
 
 gen::Expr lvalue(llvm::Value *);
 void returnBool(llvm::IRBuilder<> &, bool);
@@ -66,6 +85,9 @@ llvm::PointerType *refPtrTy(llvm::LLVMContext &);
 llvm::PointerType *refPtrPtrTy(llvm::LLVMContext &);
 llvm::Value *refPtrPtrCast(llvm::IRBuilder<> &, llvm::Value *);
 void initRefCount(llvm::IRBuilder<> &, llvm::Value *);
+/// An atomic load acquires so that a unique owner sees every write made by
+/// the previous owners
+llvm::Value *loadRefCount(llvm::IRBuilder<> &, llvm::Value *, bool = false);
 
 }
 
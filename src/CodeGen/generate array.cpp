@@ -43,7 +43,7 @@ llvm::Function *stela::genFn<PFGI::arr_def_ctor>(InstData data, ast::ArrayType *
   FuncBuilder builder{func};
   
   /*
-  obj = malloc
+  obj = obj_alloc
   obj.ref = 1
   obj.cap = 0
   obj.len = 0
@@ -52,7 +52,7 @@ llvm::Function *stela::genFn<PFGI::arr_def_ctor>(InstData data, ast::ArrayType *
   
   llvm::Value *arrayPtr = func->arg_begin();
   llvm::Type *storageTy = type->getPointerElementType();
-  llvm::Value *array = callAlloc(builder.ir, data.inst.get<FGI::alloc>(), storageTy);
+  llvm::Value *array = callAlloc(builder.ir, data.inst.get<FGI::obj_alloc>(), storageTy);
   initRefCount(builder.ir, array);
 
   llvm::Value *cap = builder.ir.CreateStructGEP(array, array_idx_cap);
@@ -220,7 +220,6 @@ llvm::Function *stela::genFn<PFGI::arr_len_ctor>(InstData data, ast::ArrayType *
   llvm::Type *type = generateType(ctx, arr);
   llvm::Type *arrayStructType = type->getPointerElementType();
   llvm::Type *elemPtr = arrayStructType->getStructElementType(array_idx_dat);
-  llvm::Type *elem = elemPtr->getPointerElementType();
   llvm::FunctionType *sig = llvm::FunctionType::get(
     elemPtr,
     {type->getPointerTo(), arrayStructType->getStructElementType(array_idx_len)},
@@ -231,26 +230,22 @@ llvm::Function *stela::genFn<PFGI::arr_len_ctor>(InstData data, ast::ArrayType *
   FuncBuilder builder{func};
   
   /*
-  obj = malloc
+  obj = alloc_array(size)
   obj.ref = 1
-  obj.cap = size
   obj.len = size
-  obj.dat = malloc(size)
   */
   
   llvm::Value *objPtr = func->arg_begin();
   llvm::Value *size = func->arg_begin() + 1;
   llvm::Type *storageTy = type->getPointerElementType();
-  llvm::Value *obj = callAlloc(builder.ir, data.inst.get<FGI::alloc>(), storageTy);
+  llvm::Value *obj = allocArray(
+    builder, data.inst.get<FGI::obj_alloc>(), data.inst.get<FGI::alloc>(), storageTy, size
+  );
   initRefCount(builder.ir, obj);
   
-  llvm::Value *objCapPtr = builder.ir.CreateStructGEP(obj, array_idx_cap);
-  builder.ir.CreateStore(size, objCapPtr);
   llvm::Value *objLenPtr = builder.ir.CreateStructGEP(obj, array_idx_len);
   builder.ir.CreateStore(size, objLenPtr);
-  llvm::Value *objDatPtr = builder.ir.CreateStructGEP(obj, array_idx_dat);
-  llvm::Value *dat = callAlloc(builder.ir, data.inst.get<FGI::alloc>(), elem, size);
-  builder.ir.CreateStore(dat, objDatPtr);
+  llvm::Value *dat = loadStructElem(builder.ir, obj, array_idx_dat);
   builder.ir.CreateStore(obj, objPtr);
   builder.ir.CreateRet(dat);
   
@@ -268,7 +263,8 @@ llvm::Function *stela::genFn<PFGI::arr_strg_dtor>(InstData data, ast::ArrayType
   
   /*
   destroy_n(obj.dat, obj.len)
-  free(storage.dat)
+  if obj.dat != obj + 1
+    free(obj.dat)
   */
   
   llvm::Value *obj = builder.ir.CreatePointerCast(func->arg_begin(), type);
@@ -276,7 +272,7 @@ llvm::Function *stela::genFn<PFGI::arr_strg_dtor>(InstData data, ast::ArrayType
   llvm::Value *objDat = loadStructElem(builder.ir, obj, array_idx_dat);
   llvm::Value *destroy_n = data.inst.get<PFGI::destroy_n>(arr->elem.get());
   builder.ir.CreateCall(destroy_n, {objDat, objLen});
-  callFree(builder.ir, data.inst.get<FGI::free>(), objDat);
+  freeArrayDat(builder, data.inst.get<FGI::free>(), obj, objDat);
   builder.ir.CreateRetVoid();
   
   return func;
@@ -423,3 +419,57 @@ llvm::Function *stela::genFn<PFGI::arr_lt>(InstData data, ast::ArrayType *arr) {
   
   return func;
 }
+
+template <>
+llvm::Function *stela::genFn<PFGI::arr_unshare>(InstData data, ast::ArrayType *arr) {
+  llvm::LLVMContext &ctx = data.mod->getContext();
+  llvm::Type *type = generateType(ctx, arr);
+  llvm::Function *func = makeInternalFunc(data.mod, unaryCtorFor(type), "arr_unshare", Inline::hint);
+  assignUnaryCtorAttrs(func);
+  FuncBuilder builder{func};
+  
+  /*
+  if array.ref == 1
+    return
+  else
+    copy = alloc_array(array.cap)
+    copy.ref = 1
+    copy.len = array.len
+    copy_n(array.dat, array.len, copy.dat)
+    ptr_dec(arr_strg_dtor, array)
+    array = copy
+    return
+  */
+  
+  llvm::BasicBlock *copyBlock = builder.makeBlock();
+  llvm::BasicBlock *doneBlock = builder.makeBlock();
+  llvm::Value *arrayPtr = func->arg_begin();
+  llvm::Value *array = builder.ir.CreateLoad(arrayPtr);
+  llvm::Value *ref = loadRefCount(builder.ir, array, data.inst.atomicRefs());
+  llvm::Value *unique = builder.ir.CreateICmpEQ(ref, constantFor(ref, 1));
+  likely(builder.ir.CreateCondBr(unique, doneBlock, copyBlock));
+  
+  builder.setCurr(copyBlock);
+  llvm::Type *storageTy = type->getPointerElementType();
+  llvm::Value *cap = loadStructElem(builder.ir, array, array_idx_cap);
+  llvm::Value *copy = allocArray(
+    builder, data.inst.get<FGI::obj_alloc>(), data.inst.get<FGI::alloc>(), storageTy, cap
+  );
+  initRefCount(builder.ir, copy);
+  llvm::Value *len = loadStructElem(builder.ir, array, array_idx_len);
+  builder.ir.CreateStore(len, builder.ir.CreateStructGEP(copy, array_idx_len));
+  llvm::Value *copyDat = loadStructElem(builder.ir, copy, array_idx_dat);
+  llvm::Value *dat = loadStructElem(builder.ir, array, array_idx_dat);
+  llvm::Function *copy_n = data.inst.get<PFGI::copy_n>(arr->elem.get());
+  builder.ir.CreateCall(copy_n, {dat, len, copyDat});
+  llvm::Function *strgDtor = data.inst.get<PFGI::arr_strg_dtor>(arr);
+  llvm::Value *arrayRef = builder.ir.CreatePointerCast(array, refPtrTy(ctx));
+  builder.ir.CreateCall(data.inst.get<FGI::ptr_dec>(), {strgDtor, arrayRef});
+  builder.ir.CreateStore(copy, arrayPtr);
+  builder.ir.CreateRetVoid();
+  
+  builder.setCurr(doneBlock);
+  builder.ir.CreateRetVoid();
+  
+  return func;
+}
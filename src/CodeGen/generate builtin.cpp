@@ -223,7 +223,8 @@ llvm::Function *stela::genFn<PFGI::reallocate>(InstData data, ast::ArrayType *ar
   /*
   newDat = malloc cap
   move_n array.dat, array.len, newDat
-  free array.dat
+  if array.dat != array + 1
+    free array.dat
   array.dat = newDat
   array.cap = cap
   */
@@ -241,7 +242,7 @@ llvm::Function *stela::genFn<PFGI::reallocate>(InstData data, ast::ArrayType *ar
   llvm::Value *dat = builder.ir.CreateLoad(datPtr);
   llvm::Value *len = loadStructElem(builder.ir, array, array_idx_len);
   builder.ir.CreateCall(move_n, {dat, len, newDat});
-  callFree(builder.ir, data.inst.get<FGI::free>(), dat);
+  freeArrayDat(builder, data.inst.get<FGI::free>(), array, dat);
   builder.ir.CreateStore(newDat, datPtr);
   llvm::Value *capPtr = builder.ir.CreateStructGEP(array, array_idx_cap);
   builder.ir.CreateStore(cap, capPtr);
@@ -304,9 +305,12 @@ llvm::Function *stela::genFn<PFGI::btn_data>(InstData data, ast::ArrayType *arr)
   FuncBuilder builder{func};
   
   /*
+  arr_unshare(array)
   return (void *)array.dat
   */
   
+  llvm::Function *unshare = data.inst.get<PFGI::arr_unshare>(arr);
+  builder.ir.CreateCall(unshare, {func->arg_begin()});
   llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
   llvm::Value *arrayDat = loadStructElem(builder.ir, array, array_idx_dat);
   builder.ir.CreateRet(builder.ir.CreatePointerCast(arrayDat, voidPtrTy(ctx)));
@@ -327,6 +331,7 @@ llvm::Function *stela::genFn<PFGI::btn_push_back>(InstData data, ast::ArrayType
   FuncBuilder builder{func};
   
   /*
+  arr_unshare(array)
   if array.len == array.cap
     reallocate(array, ceil_to_pow_2(array.len + 1))
     continue
@@ -339,6 +344,8 @@ llvm::Function *stela::genFn<PFGI::btn_push_back>(InstData data, ast::ArrayType
   
   llvm::BasicBlock *reallocBlock = builder.makeBlock();
   llvm::BasicBlock *copyBlock = builder.makeBlock();
+  llvm::Function *unshare = data.inst.get<PFGI::arr_unshare>(arr);
+  builder.ir.CreateCall(unshare, {func->arg_begin()});
   llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
   llvm::Value *value = func->arg_begin() + 1;
   llvm::Value *arrayLenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
@@ -383,6 +390,7 @@ llvm::Function *stela::genFn<PFGI::btn_append>(InstData data, ast::ArrayType *ar
   FuncBuilder builder{func};
   
   /*
+  arr_unshare(array)
   if array.len + other.len > array.cap
     reallocate(array, ceil_to_pow_2(array.len + other.len))
     continue
@@ -395,6 +403,8 @@ llvm::Function *stela::genFn<PFGI::btn_append>(InstData data, ast::ArrayType *ar
   
   llvm::BasicBlock *reallocBlock = builder.makeBlock();
   llvm::BasicBlock *copyBlock = builder.makeBlock();
+  llvm::Function *unshare = data.inst.get<PFGI::arr_unshare>(arr);
+  builder.ir.CreateCall(unshare, {func->arg_begin()});
   llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
   llvm::Value *other = builder.ir.CreateLoad(func->arg_begin() + 1);
   llvm::Value *arrayLenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
@@ -436,6 +446,7 @@ llvm::Function *stela::genFn<PFGI::btn_pop_back>(InstData data, ast::ArrayType *
   FuncBuilder builder{func};
   
   /*
+  arr_unshare(array)
   if array.len != 0
     array.len--
     destroy array.dat[array.len]
@@ -446,6 +457,8 @@ llvm::Function *stela::genFn<PFGI::btn_pop_back>(InstData data, ast::ArrayType *
   
   llvm::BasicBlock *popBlock = builder.makeBlock();
   llvm::BasicBlock *panicBlock = builder.makeBlock();
+  llvm::Function *unshare = data.inst.get<PFGI::arr_unshare>(arr);
+  builder.ir.CreateCall(unshare, {func->arg_begin()});
   llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
   llvm::Value *lenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
   llvm::Value *len = builder.ir.CreateLoad(lenPtr);
@@ -478,6 +491,7 @@ llvm::Function *stela::genFn<PFGI::btn_resize>(InstData data, ast::ArrayType *ar
   FuncBuilder builder{func};
   
   /*
+  arr_unshare(array)
   if len <= array.len
     destroy_n(array.dat + len, array.len - len)
   else
@@ -493,6 +507,8 @@ llvm::Function *stela::genFn<PFGI::btn_resize>(InstData data, ast::ArrayType *ar
   llvm::BasicBlock *constructBlock = builder.makeBlock();
   llvm::BasicBlock *reallocBlock = builder.makeBlock();
   llvm::BasicBlock *doneBlock = builder.makeBlock();
+  llvm::Function *unshare = data.inst.get<PFGI::arr_unshare>(arr);
+  builder.ir.CreateCall(unshare, {func->arg_begin()});
   llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
   llvm::Value *len = func->arg_begin() + 1;
   llvm::Value *arrayLenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
@@ -549,6 +565,7 @@ llvm::Function *stela::genFn<PFGI::btn_reserve>(InstData data, ast::ArrayType *a
   
   /*
   if cap > array.cap
+    arr_unshare(array)
     reallocate array, cap
     return
   else
@@ -563,9 +580,14 @@ llvm::Function *stela::genFn<PFGI::btn_reserve>(InstData data, ast::ArrayType *a
   llvm::Value *grow = builder.ir.CreateICmpUGT(cap, arrayCap);
   builder.ir.CreateCondBr(grow, reallocBlock, doneBlock);
   
+  // Reserving doesn't change the elements so the storage is only unshared
+  // when it is about to be reallocated
   builder.setCurr(reallocBlock);
+  llvm::Function *unshare = data.inst.get<PFGI::arr_unshare>(arr);
+  builder.ir.CreateCall(unshare, {func->arg_begin()});
+  llvm::Value *unshared = builder.ir.CreateLoad(func->arg_begin());
   llvm::Function *realloc = data.inst.get<PFGI::reallocate>(arr);
-  builder.ir.CreateCall(realloc, {array, cap});
+  builder.ir.CreateCall(realloc, {unshared, cap});
   builder.ir.CreateRetVoid();
   
   builder.setCurr(doneBlock);
@@ -9,6 +9,7 @@
 #include "generate closure.hpp"
 
 #include "gen types.hpp"
+#include "debug info.hpp"
 #include "gen helpers.hpp"
 #include "generate type.hpp"
 #include "generate stat.hpp"
@@ -359,6 +360,9 @@ llvm::Function *stela::genLambdaBody(gen::Ctx ctx, ast::Lambda &lam) {
   llvm::FunctionType *fnType = generateSig(ctx.llvm, sig);
   llvm::Function *func = makeInternalFunc(ctx.mod, fnType, "lam_body");
   assignAttrs(func, sig);
+  if (ctx.debug) {
+    ctx.debug->define(func, lam.loc);
+  }
   FuncBuilder builder{func};
   llvm::Type *capTy = generateLambdaCapture(ctx.llvm, lam)->getPointerTo();
   llvm::Value *closure = builder.ir.CreatePointerCast(func->arg_begin(), capTy);
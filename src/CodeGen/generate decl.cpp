@@ -8,12 +8,18 @@
 
 #include "generate decl.hpp"
 
+#include <algorithm>
 #include "symbols.hpp"
+#include "perf map.hpp"
+#include "debug info.hpp"
+#include "gen helpers.hpp"
+#include "fold globals.hpp"
 #include "generate type.hpp"
 #include "generate stat.hpp"
 #include "generate expr.hpp"
 #include <llvm/IR/Function.h>
 #include "lifetime exprs.hpp"
+#include "Semantic/symbol desc.hpp"
 #include "Utils/iterator range.hpp"
 #include <llvm/Support/DynamicLibrary.h>
 
@@ -21,6 +27,36 @@ using namespace stela;
 
 namespace {
 
+std::string paramDesc(const ast::ParamType &param) {
+  std::string desc = param.ref == ast::ParamRef::ref ? "ref " : "";
+  return desc + typeDesc(param.type);
+}
+
+// The name of a function followed by its signature as it appears in the
+// source. For example, "(ref Vec2) scale(real) -> void"
+std::string sourceDesc(const std::string_view name, const Signature &sig) {
+  std::string desc;
+  if (sig.receiver.type) {
+    desc += '(';
+    desc += paramDesc(sig.receiver);
+    desc += ") ";
+  }
+  desc += name;
+  desc += '(';
+  for (size_t p = 0; p != sig.params.size(); ++p) {
+    if (p != 0) {
+      desc += ", ";
+    }
+    desc += paramDesc(sig.params[p]);
+  }
+  desc += ')';
+  if (sig.ret) {
+    desc += " -> ";
+    desc += typeDesc(sig.ret);
+  }
+  return desc;
+}
+
 class Visitor final : public ast::Visitor {
 public:
   Visitor(gen::Ctx ctx, llvm::Module *module)
@@ -32,6 +68,9 @@ public:
   llvm::StringRef toStringRef(const std::string_view str) {
     return {str.data(), str.size()};
   }
+  void setOwner(ModuleGlobals *newOwner) {
+    owner = newOwner;
+  }
   
   void visit(ast::Func &func) override {
     const Signature sig = getSignature(func);
@@ -43,9 +82,51 @@ public:
       module
     );
     assignAttrs(func.llvmFunc, sig);
+    setSourceName(func.llvmFunc, sourceDesc(func.name, sig));
+    if (owner) {
+      owner->globals.push_back(func.llvmFunc);
+      if (func.external) {
+        owner->externs.push_back(func.llvmFunc);
+        owner->externNames.push_back(func.name);
+      }
+    }
+    if (ctx.debug) {
+      ctx.debug->define(func.llvmFunc, func.loc);
+    }
     FuncBuilder builder{func.llvmFunc};
     gen::Func genFunc{builder, nullptr, func.symbol};
     generateStat(ctx, genFunc, func.receiver, func.params, func.body);
+    func.llvmThunk = func.closure ? generateThunk(func, sig) : nullptr;
+  }
+  // Closures call their function with a pointer to the closure data. Regular
+  // functions don't take this pointer so a thunk is needed to discard it
+  llvm::Function *generateThunk(ast::Func &func, Signature sig) {
+    sig.closure = true;
+    llvm::Function *thunk = llvm::Function::Create(
+      generateSig(ctx.llvm, sig),
+      llvm::GlobalObject::InternalLinkage,
+      toStringRef(func.name) + ".clo",
+      module
+    );
+    assignAttrs(thunk, sig);
+    setSourceName(thunk, sourceName(*func.llvmFunc) + " (closure)");
+    if (owner) {
+      owner->globals.push_back(thunk);
+    }
+    FuncBuilder builder{thunk};
+    std::vector<llvm::Value *> args;
+    for (llvm::Argument &arg : builder.args().drop_front()) {
+      args.push_back(&arg);
+    }
+    coerceArgs(builder.ir, func.llvmFunc->getFunctionType(), args);
+    llvm::CallInst *call = builder.ir.CreateCall(func.llvmFunc, args);
+    call->setTailCall();
+    if (thunk->getReturnType()->isVoidTy()) {
+      builder.ir.CreateRetVoid();
+    } else {
+      builder.ir.CreateRet(call);
+    }
+    return thunk;
   }
   void visit(ast::ExtFunc &func) override {
     llvm::FunctionType *fnType = generateSig(ctx.llvm, func);
@@ -56,6 +137,7 @@ public:
       module
     );
     func.llvmFunc->addFnAttr(llvm::Attribute::NoUnwind);
+    assignByVal(func.llvmFunc, getSignature(func));
     if (func.impl) {
       llvm::sys::DynamicLibrary::AddSymbol(
         func.mangledName,
@@ -106,7 +188,6 @@ public:
     llvm::StringRef nameRef{name.data(), name.size()};
     
     llvm::Function *ctor = makeCtorDtor(ctorName(nameRef));
-    ctor->addFnAttr(llvm::Attribute::ReadNone);
     FuncBuilder ctorBuilder{ctor};
     LifetimeExpr ctorLife{ctx.inst, ctorBuilder.ir};
     if (expr) {
@@ -123,12 +204,22 @@ public:
     ctors.push_back(ctor);
     
     llvm::Function *dtor = makeCtorDtor(dtorName(nameRef));
-    dtor->addFnAttr(llvm::Attribute::ReadOnly);
     FuncBuilder dtorBuilder{dtor};
     LifetimeExpr dtorLife{ctx.inst, dtorBuilder.ir};
     dtorLife.destroy(type, llvmAddr);
     dtorBuilder.ir.CreateRetVoid();
     dtors.push_back(dtor);
+    owners.push_back(owner);
+    
+    if (owner) {
+      owner->globals.push_back(llvm::cast<llvm::GlobalValue>(llvmAddr));
+      owner->globals.push_back(ctor);
+      owner->globals.push_back(dtor);
+      owner->vars.push_back(llvm::cast<llvm::GlobalVariable>(llvmAddr));
+      owner->ctors.push_back(ctor);
+      owner->dtors.push_back(dtor);
+      owner->varNames.push_back(name);
+    }
     
     return llvmAddr;
   }
@@ -178,14 +269,64 @@ public:
     };
   }
   
-  void writeCtorList() {
-    if (ctors.empty()) {
+  // The constructors and destructors of a module stay parallel to its
+  // variables so a null entry is left in place of an erased function
+  using FuncList = std::vector<llvm::Function *> ModuleGlobals::*;
+  void forget(ModuleGlobals *globals, const FuncList list, llvm::Function *func) {
+    if (globals) {
+      auto &funcs = globals->*list;
+      *std::find(funcs.begin(), funcs.end(), func) = nullptr;
+      auto &all = globals->globals;
+      all.erase(std::find(all.begin(), all.end(), func));
+    }
+  }
+  void eraseCtor(const size_t c) {
+    forget(owners[c], &ModuleGlobals::ctors, ctors[c]);
+    ctors[c]->eraseFromParent();
+    ctors[c] = nullptr;
+  }
+  void eraseDtor(const size_t d) {
+    forget(owners[d], &ModuleGlobals::dtors, dtors[d]);
+    dtors[d]->eraseFromParent();
+    dtors[d] = nullptr;
+  }
+  // Constructors that can be evaluated at compile time are replaced by the
+  // initializers of their globals. A constructor may read globals that were
+  // initialized by the constructors before it so folding stops at the first
+  // constructor that can't be evaluated
+  void foldCtorDtors() {
+    for (size_t c = 0; c != ctors.size(); ++c) {
+      if (!foldGlobalCtor(ctors[c])) {
+        break;
+      }
+      eraseCtor(c);
+    }
+    for (size_t d = 0; d != dtors.size(); ++d) {
+      if (isEmptyFunc(dtors[d])) {
+        eraseDtor(d);
+      }
+    }
+    const auto isNull = [](llvm::Function *func) {
+      return func == nullptr;
+    };
+    ctors.erase(std::remove_if(ctors.begin(), ctors.end(), isNull), ctors.end());
+    dtors.erase(std::remove_if(dtors.begin(), dtors.end(), isNull), dtors.end());
+  }
+  void writeList(const std::vector<llvm::Function *> &funcs, const llvm::Twine &name) {
+    if (funcs.empty()) {
       return;
     }
     llvm::StructType *entryType = getEntryType();
-    llvm::ArrayType *listType = llvm::ArrayType::get(entryType, ctors.size());
-    createListVar(createEntries(ctors, entryType), listType, "llvm.global_ctors");
-    createListVar(createEntries(dtors, entryType), listType, "llvm.global_dtors");
+    llvm::ArrayType *listType = llvm::ArrayType::get(entryType, funcs.size());
+    createListVar(createEntries(funcs, entryType), listType, name);
+  }
+  
+  void writeCtorList() {
+    foldCtorDtors();
+    writeList(ctors, "llvm.global_ctors");
+    // globals are destroyed in the reverse order that they were constructed
+    std::reverse(dtors.begin(), dtors.end());
+    writeList(dtors, "llvm.global_dtors");
   }
   
 private:
@@ -193,6 +334,8 @@ private:
   llvm::Module *module;
   std::vector<llvm::Function *> ctors;
   std::vector<llvm::Function *> dtors;
+  std::vector<ModuleGlobals *> owners;
+  ModuleGlobals *owner = nullptr;
 };
 
 }
@@ -204,3 +347,26 @@ void stela::generateDecl(gen::Ctx ctx, llvm::Module *module, const ast::Decls &d
   }
   visitor.writeCtorList();
 }
+
+std::vector<ModuleGlobals> stela::generateDecl(
+  gen::Ctx ctx,
+  llvm::Module *module,
+  const Symbols &syms
+) {
+  std::vector<ModuleGlobals> globals(syms.modules.size());
+  Visitor visitor{ctx, module};
+  size_t begin = 0;
+  for (size_t m = 0; m != syms.modules.size(); ++m) {
+    visitor.setOwner(&globals[m]);
+    if (ctx.debug) {
+      ctx.debug->setFile(syms.modules[m].name);
+    }
+    const size_t end = syms.modules[m].end;
+    for (size_t d = begin; d != end; ++d) {
+      syms.decls[d]->accept(visitor);
+    }
+    begin = end;
+  }
+  visitor.writeCtorList();
+  return globals;
+}
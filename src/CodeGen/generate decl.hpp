@@ -9,18 +9,41 @@
 #ifndef stela_generate_decl_hpp
 #define stela_generate_decl_hpp
 
+#include <vector>
 #include "ast.hpp"
+#include "symbols.hpp"
 #include "gen context.hpp"
 
 namespace llvm {
 
 class Module;
+class Function;
+class GlobalValue;
+class GlobalVariable;
 
 }
 
 namespace stela {
 
+/// The globals that are defined by the declarations of a module
+struct ModuleGlobals {
+  std::vector<llvm::GlobalValue *> globals;
+  /// The global variables and their constructors and destructors. The
+  /// constructor or destructor is null if it was folded away
+  std::vector<llvm::GlobalVariable *> vars;
+  std::vector<llvm::Function *> ctors;
+  std::vector<llvm::Function *> dtors;
+  /// The source names of the global variables
+  std::vector<std::string_view> varNames;
+  /// The extern functions and their source names
+  std::vector<llvm::Function *> externs;
+  std::vector<std::string_view> externNames;
+};
+
 void generateDecl(gen::Ctx, llvm::Module *, const ast::Decls &);
+/// Generate the declarations of every module and collect the globals that each
+/// module defines
+std::vector<ModuleGlobals> generateDecl(gen::Ctx, llvm::Module *, const Symbols &);
 
 }
 
@@ -8,6 +8,7 @@
 
 #include "generate expr.hpp"
 
+#include <utility>
 #include "llvm.hpp"
 #include "symbols.hpp"
 #include "gen types.hpp"
@@ -49,6 +50,12 @@ public:
     expr->accept(*this);
     return {value, classifyValue(expr)};
   }
+  gen::Expr visitMut(ast::Expression *expr) {
+    mutating = dynamic_cast<ast::Subscript *>(expr)
+            || dynamic_cast<ast::MemberIdent *>(expr)
+            || dynamic_cast<ast::Ternary *>(expr);
+    return visitExpr(expr, nullptr);
+  }
   gen::Expr visitBool(ast::Expression *expr) {
     result = nullptr;
     expr->accept(*this);
@@ -248,7 +255,7 @@ public:
   }
   llvm::Value *visitParam(ast::Type *type, ast::ParamRef ref, ast::Expression *expr, Object *destroy) {
     if (ref == ast::ParamRef::ref) {
-      const gen::Expr evalExpr = visitExpr(expr, nullptr);
+      const gen::Expr evalExpr = visitMut(expr);
       assert(evalExpr.cat == ValueCat::lvalue);
       return evalExpr.obj;
     }
@@ -287,29 +294,48 @@ public:
       }
     }
   }
-  void genCall(
+  // small structs are returned in registers
+  bool returnsRegisters(llvm::FunctionType *type, ast::Expression *expr) {
+    return !type->getReturnType()->isVoidTy() &&
+      classifyType(expr->exprType.get()) != TypeCat::trivially_copyable;
+  }
+  llvm::CallInst *genCall(
     llvm::Value *func,
     llvm::FunctionType *type,
     std::vector<llvm::Value *> &args,
     llvm::Value *resultAddr,
     ast::Expression *expr
   ) {
+    coerceArgs(builder.ir, type, args);
+    llvm::CallInst *call;
     if (type->getNumParams() == args.size() + 1) {
       if (resultAddr) {
         args.push_back(resultAddr);
-        builder.ir.CreateCall(func, args);
+        call = builder.ir.CreateCall(func, args);
         value = nullptr;
       } else {
         llvm::Type *retType = type->params().back()->getPointerElementType();
         llvm::Value *retAddr = builder.alloc(retType);
         args.push_back(retAddr);
-        builder.ir.CreateCall(func, args);
+        call = builder.ir.CreateCall(func, args);
+        value = retAddr;
+      }
+    } else if (returnsRegisters(type, expr)) {
+      call = builder.ir.CreateCall(func, args);
+      if (resultAddr) {
+        storeCoerced(builder.ir, call, resultAddr);
+        value = nullptr;
+      } else {
+        llvm::Value *retAddr = builder.alloc(generateType(ctx.llvm, expr->exprType.get()));
+        storeCoerced(builder.ir, call, retAddr);
         value = retAddr;
       }
     } else {
-      value = builder.ir.CreateCall(func, args);
+      call = builder.ir.CreateCall(func, args);
+      value = call;
       constructResultFromValue(resultAddr, expr);
     }
+    return call;
   }
   void callFuncPtr(ast::FuncCall &call, llvm::Value *resultAddr) {
     const gen::Expr func = visitExpr(call.func.get(), nullptr);
@@ -328,7 +354,7 @@ public:
         param.type.get(), param.ref, call.args[a].get(), &dtors[a]
       ));
     }
-    genCall(fun, fnType, args, resultAddr, &call);
+    assignByVal(genCall(fun, fnType, args, resultAddr, &call), sig);
     destroyArgs(dtors);
     if (func.cat == ValueCat::prvalue) {
       lifetime.destroy(funcType, func.obj);
@@ -344,8 +370,6 @@ public:
       ast::Expression *self = assertDownCast<ast::MemberIdent>(call.func.get())->object.get();
       ast::FuncParam &rec = *func->receiver;
       args.push_back(visitParam(rec.type.get(), rec.ref, self, &dtors[0]));
-    } else {
-      args.push_back(llvm::UndefValue::get(voidPtrTy(ctx.llvm)));
     }
     pushArgs(args, call.args, func->params, dtors);
     genCall(func->llvmFunc, funcType, args, resultAddr, &call);
@@ -403,13 +427,15 @@ public:
     }
   }
   
-  llvm::Value *materialize(ast::Expression *expr) {
+  llvm::Value *materialize(ast::Expression *expr, const bool mut = false) {
     if (classifyValue(expr) == ValueCat::prvalue) {
       ast::Type *type = expr->exprType.get();
       llvm::Value *object = builder.alloc(generateType(ctx.llvm, type));
       visitExpr(expr, object);
       temps.push_back({object, type});
       return object;
+    } else if (mut) {
+      return visitMut(expr).obj;
     } else {
       return visitExpr(expr, nullptr).obj;
     }
@@ -417,7 +443,8 @@ public:
   
   void visit(ast::MemberIdent &mem) override {
     llvm::Value *resultAddr = result;
-    llvm::Value *object = materialize(mem.object.get());
+    const bool mut = std::exchange(mutating, false);
+    llvm::Value *object = materialize(mem.object.get(), mut);
     ast::Type *objectType = concreteType(mem.object->exprType.get());
     if (auto *strut = dynamic_cast<ast::StructType *>(objectType)) {
       value = builder.ir.CreateStructGEP(object, mem.index);
@@ -442,7 +469,8 @@ public:
   
   void visit(ast::Subscript &sub) override {
     llvm::Value *resultAddr = result;
-    llvm::Value *object = materialize(sub.object.get());
+    const bool mut = std::exchange(mutating, false);
+    llvm::Value *object = materialize(sub.object.get(), mut);
     gen::Expr index = visitValue(sub.index.get());
     ast::BtnType *indexType = concreteType<ast::BtnType>(sub.index->exprType.get());
     
@@ -454,6 +482,9 @@ public:
     } else {
       indexFn = ctx.inst.get<PFGI::arr_idx_u>(arr);
     }
+    if (mut) {
+      builder.ir.CreateCall(ctx.inst.get<PFGI::arr_unshare>(arr), {object});
+    }
     value = builder.ir.CreateCall(indexFn, {object, index.obj});
     
     constructResultFromValue(resultAddr, &sub);
@@ -485,11 +516,11 @@ public:
       auto *funcType = assertDownCast<ast::FuncType>(exprType);
       llvm::Function *funCtor = ctx.inst.get<PFGI::clo_fun_ctor>(funcType);
       if (resultAddr) {
-        builder.ir.CreateCall(funCtor, {resultAddr, func->llvmFunc});
+        builder.ir.CreateCall(funCtor, {resultAddr, func->llvmThunk});
         value = nullptr;
       } else {
         llvm::Value *fnAddr = builder.alloc(generateType(ctx.llvm, funcType));
-        builder.ir.CreateCall(funCtor, {fnAddr, func->llvmFunc});
+        builder.ir.CreateCall(funCtor, {fnAddr, func->llvmThunk});
         value = fnAddr;
       }
       // @TODO lifetime.startLife
@@ -515,6 +546,7 @@ public:
     auto *folsBlock = builder.makeBlock();
     auto *doneBlock = builder.makeBlock();
     llvm::Value *resultAddr = result;
+    const bool mut = std::exchange(mutating, false);
     
     builder.setCurr(condBlock);
     builder.ir.CreateCondBr(visitBool(tern.cond.get()).obj, trooBlock, folsBlock);
@@ -532,9 +564,9 @@ public:
       value = nullptr;
     } else if (trooCat == ValueCat::lvalue && folsCat == ValueCat::lvalue) {
       builder.setCurr(trooBlock);
-      troo = visitExpr(tern.troo.get(), nullptr);
+      troo = mut ? visitMut(tern.troo.get()) : visitExpr(tern.troo.get(), nullptr);
       builder.setCurr(folsBlock);
-      fols = visitExpr(tern.fols.get(), nullptr);
+      fols = mut ? visitMut(tern.fols.get()) : visitExpr(tern.fols.get(), nullptr);
     } else if (classifyType(tern.exprType.get()) == TypeCat::trivially_copyable) {
       builder.setCurr(trooBlock);
       troo = visitValue(tern.troo.get());
@@ -720,7 +752,7 @@ public:
   void visit(ast::Lambda &lambda) override {
     llvm::Value *resultAddr = result;
     llvm::Function *body = genLambdaBody(ctx, lambda);
-    llvm::Function *alloc = ctx.inst.get<FGI::alloc>();
+    llvm::Function *alloc = ctx.inst.get<FGI::obj_alloc>();
     llvm::Type *capTy = generateLambdaCapture(ctx.llvm, lambda);
     llvm::Value *captures = callAlloc(builder.ir, alloc, capTy);
     initRefCount(builder.ir, captures);
@@ -763,6 +795,8 @@ private:
   llvm::Value *closure = nullptr;
   llvm::Value *value = nullptr;
   llvm::Value *result = nullptr;
+  // Set when the subscript, member or ternary being visited is modified
+  bool mutating = false;
   
   void storeValueAsResult(llvm::Value *resultAddr) {
     if (resultAddr) {
@@ -813,3 +847,13 @@ gen::Expr stela::generateExpr(
   Visitor visitor{temps, ctx, func.builder, func.closure};
   return visitor.visitExpr(expr, result);
 }
+
+gen::Expr stela::generateMutExpr(
+  Scope &temps,
+  gen::Ctx ctx,
+  gen::Func func,
+  ast::Expression *expr
+) {
+  Visitor visitor{temps, ctx, func.builder, func.closure};
+  return visitor.visitMut(expr);
+}
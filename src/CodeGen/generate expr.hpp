@@ -37,6 +37,9 @@ struct Func {
 gen::Expr generateValueExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *);
 gen::Expr generateBoolExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *);
 gen::Expr generateExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *, llvm::Value *);
+/// Generate an lvalue that is about to be modified. The arrays that it is an
+/// element of are given their own storage first
+gen::Expr generateMutExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *);
 
 }
 
@@ -6,16 +6,100 @@
 //  Copyright © 2018 Indi Kernick. All rights reserved.
 //
 
+#include <mutex>
 #include "inst data.hpp"
+#include <unordered_map>
 #include "gen types.hpp"
+#include "allocator.hpp"
 #include "gen helpers.hpp"
 #include "compare exprs.hpp"
 #include "lifetime exprs.hpp"
 #include "function builder.hpp"
 #include "func instantiations.hpp"
+#include <llvm/Support/DynamicLibrary.h>
 
 using namespace stela;
 
+namespace {
+
+constexpr unsigned allocator_idx_alloc = 0;
+constexpr unsigned allocator_idx_free = 1;
+constexpr unsigned allocator_idx_self = 2;
+
+/// Each allocator is given a symbol the first time that it's used. Code that
+/// is compiled for the same allocator is identical so it can be cached
+std::string allocatorSymbol(const Allocator *allocator) {
+  static std::mutex mutex;
+  static std::unordered_map<const Allocator *, std::string> symbols;
+  std::lock_guard<std::mutex> lock{mutex};
+  auto [iter, inserted] = symbols.try_emplace(allocator);
+  if (inserted) {
+    iter->second = "stela_allocator_" + std::to_string(symbols.size() - 1);
+    llvm::sys::DynamicLibrary::AddSymbol(iter->second, const_cast<Allocator *>(allocator));
+  }
+  return iter->second;
+}
+
+/// Declare the Allocator table. The address is resolved when the code is
+/// linked
+llvm::Constant *allocatorTable(llvm::Module *module, const Allocator *allocator) {
+  llvm::LLVMContext &ctx = module->getContext();
+  llvm::Type *memTy = voidPtrTy(ctx);
+  llvm::Type *sizeTy = getType<size_t>(ctx);
+  llvm::FunctionType *allocType = llvm::FunctionType::get(memTy, {memTy, sizeTy}, false);
+  llvm::FunctionType *freeType = llvm::FunctionType::get(voidTy(ctx), {memTy, memTy}, false);
+  llvm::StructType *tableType = llvm::StructType::get(ctx, {
+    allocType->getPointerTo(), freeType->getPointerTo(), memTy
+  });
+  return module->getOrInsertGlobal(allocatorSymbol(allocator), tableType);
+}
+
+llvm::FunctionType *allocSig(llvm::Module *module) {
+  llvm::LLVMContext &ctx = module->getContext();
+  return llvm::FunctionType::get(voidPtrTy(ctx), {getType<size_t>(ctx)}, false);
+}
+
+llvm::FunctionType *freeSig(llvm::Module *module) {
+  llvm::LLVMContext &ctx = module->getContext();
+  return llvm::FunctionType::get(voidTy(ctx), {voidPtrTy(ctx)}, false);
+}
+
+/// Make a function that calls an allocation function and panics if it
+/// returns null
+template <typename CallAlloc>
+llvm::Function *makeCheckedAlloc(InstData data, const llvm::Twine &name, CallAlloc callAlloc) {
+  llvm::Function *alloc = makeInternalFunc(data.mod, allocSig(data.mod), name);
+  alloc->addAttribute(0, llvm::Attribute::NoAlias);
+  alloc->addAttribute(0, llvm::Attribute::NonNull);
+  FuncBuilder builder{alloc};
+  
+  llvm::BasicBlock *okBlock = builder.makeBlock();
+  llvm::BasicBlock *errorBlock = builder.makeBlock();
+  llvm::Value *ptr = callAlloc(builder, alloc->arg_begin());
+  llvm::Value *isNotNull = builder.ir.CreateIsNotNull(ptr);
+  likely(builder.ir.CreateCondBr(isNotNull, okBlock, errorBlock));
+  
+  builder.setCurr(okBlock);
+  builder.ir.CreateRet(ptr);
+  builder.setCurr(errorBlock);
+  callPanic(builder.ir, data.inst.get<FGI::panic>(), "Out of memory");
+  
+  return alloc;
+}
+
+/// Declare a function that is implemented by the host
+llvm::Function *declareHostFunc(
+  llvm::Module *module,
+  llvm::FunctionType *type,
+  const char *name,
+  void *addr
+) {
+  llvm::sys::DynamicLibrary::AddSymbol(name, addr);
+  return declareCFunc(module, type, name);
+}
+
+}
+
 template <>
 llvm::Function *stela::genFn<FGI::panic>(InstData data) {
   llvm::LLVMContext &ctx = data.mod->getContext();
@@ -46,42 +130,69 @@ llvm::Function *stela::genFn<FGI::panic>(InstData data) {
 
 template <>
 llvm::Function *stela::genFn<FGI::alloc>(InstData data) {
-  llvm::LLVMContext &ctx = data.mod->getContext();
-  
-  llvm::Type *memTy = voidPtrTy(ctx);
-  llvm::Type *sizeTy = getType<size_t>(ctx);
-  llvm::FunctionType *mallocType = llvm::FunctionType::get(memTy, {sizeTy}, false);
-  llvm::FunctionType *allocType = mallocType;
-  
-  llvm::Function *malloc = declareCFunc(data.mod, mallocType, "malloc");
-  llvm::Function *alloc = makeInternalFunc(data.mod, allocType, "alloc");
-  malloc->addAttribute(0, llvm::Attribute::NoAlias);
-  alloc->addAttribute(0, llvm::Attribute::NoAlias);
-  alloc->addAttribute(0, llvm::Attribute::NonNull);
-  FuncBuilder builder{alloc};
-  
-  llvm::BasicBlock *okBlock = builder.makeBlock();
-  llvm::BasicBlock *errorBlock = builder.makeBlock();
-  llvm::Value *ptr = builder.ir.CreateCall(malloc, alloc->arg_begin());
-  llvm::Value *isNotNull = builder.ir.CreateIsNotNull(ptr);
-  likely(builder.ir.CreateCondBr(isNotNull, okBlock, errorBlock));
-  
-  builder.setCurr(okBlock);
-  builder.ir.CreateRet(ptr);
-  builder.setCurr(errorBlock);
-  callPanic(builder.ir, data.inst.get<FGI::panic>(), "Out of memory");
-  
-  return alloc;
+  return makeCheckedAlloc(data, "alloc", [data](FuncBuilder &builder, llvm::Value *size) {
+    if (const Allocator *allocator = data.inst.allocator()) {
+      llvm::Constant *table = allocatorTable(data.mod, allocator);
+      llvm::Value *allocFn = loadStructElem(builder.ir, table, allocator_idx_alloc);
+      llvm::Value *self = loadStructElem(builder.ir, table, allocator_idx_self);
+      return builder.ir.CreateCall(allocFn, {self, size});
+    } else {
+      llvm::Function *malloc = declareCFunc(data.mod, allocSig(data.mod), "malloc");
+      malloc->addAttribute(0, llvm::Attribute::NoAlias);
+      return builder.ir.CreateCall(malloc, size);
+    }
+  });
 }
 
 template <>
 llvm::Function *stela::genFn<FGI::free>(InstData data) {
-  llvm::LLVMContext &ctx = data.mod->getContext();
-  llvm::Type *memTy = voidPtrTy(ctx);
-  llvm::FunctionType *freeType = llvm::FunctionType::get(voidTy(ctx), {memTy}, false);
-  llvm::Function *free = declareCFunc(data.mod, freeType, "free");
-  free->addParamAttr(0, llvm::Attribute::NoCapture);
-  return free;
+  const Allocator *allocator = data.inst.allocator();
+  if (!allocator) {
+    llvm::Function *free = declareCFunc(data.mod, freeSig(data.mod), "free");
+    free->addParamAttr(0, llvm::Attribute::NoCapture);
+    return free;
+  }
+  
+  llvm::Function *dealloc = makeInternalFunc(data.mod, freeSig(data.mod), "dealloc");
+  dealloc->addParamAttr(0, llvm::Attribute::NoCapture);
+  FuncBuilder builder{dealloc};
+  llvm::Constant *table = allocatorTable(data.mod, allocator);
+  llvm::Value *freeFn = loadStructElem(builder.ir, table, allocator_idx_free);
+  llvm::Value *self = loadStructElem(builder.ir, table, allocator_idx_self);
+  builder.ir.CreateCall(freeFn, {self, dealloc->arg_begin()});
+  builder.ir.CreateRetVoid();
+  return dealloc;
+}
+
+template <>
+llvm::Function *stela::genFn<FGI::obj_alloc>(InstData data) {
+  return makeCheckedAlloc(data, "obj_alloc", [data](FuncBuilder &builder, llvm::Value *size) {
+    llvm::LLVMContext &ctx = data.mod->getContext();
+    llvm::Type *memTy = voidPtrTy(ctx);
+    llvm::FunctionType *sig = llvm::FunctionType::get(
+      memTy, {memTy, getType<size_t>(ctx)}, false
+    );
+    llvm::Function *objectAlloc = declareHostFunc(
+      data.mod, sig, "stela_obj_alloc", reinterpret_cast<void *>(&stela::objectAlloc)
+    );
+    objectAlloc->addAttribute(0, llvm::Attribute::NoAlias);
+    // The block remembers the allocator so that it can be freed by the host
+    // or by code compiled for a different allocator
+    llvm::Value *allocator = llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(memTy));
+    if (data.inst.allocator()) {
+      allocator = builder.ir.CreatePointerCast(allocatorTable(data.mod, data.inst.allocator()), memTy);
+    }
+    return builder.ir.CreateCall(objectAlloc, {allocator, size});
+  });
+}
+
+template <>
+llvm::Function *stela::genFn<FGI::obj_free>(InstData data) {
+  llvm::Function *objectFree = declareHostFunc(
+    data.mod, freeSig(data.mod), "stela_obj_free", reinterpret_cast<void *>(&stela::objectFree)
+  );
+  objectFree->addParamAttr(0, llvm::Attribute::NoCapture);
+  return objectFree;
 }
 
 template <>
@@ -0,0 +1,79 @@
+//
+//  generate module.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "generate module.hpp"
+
+#include <optional>
+#include "allocator.hpp"
+#include "debug info.hpp"
+#include "host machine.hpp"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include "func instantiations.hpp"
+#include <llvm/Target/TargetMachine.h>
+
+using namespace stela;
+
+namespace {
+
+// The host and the compiled code have to allocate objects the same way
+const Allocator *codeAllocator(Log &log, const OptFlags opt) {
+  const Allocator *scope = currentAllocator();
+  if (!opt.allocator) {
+    return scope;
+  }
+  if (scope && scope != opt.allocator) {
+    log.error() << "OptFlags::allocator does not match the current AllocatorScope" << fatal;
+  }
+  return opt.allocator;
+}
+
+}
+
+std::unique_ptr<llvm::Module> stela::generateModule(
+  llvm::LLVMContext &context,
+  const Symbols &syms,
+  Log &log,
+  std::vector<ModuleGlobals> *globals,
+  const OptFlags opt
+) {
+  log.status() << "Generating code" << endlog;
+  
+  auto module = std::make_unique<llvm::Module>("", context);
+  std::unique_ptr<llvm::TargetMachine> machine = createHostMachine(log, opt);
+  module->setTargetTriple(machine->getTargetTriple().str());
+  module->setDataLayout(machine->createDataLayout());
+  FuncInst inst{module.get(), opt.atomicRefs, codeAllocator(log, opt)};
+  std::optional<DebugInfo> debug;
+  if (opt.debugInfo) {
+    debug.emplace(*module);
+  }
+  gen::Ctx ctx {module->getContext(), module.get(), inst, log, debug ? &*debug : nullptr};
+  // The declarations are generated module by module so that each Stela
+  // module has its own file in the debug info
+  if (globals || debug) {
+    std::vector<ModuleGlobals> moduleGlobals = generateDecl(ctx, module.get(), syms);
+    if (globals) {
+      *globals = std::move(moduleGlobals);
+    }
+  } else {
+    generateDecl(ctx, module.get(), syms.decls);
+  }
+  if (debug) {
+    debug->finalize();
+  }
+  
+  std::string str;
+  llvm::raw_string_ostream strStream(str);
+  if (llvm::verifyModule(*module, &strStream)) {
+    strStream.flush();
+    log.error() << str << fatal;
+  }
+  
+  return module;
+}
@@ -0,0 +1,36 @@
+//
+//  generate module.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_generate_module_hpp
+#define stela_generate_module_hpp
+
+#include <memory>
+#include "symbols.hpp"
+#include "generate decl.hpp"
+#include "Log/log output.hpp"
+#include "code generation.hpp"
+
+namespace llvm {
+
+class LLVMContext;
+class Module;
+
+}
+
+namespace stela {
+
+/// Generate a module for the host machine from the declarations in the
+/// Symbols. If a vector is given, the globals defined by each Stela module are
+/// written to it
+std::unique_ptr<llvm::Module> generateModule(
+  llvm::LLVMContext &, const Symbols &, Log &, std::vector<ModuleGlobals> * = nullptr, OptFlags = opt_all
+);
+
+}
+
+#endif
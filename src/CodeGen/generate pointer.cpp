@@ -20,7 +20,27 @@ enum class RefChg {
   dec
 };
 
-llvm::Value *refChange(llvm::IRBuilder<> &ir, llvm::Value *ptr, const RefChg chg) {
+llvm::Value *refChange(
+  llvm::IRBuilder<> &ir,
+  llvm::Value *ptr,
+  const RefChg chg,
+  const bool atomic
+) {
+  if (atomic) {
+    // Taking a reference doesn't need to synchronize with anything. Dropping
+    // one releases so that the thread that destroys the object sees every
+    // write made to it
+    llvm::Constant *one = constantForPtr(ptr, 1);
+    llvm::Value *ref = ir.CreateAtomicRMW(
+      chg == RefChg::inc ? llvm::AtomicRMWInst::Add : llvm::AtomicRMWInst::Sub,
+      ptr,
+      one,
+      chg == RefChg::inc ? llvm::AtomicOrdering::Monotonic
+                         : llvm::AtomicOrdering::Release
+    );
+    return chg == RefChg::inc ? ir.CreateNSWAdd(ref, one)
+                              : ir.CreateNSWSub(ref, one);
+  }
   llvm::Value *ref = ir.CreateLoad(ptr);
   llvm::Constant *one = constantFor(ref, 1);
   llvm::Value *changed = chg == RefChg::inc ? ir.CreateNSWAdd(ref, one)
@@ -51,7 +71,7 @@ llvm::Function *stela::genFn<FGI::ptr_inc>(InstData data) {
   builder.ir.CreateCondBr(ptrNotNull, incBlock, doneBlock);
   
   builder.setCurr(incBlock);
-  refChange(builder.ir, func->arg_begin(), RefChg::inc);
+  refChange(builder.ir, func->arg_begin(), RefChg::inc, data.inst.atomicRefs());
   builder.ir.CreateBr(doneBlock);
   
   builder.setCurr(doneBlock);
@@ -78,6 +98,16 @@ llvm::Function *stela::genFn<FGI::ptr_dec>(InstData data) {
     if ptr.ref == 0
       dtor
       free ptr
+  
+  atomic:
+  
+  if ptr != null
+    if atomic_load_acquire(ptr.ref) != 1
+      if atomic_sub_release(ptr.ref) != 1
+        return
+      fence_acquire
+    dtor
+    free ptr
   */
   
   llvm::BasicBlock *decBlock = builder.makeBlock();
@@ -86,17 +116,42 @@ llvm::Function *stela::genFn<FGI::ptr_dec>(InstData data) {
   llvm::Value *dtor = func->arg_begin();
   llvm::Value *ptr = func->arg_begin() + 1;
   llvm::Value *ptrNotNull = builder.ir.CreateIsNotNull(ptr);
-  builder.ir.CreateCondBr(ptrNotNull, decBlock, doneBlock);
+  const bool atomic = data.inst.atomicRefs();
   
-  builder.setCurr(decBlock);
-  llvm::Value *subed = refChange(builder.ir, ptr, RefChg::dec);
-  llvm::Value *refIsZero = builder.ir.CreateICmpEQ(subed, constantFor(subed, 0));
-  builder.ir.CreateCondBr(refIsZero, destroyBlock, doneBlock);
+  if (atomic) {
+    // A unique owner can't race with anyone so it skips the read-modify-write.
+    // Objects that never leave their thread stay unique and only pay for the
+    // load
+    llvm::BasicBlock *checkBlock = decBlock;
+    decBlock = builder.makeBlock();
+    llvm::BasicBlock *fenceBlock = builder.makeBlock();
+    builder.ir.CreateCondBr(ptrNotNull, checkBlock, doneBlock);
+    
+    builder.setCurr(checkBlock);
+    llvm::Value *ref = loadRefCount(builder.ir, ptr, true);
+    llvm::Value *unique = builder.ir.CreateICmpEQ(ref, constantFor(ref, 1));
+    builder.ir.CreateCondBr(unique, destroyBlock, decBlock);
+    
+    builder.setCurr(decBlock);
+    llvm::Value *subed = refChange(builder.ir, ptr, RefChg::dec, true);
+    llvm::Value *refIsZero = builder.ir.CreateICmpEQ(subed, constantFor(subed, 0));
+    builder.ir.CreateCondBr(refIsZero, fenceBlock, doneBlock);
+    
+    builder.setCurr(fenceBlock);
+    builder.ir.CreateFence(llvm::AtomicOrdering::Acquire);
+    builder.ir.CreateBr(destroyBlock);
+  } else {
+    builder.ir.CreateCondBr(ptrNotNull, decBlock, doneBlock);
+    builder.setCurr(decBlock);
+    llvm::Value *subed = refChange(builder.ir, ptr, RefChg::dec, false);
+    llvm::Value *refIsZero = builder.ir.CreateICmpEQ(subed, constantFor(subed, 0));
+    builder.ir.CreateCondBr(refIsZero, destroyBlock, doneBlock);
+  }
   
   builder.setCurr(destroyBlock);
   llvm::Value *voidPtr = builder.ir.CreatePointerCast(ptr, voidPtrTy(ctx));
   builder.ir.CreateCall(dtor, {voidPtr});
-  callFree(builder.ir, data.inst.get<FGI::free>(), ptr);
+  callFree(builder.ir, data.inst.get<FGI::obj_free>(), ptr);
   builder.ir.CreateBr(doneBlock);
   
   builder.setCurr(doneBlock);
@@ -11,6 +11,8 @@
 #include "llvm.hpp"
 #include "symbols.hpp"
 #include "categories.hpp"
+#include "debug info.hpp"
+#include "gen helpers.hpp"
 #include "compare exprs.hpp"
 #include "generate type.hpp"
 #include "generate expr.hpp"
@@ -30,6 +32,65 @@ struct FlowData {
   size_t scopeIndex = 0;
 };
 
+/// Finds the local variable that every return statement returns. This
+/// variable can be constructed directly in the return slot (NRVO)
+class NRVOVisitor final : public ast::Visitor {
+public:
+  void visit(ast::Block &block) override {
+    for (const ast::StatPtr &stat : block.nodes) {
+      stat->accept(*this);
+    }
+  }
+  void visit(ast::If &fi) override {
+    fi.body->accept(*this);
+    if (fi.elseBody) {
+      fi.elseBody->accept(*this);
+    }
+  }
+  void visit(ast::Switch &swich) override {
+    for (const ast::SwitchCase &cas : swich.cases) {
+      cas.body->accept(*this);
+    }
+  }
+  void visit(ast::While &wile) override {
+    wile.body->accept(*this);
+  }
+  void visit(ast::For &four) override {
+    four.body->accept(*this);
+  }
+  void visit(ast::Return &ret) override {
+    ast::Statement *local = returnedLocal(ret.expr.get());
+    if (!local || (object && object != local)) {
+      failed = true;
+    } else {
+      object = local;
+    }
+  }
+  
+  ast::Statement *returnedObject() const {
+    return failed ? nullptr : object;
+  }
+
+private:
+  ast::Statement *object = nullptr;
+  bool failed = false;
+  
+  static ast::Statement *returnedLocal(ast::Expression *expr) {
+    auto *ident = dynamic_cast<ast::Identifier *>(expr);
+    if (!ident || ident->captureIndex != ~uint32_t{}) {
+      return nullptr;
+    }
+    ast::Statement *def = ident->definition;
+    if (dynamic_cast<ast::Var *>(def) || dynamic_cast<ast::Let *>(def)) {
+      return def;
+    }
+    if (dynamic_cast<ast::DeclAssign *>(def)) {
+      return def;
+    }
+    return nullptr;
+  }
+};
+
 class Visitor final : public ast::Visitor {
 public:
   Visitor(gen::Ctx ctx, gen::Func func)
@@ -51,6 +112,9 @@ public:
   gen::Expr genExpr(ast::Expression *expr) {
     return generateExpr(scopes.back(), ctx, makeFunc(), expr, nullptr);
   }
+  gen::Expr genMutExpr(ast::Expression *expr) {
+    return generateMutExpr(scopes.back(), ctx, makeFunc(), expr);
+  }
   void genCondBr(
     ast::Expression *cond,
     llvm::BasicBlock *troo,
@@ -84,10 +148,15 @@ public:
     return equalExpr;
   }
   
+  void visitStat(ast::Statement *stat) {
+    setDebugLoc(builder.ir, stat->loc);
+    stat->accept(*this);
+  }
+  
   void visit(ast::Block &block) override {
     enterScope();
     for (const ast::StatPtr &stat : block.nodes) {
-      stat->accept(*this);
+      visitStat(stat.get());
     }
     leaveScope();
   }
@@ -255,26 +324,41 @@ public:
     if (cat == TypeCat::trivially_copyable) {
       return trivialReturnObject(expr);
     }
+    if (nrvoAddr) {
+      // the object is already in the return slot
+      return nrvoAddr;
+    }
     if (ast::Identifier *ident = rootLvalue(expr)) {
       sym::Object *object = getObject(ident->definition);
       if (object && canMoveReturn(object)) {
-        llvm::Value *retObj = &builder.args().back();
+        llvm::Value *retObj = returnAddr(expr->exprType.get());
         lifetime.moveConstruct(expr->exprType.get(), retObj, genExpr(expr).obj);
         return retObj;
       }
     }
-    llvm::Value *retObj = &builder.args().back();
-    // @TODO NRVO
-    // if there is one object that is always returned from a function,
-    //   treat the return pointer as an lvalue of that object
+    llvm::Value *retObj = returnAddr(expr->exprType.get());
     genExpr(expr, retObj);
     return retObj;
   }
+  // Small structs are returned in registers so they are constructed in a
+  // local variable. Everything else is constructed in the return parameter
+  llvm::Value *returnAddr(ast::Type *type) {
+    if (builder.ir.getCurrentFunctionReturnType()->isVoidTy()) {
+      return &builder.args().back();
+    }
+    if (!retAddr) {
+      retAddr = builder.alloc(generateType(ctx.llvm, type));
+    }
+    return retAddr;
+  }
   void returnObject(llvm::Value *retObj, const TypeCat cat) {
+    llvm::Type *retType = builder.ir.getCurrentFunctionReturnType();
     if (retObj->getType()->isVoidTy()) {
       builder.ir.CreateRetVoid();
     } else if (cat == TypeCat::trivially_copyable) {
       builder.ir.CreateRet(retObj);
+    } else if (!retType->isVoidTy()) { // small struct
+      builder.ir.CreateRet(loadCoerced(builder.ir, retType, retObj));
     } else { // trivially_relocatable or nontrivial
       builder.ir.CreateRetVoid();
     }
@@ -283,7 +367,7 @@ public:
     if (ret.expr) {
       const TypeCat cat = classifyType(ret.expr->exprType.get());
       llvm::Value *retObj = createReturnObject(ret.expr.get(), cat);
-      destroy(0);
+      destroy(0, nrvoAddr);
       returnObject(retObj, cat);
     } else {
       destroy(0);
@@ -300,6 +384,7 @@ public:
     leaveScope();
     builder.terminate(cond);
     builder.setCurr(cond);
+    setDebugLoc(builder.ir, wile.cond->loc);
     genCondBr(wile.cond.get(), body, done);
     builder.setCurr(done);
   }
@@ -318,10 +403,11 @@ public:
     leaveScope();
     builder.terminate(incr);
     builder.setCurr(cond);
+    setDebugLoc(builder.ir, four.cond->loc);
     genCondBr(four.cond.get(), body, done);
     builder.setCurr(incr);
     if (four.incr) {
-      four.incr->accept(*this);
+      visitStat(four.incr.get());
     }
     builder.ir.CreateBr(cond);
     builder.setCurr(done);
@@ -329,9 +415,17 @@ public:
     leaveScope();
   }
   
-  llvm::Value *insertVar(sym::Object *obj, ast::Expression *expr) {
+  void setNRVO(ast::Statement *object) {
+    nrvo = object;
+  }
+  llvm::Value *insertVar(ast::Statement *decl, sym::Object *obj, ast::Expression *expr) {
     ast::Type *type = obj->etype.type.get();
-    llvm::Value *addr = builder.alloc(generateType(ctx.llvm, type));
+    llvm::Value *addr;
+    if (decl == nrvo && classifyType(type) != TypeCat::trivially_copyable) {
+      addr = nrvoAddr = returnAddr(type);
+    } else {
+      addr = builder.alloc(generateType(ctx.llvm, type));
+    }
     if (expr) {
       const size_t exprScope = enterScope();
       if (isBoolCast(type, expr->exprType.get())) {
@@ -350,16 +444,18 @@ public:
   }
   
   void visit(ast::Var &var) override {
-    var.llvmAddr = insertVar(var.symbol, var.expr.get());
+    var.llvmAddr = insertVar(&var, var.symbol, var.expr.get());
   }
   void visit(ast::Let &let) override {
-    let.llvmAddr = insertVar(let.symbol, let.expr.get());
+    let.llvmAddr = insertVar(&let, let.symbol, let.expr.get());
   }
   
-  void destroy(const size_t index) {
+  void destroy(const size_t index, llvm::Value *keep = nullptr) {
     for (size_t i = scopes.size() - 1; i != index - 1; --i) {
       for (const Object obj : rev_range(scopes[i])) {
-        lifetime.destroy(obj.type, obj.addr);
+        if (obj.addr != keep) {
+          lifetime.destroy(obj.type, obj.addr);
+        }
       }
     }
   }
@@ -367,7 +463,7 @@ public:
   void visit(ast::Assign &assign) override {
     const size_t exprScope = enterScope();
     ast::Type *type = assign.dst->exprType.get();
-    gen::Expr dst = genExpr(assign.dst.get());
+    gen::Expr dst = genMutExpr(assign.dst.get());
     gen::Expr src = genExpr(assign.src.get());
     assert(glvalue(dst.cat));
     lifetime.assign(type, dst.obj, src);
@@ -375,7 +471,7 @@ public:
     leaveScope();
   }
   void visit(ast::DeclAssign &assign) override {
-    assign.llvmAddr = insertVar(assign.symbol, assign.expr.get());
+    assign.llvmAddr = insertVar(&assign, assign.symbol, assign.expr.get());
   }
   void visit(ast::CallAssign &assign) override {
     const size_t exprScope = enterScope();
@@ -391,6 +487,9 @@ public:
     } else {
       if (classifyType(param.type.get()) == TypeCat::trivially_copyable) {
         param.llvmAddr = builder.allocStore(arg);
+      } else if (!arg->getType()->isPointerTy()) { // passed in registers
+        param.llvmAddr = builder.alloc(generateType(ctx.llvm, param.type.get()));
+        storeCoerced(builder.ir, arg, param.llvmAddr);
       } else { // trivially_relocatable or nontrivial
         param.llvmAddr = arg;
       }
@@ -417,6 +516,9 @@ private:
   LifetimeExpr lifetime;
   llvm::Value *closure;
   sym::Symbol *symbol;
+  llvm::Value *retAddr = nullptr;
+  ast::Statement *nrvo = nullptr;
+  llvm::Value *nrvoAddr = nullptr;
 };
 
 }
@@ -430,16 +532,20 @@ void stela::generateStat(
 ) {
   lowerExpressions(block);
   Visitor visitor{ctx, func};
+  NRVOVisitor nrvo;
+  nrvo.visit(block);
+  visitor.setNRVO(nrvo.returnedObject());
   visitor.enterScope();
   // @TODO maybe do parameter insersion in a separate function
   if (rec) {
     visitor.insert(*rec, 0);
   }
+  const size_t first = rec || func.closure ? 1 : 0;
   for (size_t p = 0; p != params.size(); ++p) {
-    visitor.insert(params[p], p + 1);
+    visitor.insert(params[p], first + p);
   }
   for (const ast::StatPtr &stat : block.nodes) {
-    stat->accept(visitor);
+    visitor.visitStat(stat.get());
   }
   visitor.leaveScope();
 }
@@ -9,13 +9,17 @@
 #include "generate type.hpp"
 
 #include "llvm.hpp"
+#include <algorithm>
 #include "symbols.hpp"
 #include "gen types.hpp"
 #include "categories.hpp"
 #include <llvm/IR/Type.h>
+#include "pass traits.hpp"
 #include <llvm/IR/Function.h>
 #include "Utils/unreachable.hpp"
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/MathExtras.h>
 
 using namespace stela;
 
@@ -97,20 +101,75 @@ ast::ParamType convert(const sym::ExprType &param) {
 
 }
 
+namespace {
+
+// The registers that are left for passing parameters
+struct Registers {
+  unsigned integer = 6;
+  unsigned sse = 8;
+  
+  static bool isSSE(llvm::Type *type) {
+    return type->isFloatingPointTy() || type->isVectorTy();
+  }
+  bool fits(llvm::Type *type) const {
+    unsigned integerParts = 0;
+    unsigned sseParts = 0;
+    for (llvm::Type *part : parts(type)) {
+      ++(isSSE(part) ? sseParts : integerParts);
+    }
+    return integerParts <= integer && sseParts <= sse;
+  }
+  void take(llvm::Type *type) {
+    for (llvm::Type *part : parts(type)) {
+      unsigned &count = isSSE(part) ? sse : integer;
+      count -= count != 0;
+    }
+  }
+  
+private:
+  static llvm::ArrayRef<llvm::Type *> parts(llvm::Type *const &type) {
+    if (auto *srt = llvm::dyn_cast<llvm::StructType>(type)) {
+      return srt->elements();
+    }
+    return type;
+  }
+};
+
+llvm::Type *passParam(llvm::LLVMContext &ctx, const ast::ParamType &param, Registers &regs) {
+  if (param.ref == ast::ParamRef::val) {
+    if (llvm::Type *regType = registerType(ctx, param.type.get())) {
+      if (regs.fits(regType)) {
+        regs.take(regType);
+        return regType;
+      }
+      return generateType(ctx, param.type.get())->getPointerTo();
+    }
+  }
+  llvm::Type *type = convertParam(ctx, param);
+  regs.take(type);
+  return type;
+}
+
+}
+
 llvm::FunctionType *stela::generateSig(llvm::LLVMContext &ctx, const Signature &sig) {
   std::vector<llvm::Type *> params;
   params.reserve(1 + sig.params.size());
+  Registers regs;
   if (sig.receiver.type) {
-    params.push_back(convertParam(ctx, sig.receiver));
-  } else {
+    params.push_back(passParam(ctx, sig.receiver, regs));
+  } else if (sig.closure) {
     params.push_back(voidPtrTy(ctx));
+    regs.take(params.back());
   }
   for (const ast::ParamType &param : sig.params) {
-    params.push_back(convertParam(ctx, param));
+    params.push_back(passParam(ctx, param, regs));
   }
   llvm::Type *ret = generateType(ctx, sig.ret.get());
   if (classifyType(sig.ret.get()) == TypeCat::trivially_copyable) {
     return llvm::FunctionType::get(ret, params, false);
+  } else if (llvm::Type *regType = registerType(ctx, sig.ret.get())) {
+    return llvm::FunctionType::get(regType, params, false);
   } else {
     params.push_back(ret->getPointerTo());
     return llvm::FunctionType::get(voidTy(ctx), params, false);
@@ -118,21 +177,7 @@ llvm::FunctionType *stela::generateSig(llvm::LLVMContext &ctx, const Signature &
 }
 
 llvm::FunctionType *stela::generateSig(llvm::LLVMContext &ctx, const ast::ExtFunc &func) {
-  std::vector<llvm::Type *> params;
-  params.reserve((func.receiver.type ? 1 : 0) + func.params.size());
-  if (func.receiver.type) {
-    params.push_back(convertParam(ctx, func.receiver));
-  }
-  for (const ast::ParamType &param : func.params) {
-    params.push_back(convertParam(ctx, param));
-  }
-  llvm::Type *ret = generateType(ctx, func.ret.get());
-  if (classifyType(func.ret.get()) == TypeCat::trivially_copyable) {
-    return llvm::FunctionType::get(ret, params, false);
-  } else {
-    params.push_back(ret->getPointerTo());
-    return llvm::FunctionType::get(voidTy(ctx), params, false);
-  }
+  return generateSig(ctx, getSignature(func));
 }
 
 Signature stela::getSignature(const ast::Func &func) {
@@ -143,9 +188,14 @@ Signature stela::getSignature(const ast::Func &func) {
     sig.params.push_back(convert(*p));
   }
   sig.ret = func.symbol->ret.type;
+  sig.closure = false;
   return sig;
 }
 
+Signature stela::getSignature(const ast::ExtFunc &func) {
+  return {func.receiver, func.params, func.ret, false};
+}
+
 Signature stela::getSignature(const ast::Lambda &lam) {
   Signature sig;
   sig.receiver = {};
@@ -171,18 +221,17 @@ namespace {
 void assignParamAttrs(
   llvm::Function *func,
   const ast::ParamType &param,
-  const unsigned idx,
-  const unsigned retParam
+  const unsigned idx
 ) {
   llvm::FunctionType *fnType = func->getFunctionType();
   llvm::Type *paramType = fnType->getParamType(idx);
   if (paramType->isPointerTy()) {
     func->addParamAttr(idx, llvm::Attribute::NonNull);
     func->addParamAttr(idx, llvm::Attribute::NoCapture);
-    if (idx != retParam && param.ref != ast::ParamRef::ref) {
+    if (param.ref != ast::ParamRef::ref) {
       func->addParamAttr(idx, llvm::Attribute::NoAlias);
     }
-  } else if (idx != retParam && isBoolType(param.type.get())) {
+  } else if (isBoolType(param.type.get())) {
     func->addParamAttr(idx, llvm::Attribute::ZExt);
   }
 }
@@ -192,18 +241,58 @@ void assignParamAttrs(
 void stela::assignAttrs(llvm::Function *func, const Signature &sig) {
   llvm::FunctionType *type = func->getFunctionType();
   const unsigned numParams = type->getNumParams();
-  const unsigned retParam = numParams > sig.params.size() + 1 ? numParams - 1 : 0;
-  assignParamAttrs(func, sig.receiver, 0, retParam);
-  for (unsigned p = 1; p != numParams; ++p) {
-    assignParamAttrs(func, sig.params[p - 1], p, retParam);
+  const unsigned first = sig.receiver.type || sig.closure ? 1 : 0;
+  if (first) {
+    assignParamAttrs(func, sig.receiver, 0);
   }
-  if (retParam) {
+  for (unsigned p = 0; p != sig.params.size(); ++p) {
+    assignParamAttrs(func, sig.params[p], first + p);
+  }
+  if (numParams > first + sig.params.size()) {
+    const unsigned retParam = numParams - 1;
+    func->addParamAttr(retParam, llvm::Attribute::NonNull);
+    func->addParamAttr(retParam, llvm::Attribute::NoCapture);
     func->addParamAttr(retParam, llvm::Attribute::NoAlias);
     func->addParamAttr(retParam, llvm::Attribute::WriteOnly);
   } else if (isBoolType(sig.ret.get())) {
     func->addAttribute(0, llvm::Attribute::ZExt);
   }
   func->addFnAttr(llvm::Attribute::NoUnwind);
+  assignByVal(func, sig);
+}
+
+namespace {
+
+template <typename Target>
+void assignByValParams(Target *target, llvm::FunctionType *type, const Signature &sig) {
+  llvm::LLVMContext &ctx = type->getContext();
+  const auto assign = [&](const ast::ParamType &param, const unsigned idx) {
+    if (
+      param.ref == ast::ParamRef::val &&
+      type->getParamType(idx)->isPointerTy() &&
+      registerType(ctx, param.type.get())
+    ) {
+      target->addParamAttr(idx, llvm::Attribute::ByVal);
+      target->addParamAttr(idx, llvm::Attribute::getWithAlignment(ctx, 8));
+    }
+  };
+  const unsigned first = sig.receiver.type || sig.closure ? 1 : 0;
+  if (sig.receiver.type) {
+    assign(sig.receiver, 0);
+  }
+  for (unsigned p = 0; p != sig.params.size(); ++p) {
+    assign(sig.params[p], first + p);
+  }
+}
+
+}
+
+void stela::assignByVal(llvm::Function *func, const Signature &sig) {
+  assignByValParams(func, func->getFunctionType(), sig);
+}
+
+void stela::assignByVal(llvm::CallInst *call, const Signature &sig) {
+  assignByValParams(call, call->getFunctionType(), sig);
 }
 
 llvm::Type *stela::convertParam(llvm::LLVMContext &ctx, const ast::ParamType &param) {
@@ -215,6 +304,107 @@ llvm::Type *stela::convertParam(llvm::LLVMContext &ctx, const ast::ParamType &pa
   return paramType;
 }
 
+namespace {
+
+struct Layout {
+  uint64_t size = 0;
+  uint64_t align = 1;
+};
+
+// Returns a size of 0 if the type cannot be passed in registers
+Layout layoutOf(ast::Type *type) {
+  type = concreteType(type);
+  if (auto *btn = dynamic_cast<ast::BtnType *>(type)) {
+    switch (btn->value) {
+      case ast::BtnTypeEnum::Void:
+        return {};
+      case ast::BtnTypeEnum::Opaq:
+        return {8, 8};
+      case ast::BtnTypeEnum::Bool:
+      case ast::BtnTypeEnum::Byte:
+      case ast::BtnTypeEnum::Char:
+        return {1, 1};
+      case ast::BtnTypeEnum::Real:
+      case ast::BtnTypeEnum::Sint:
+      case ast::BtnTypeEnum::Uint:
+        return {4, 4};
+    }
+    UNREACHABLE();
+  }
+  if (auto *srt = dynamic_cast<ast::StructType *>(type)) {
+    Layout layout;
+    for (const ast::Field &field : srt->fields) {
+      const Layout fieldLayout = layoutOf(field.type.get());
+      if (fieldLayout.size == 0) {
+        return {};
+      }
+      layout.size = llvm::alignTo(layout.size, fieldLayout.align) + fieldLayout.size;
+      layout.align = std::max(layout.align, fieldLayout.align);
+    }
+    layout.size = llvm::alignTo(layout.size, layout.align);
+    return layout;
+  }
+  return {};
+}
+
+// An eightbyte that only contains floats is passed in an SSE register.
+// Anything else is passed in an integer register
+struct EightByte {
+  unsigned floats = 0;
+  bool integer = false;
+};
+
+void classifyEightBytes(ast::Type *type, const uint64_t offset, EightByte *bytes) {
+  type = concreteType(type);
+  if (auto *srt = dynamic_cast<ast::StructType *>(type)) {
+    uint64_t fieldOffset = offset;
+    for (const ast::Field &field : srt->fields) {
+      const Layout fieldLayout = layoutOf(field.type.get());
+      fieldOffset = llvm::alignTo(fieldOffset, fieldLayout.align);
+      classifyEightBytes(field.type.get(), fieldOffset, bytes);
+      fieldOffset += fieldLayout.size;
+    }
+  } else if (assertDownCast<ast::BtnType>(type)->value == ast::BtnTypeEnum::Real) {
+    ++bytes[offset / 8].floats;
+  } else {
+    bytes[offset / 8].integer = true;
+  }
+}
+
+}
+
+llvm::Type *stela::registerType(llvm::LLVMContext &ctx, ast::Type *type) {
+  if constexpr (!register_structs) {
+    return nullptr;
+  }
+  auto *srt = concreteType<ast::StructType>(type);
+  if (!srt) {
+    return nullptr;
+  }
+  const Layout layout = layoutOf(srt);
+  if (layout.size == 0 || layout.size > 16) {
+    return nullptr;
+  }
+  EightByte bytes[2];
+  classifyEightBytes(srt, 0, bytes);
+  std::vector<llvm::Type *> parts;
+  for (uint64_t offset = 0; offset < layout.size; offset += 8) {
+    const EightByte &byte = bytes[offset / 8];
+    if (byte.integer) {
+      const uint64_t size = std::min(layout.size - offset, uint64_t{8});
+      parts.push_back(llvm::Type::getIntNTy(ctx, unsigned(size * 8)));
+    } else if (byte.floats == 1) {
+      parts.push_back(llvm::Type::getFloatTy(ctx));
+    } else {
+      parts.push_back(llvm::VectorType::get(llvm::Type::getFloatTy(ctx), 2));
+    }
+  }
+  if (parts.size() == 1) {
+    return parts[0];
+  }
+  return llvm::StructType::get(ctx, parts);
+}
+
 bool stela::isBoolType(ast::Type *type) {
   if (auto *btn = concreteType<ast::BtnType>(type)) {
     if (btn->value == ast::BtnTypeEnum::Bool) {
@@ -21,6 +21,7 @@ class FunctionType;
 class PointerType;
 class StructType;
 class LLVMContext;
+class CallInst;
 
 }
 
@@ -31,19 +32,29 @@ struct Signature {
   ast::ParamType receiver;
   ast::ParamTypes params;
   ast::TypePtr ret;
+  // functions without a receiver take a pointer to the closure data
+  bool closure = true;
 };
 
 llvm::Type *generateType(llvm::LLVMContext &, ast::Type *);
 llvm::FunctionType *generateSig(llvm::LLVMContext &, const Signature &);
-// @TODO this might not be necessary if we remove void * from regular functions
 llvm::FunctionType *generateSig(llvm::LLVMContext &, const ast::ExtFunc &);
 
 Signature getSignature(const ast::Func &);
+Signature getSignature(const ast::ExtFunc &);
 Signature getSignature(const ast::Lambda &);
 Signature getSignature(const ast::FuncType &);
 
 void assignAttrs(llvm::Function *, const Signature &);
+/// Small structs that don't fit in the remaining registers are copied onto the
+/// stack. The byval attribute must be on the function and on indirect calls
+void assignByVal(llvm::Function *, const Signature &);
+void assignByVal(llvm::CallInst *, const Signature &);
 llvm::Type *convertParam(llvm::LLVMContext &, const ast::ParamType &);
+/// Small structs of builtin types are passed and returned in registers the
+/// same way that C++ does on x86-64. Returns null if the type is passed in
+/// memory
+llvm::Type *registerType(llvm::LLVMContext &, ast::Type *);
 std::string generateFuncName(gen::Ctx, const ast::FuncType &);
 
 ast::Type *concreteType(ast::Type *);
@@ -0,0 +1,69 @@
+//
+//  host machine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "host machine.hpp"
+
+#include <llvm/Support/Host.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Support/TargetRegistry.h>
+
+std::string stela::hostCPU(const OptFlags opt) {
+  if (opt.cpu) {
+    return opt.cpu;
+  } else {
+    return llvm::sys::getHostCPUName().str();
+  }
+}
+
+std::vector<std::string> stela::hostFeatures(const OptFlags opt) {
+  llvm::SubtargetFeatures features;
+  llvm::StringMap<bool> host;
+  if (llvm::sys::getHostCPUFeatures(host)) {
+    for (const auto &feature : host) {
+      features.AddFeature(feature.first(), feature.second);
+    }
+  }
+  if (opt.features) {
+    // later features override earlier ones
+    llvm::SubtargetFeatures overrides{opt.features};
+    for (const std::string &feature : overrides.getFeatures()) {
+      features.AddFeature(feature);
+    }
+  }
+  return features.getFeatures();
+}
+
+std::unique_ptr<llvm::TargetMachine> stela::createHostMachine(
+  Log &log,
+  const OptFlags opt,
+  const llvm::Optional<llvm::Reloc::Model> reloc
+) {
+  const std::string triple = llvm::sys::getProcessTriple();
+  std::string error;
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (target == nullptr) {
+    log.error() << error << fatal;
+  }
+  
+  llvm::SubtargetFeatures features;
+  for (const std::string &feature : hostFeatures(opt)) {
+    features.AddFeature(feature);
+  }
+  
+  return std::unique_ptr<llvm::TargetMachine>{target->createTargetMachine(
+    triple,
+    hostCPU(opt),
+    features.getString(),
+    llvm::TargetOptions{},
+    reloc,
+    llvm::None,
+    opt.optimizeASM ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None
+  )};
+}
@@ -0,0 +1,38 @@
+//
+//  host machine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_host_machine_hpp
+#define stela_host_machine_hpp
+
+#include <vector>
+#include "Log/log output.hpp"
+#include "code generation.hpp"
+#include <llvm/ADT/Optional.h>
+#include <llvm/Support/CodeGen.h>
+
+namespace llvm {
+
+class TargetMachine;
+
+}
+
+namespace stela {
+
+/// The name of the host CPU unless it is overridden by the OptFlags
+std::string hostCPU(OptFlags);
+/// The features of the host CPU (+avx2, -avx512f, etc) followed by the
+/// features in the OptFlags
+std::vector<std::string> hostFeatures(OptFlags);
+/// Create a target machine for the host CPU
+std::unique_ptr<llvm::TargetMachine> createHostMachine(
+  Log &, OptFlags, llvm::Optional<llvm::Reloc::Model> = llvm::None
+);
+
+}
+
+#endif
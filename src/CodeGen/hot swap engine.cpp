@@ -0,0 +1,452 @@
+//
+//  hot swap engine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "hot swap engine.hpp"
+
+#include <new>
+#include <cstring>
+#include <algorithm>
+#include "trampoline.hpp"
+#include "host machine.hpp"
+#include "split modules.hpp"
+#include "Log/log output.hpp"
+#include "generate module.hpp"
+#include "optimize module.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+
+using namespace stela;
+
+namespace {
+
+std::string typeName(llvm::Type *type) {
+  std::string name;
+  llvm::raw_string_ostream stream{name};
+  type->print(stream);
+  return stream.str();
+}
+
+/// Functions and global variables are matched across versions by the name of
+/// their module, their own name and their type
+std::string globalKey(const ModuleDecls &module, const std::string_view name, llvm::Type *type) {
+  return module.name + "::" + std::string{name} + " " + typeName(type);
+}
+
+std::unique_ptr<llvm::ExecutionEngine> createEngine(
+  std::unique_ptr<llvm::Module> module,
+  std::unique_ptr<llvm::RTDyldMemoryManager> memory,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  Log log{sink, LogCat::generate};
+  llvm::Module *modulePtr = module.get();
+  std::string str;
+  std::unique_ptr<llvm::ExecutionEngine> engine{llvm::EngineBuilder(std::move(module))
+    .setErrorStr(&str)
+    .setOptLevel(opt.optimizeASM ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None)
+    .setEngineKind(llvm::EngineKind::JIT)
+    .setMCPU(hostCPU(opt))
+    .setMAttrs(hostFeatures(opt))
+    .setMCJITMemoryManager(std::move(memory))
+    .create()
+  };
+  if (!engine) {
+    log.error() << str << fatal;
+  }
+  if (opt.optimizeIR) {
+    if (llvm::Error error = optimizeModule(engine->getTargetMachine(), modulePtr, opt, &sink)) {
+      log.error() << llvm::toString(std::move(error)) << fatal;
+    }
+  }
+  engine->finalizeObject();
+  return engine;
+}
+
+/// Resolves the global variables that a version uses to the variables that
+/// are kept across reloads
+class StateResolver final : public llvm::SectionMemoryManager {
+public:
+  StateResolver(std::unordered_map<std::string, uint64_t> symbols, const char prefix)
+    : symbols{std::move(symbols)}, prefix{prefix} {}
+
+  uint64_t getSymbolAddress(const std::string &name) override {
+    const bool prefixed = prefix != '\0' && !name.empty() && name[0] == prefix;
+    const auto symbol = symbols.find(name.substr(prefixed));
+    if (symbol != symbols.end()) {
+      return symbol->second;
+    }
+    return llvm::SectionMemoryManager::getSymbolAddress(name);
+  }
+
+private:
+  std::unordered_map<std::string, uint64_t> symbols;
+  char prefix;
+};
+
+/// Create a constructor that stores the initializer of a global variable.
+/// Returns null if the initializer is undefined
+llvm::Function *createInit(llvm::GlobalVariable *var) {
+  llvm::Constant *init = var->getInitializer();
+  if (llvm::isa<llvm::UndefValue>(init)) {
+    return nullptr;
+  }
+  llvm::Function *func = llvm::Function::Create(
+    llvm::FunctionType::get(llvm::Type::getVoidTy(var->getContext()), false),
+    llvm::Function::InternalLinkage,
+    var->getName() + "_init",
+    var->getParent()
+  );
+  llvm::IRBuilder<> ir{llvm::BasicBlock::Create(var->getContext(), "", func)};
+  ir.CreateStore(init, var);
+  ir.CreateRetVoid();
+  return func;
+}
+
+/// The trampolines of functions that were added by a reload must outlive the
+/// version that added them. The declarations are copied into the stub context
+/// through bitcode because types can't be shared between contexts
+std::unique_ptr<llvm::Module> createStubModule(
+  const llvm::Module &module,
+  const std::vector<std::pair<std::string, llvm::Function *>> &funcs,
+  llvm::LLVMContext &context,
+  Log &log
+) {
+  llvm::Module decls{"stela.stubs", module.getContext()};
+  decls.setTargetTriple(module.getTargetTriple());
+  decls.setDataLayout(module.getDataLayout());
+  for (const auto &[symbol, func] : funcs) {
+    llvm::Function *decl = llvm::Function::Create(
+      func->getFunctionType(),
+      llvm::Function::ExternalLinkage,
+      symbol,
+      &decls
+    );
+    decl->setAttributes(func->getAttributes());
+  }
+  
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream stream{buffer};
+  llvm::WriteBitcodeToFile(decls, stream);
+  llvm::Expected<std::unique_ptr<llvm::Module>> stubs = llvm::parseBitcodeFile(
+    llvm::MemoryBufferRef{llvm::StringRef{buffer.data(), buffer.size()}, "stela.stubs"},
+    context
+  );
+  if (!stubs) {
+    log.error() << llvm::toString(stubs.takeError()) << fatal;
+  }
+  createStubs(**stubs);
+  return std::move(*stubs);
+}
+
+void *allocGlobal(const size_t size, const size_t align) {
+  void *addr = ::operator new(std::max(size, size_t{1}), std::align_val_t{align});
+  std::memset(addr, 0, size);
+  return addr;
+}
+
+void freeGlobal(void *addr, const size_t align) {
+  ::operator delete(addr, std::align_val_t{align});
+}
+
+}
+
+struct HotSwapEngine::Version {
+  ContextLease context;
+  std::unique_ptr<llvm::ExecutionEngine> engine;
+  /// The keys of the added global variables that this version uses and their
+  /// destructors in this version
+  std::vector<std::pair<std::string, uint64_t>> globals;
+  /// The number of slots that point to this version
+  size_t slots = 0;
+};
+
+HotSwapEngine::HotSwapEngine(
+  const Symbols &syms,
+  LogSink &sink,
+  const OptFlags opt
+) : baseContext{std::make_unique<llvm::LLVMContext>()},
+    stubContext{std::make_unique<llvm::LLVMContext>()},
+    opt{opt} {
+  this->opt.profileGen = false;
+  
+  Log log{sink, LogCat::generate};
+  std::vector<ModuleGlobals> moduleGlobals;
+  std::unique_ptr<llvm::Module> module = generateModule(
+    *baseContext, syms, log, &moduleGlobals, this->opt
+  );
+  exportGlobals(*module);
+  
+  // name and key
+  std::vector<std::pair<std::string, std::string>> vars;
+  std::vector<std::pair<std::string, std::string>> funcs;
+  for (size_t m = 0; m != moduleGlobals.size(); ++m) {
+    const ModuleGlobals &owned = moduleGlobals[m];
+    for (size_t v = 0; v != owned.vars.size(); ++v) {
+      llvm::GlobalVariable *var = owned.vars[v];
+      vars.emplace_back(
+        var->getName().str(),
+        globalKey(syms.modules[m], owned.varNames[v], var->getValueType())
+      );
+    }
+    for (size_t f = 0; f != owned.externs.size(); ++f) {
+      llvm::Function *func = owned.externs[f];
+      funcs.emplace_back(
+        func->getName().str(),
+        globalKey(syms.modules[m], owned.externNames[f], func->getFunctionType())
+      );
+    }
+  }
+  createTrampolines(*module, 0);
+  
+  baseEngine = createEngine(
+    std::move(module), std::make_unique<llvm::SectionMemoryManager>(), sink, this->opt
+  );
+  baseEngine->runStaticConstructorsDestructors(false);
+  
+  for (const auto &[name, key] : vars) {
+    void *addr = reinterpret_cast<void *>(baseEngine->getGlobalValueAddress(name));
+    const Global &global = globals.emplace(key, Global{addr, 0, 0, false}).first->second;
+    varNames.emplace(name, &global);
+  }
+  for (const auto &[name, key] : funcs) {
+    const uint64_t stub = baseEngine->getFunctionAddress(name);
+    const uint64_t slot = baseEngine->getGlobalValueAddress(name + ".slot");
+    const Entry &entry = entries.emplace(key, Entry{
+      stub,
+      reinterpret_cast<std::atomic<void *> *>(slot),
+      nullptr
+    }).first->second;
+    funcNames.emplace(name, &entry);
+  }
+}
+
+HotSwapEngine::~HotSwapEngine() {
+  // An added global variable is destroyed by the newest version that uses it
+  for (auto v = versions.rbegin(); v != versions.rend(); ++v) {
+    for (auto g = (*v)->globals.rbegin(); g != (*v)->globals.rend(); ++g) {
+      if (globals.count(g->first)) {
+        destroy(g->first, g->second);
+      }
+    }
+  }
+  baseEngine->runStaticConstructorsDestructors(true);
+  versions.clear();
+}
+
+void HotSwapEngine::reload(const Symbols &syms, LogSink &sink) {
+  Log log{sink, LogCat::generate};
+  std::lock_guard<std::mutex> lock{mutex};
+  
+  auto version = std::make_unique<Version>();
+  std::vector<ModuleGlobals> moduleGlobals;
+  std::unique_ptr<llvm::Module> module = generateModule(
+    *version->context, syms, log, &moduleGlobals, opt
+  );
+  if (llvm::GlobalVariable *ctors = module->getGlobalVariable("llvm.global_ctors")) {
+    ctors->eraseFromParent();
+  }
+  if (llvm::GlobalVariable *dtors = module->getGlobalVariable("llvm.global_dtors")) {
+    dtors->eraseFromParent();
+  }
+  const llvm::DataLayout &layout = module->getDataLayout();
+  
+  // The version only declares the global variables. Only the variables that
+  // are new are constructed
+  std::unordered_map<std::string, Global> added;
+  // name and key
+  std::vector<std::pair<std::string, std::string>> vars;
+  std::vector<std::pair<std::string, std::string>> swaps;
+  // key and destructor symbol
+  std::vector<std::pair<std::string, std::string>> dtors;
+  // stub symbol and function
+  std::vector<std::pair<std::string, llvm::Function *>> newFuncs;
+  std::vector<std::string> newKeys;
+  std::unique_ptr<llvm::ExecutionEngine> stubEngine;
+  
+  try {
+    std::unordered_map<std::string, uint64_t> symbols;
+    std::vector<llvm::Function *> ctors;
+    for (size_t m = 0; m != moduleGlobals.size(); ++m) {
+      const ModuleGlobals &owned = moduleGlobals[m];
+      for (size_t v = 0; v != owned.vars.size(); ++v) {
+        llvm::GlobalVariable *var = owned.vars[v];
+        std::string key = globalKey(syms.modules[m], owned.varNames[v], var->getValueType());
+        vars.emplace_back(var->getName().str(), key);
+        const std::string symbol = "stela.global." + std::to_string(symbols.size());
+        
+        Global global;
+        const auto existing = globals.find(key);
+        if (existing == globals.end()) {
+          const size_t align = std::max(var->getAlignment(), layout.getPreferredAlignment(var));
+          const size_t size = layout.getTypeAllocSize(var->getValueType());
+          global = {allocGlobal(size, align), align, 0, true};
+          added.emplace(key, global);
+          if (llvm::Function *init = createInit(var)) {
+            ctors.push_back(init);
+          }
+          ctors.push_back(owned.ctors[v]);
+        } else {
+          global = existing->second;
+        }
+        if (global.added && owned.dtors[v]) {
+          owned.dtors[v]->setName(symbol + ".dtor");
+          owned.dtors[v]->setLinkage(llvm::GlobalValue::ExternalLinkage);
+          dtors.emplace_back(std::move(key), symbol + ".dtor");
+        } else if (global.added) {
+          dtors.emplace_back(std::move(key), "");
+        }
+        
+        var->setName(symbol);
+        var->setInitializer(nullptr);
+        var->setLinkage(llvm::GlobalValue::ExternalLinkage);
+        symbols.emplace(symbol, reinterpret_cast<uint64_t>(global.addr));
+      }
+    }
+    createCallList(*module, "stela.reload.ctors", ctors);
+    
+    for (size_t m = 0; m != moduleGlobals.size(); ++m) {
+      const ModuleGlobals &owned = moduleGlobals[m];
+      for (size_t f = 0; f != owned.externs.size(); ++f) {
+        llvm::Function *func = owned.externs[f];
+        std::string key = globalKey(syms.modules[m], owned.externNames[f], func->getFunctionType());
+        if (entries.count(key) == 0) {
+          newFuncs.emplace_back("stela.stub." + std::to_string(entries.size() + newKeys.size()), func);
+          newKeys.push_back(key);
+        }
+        swaps.emplace_back(func->getName().str(), std::move(key));
+      }
+    }
+    
+    std::unique_ptr<llvm::Module> stubModule;
+    if (!newFuncs.empty()) {
+      stubModule = createStubModule(*module, newFuncs, *stubContext, log);
+    }
+    const char prefix = layout.getGlobalPrefix();
+    version->engine = createEngine(
+      std::move(module), std::make_unique<StateResolver>(std::move(symbols), prefix), sink, opt
+    );
+    if (stubModule) {
+      stubEngine = createEngine(
+        std::move(stubModule), std::make_unique<llvm::SectionMemoryManager>(), sink, opt
+      );
+    }
+  } catch (...) {
+    // The storage of new variables is freed if the version fails to compile
+    for (const auto &pair : added) {
+      freeGlobal(pair.second.addr, pair.second.align);
+    }
+    throw;
+  }
+  
+  globals.insert(added.begin(), added.end());
+  for (auto &[key, dtor] : dtors) {
+    ++globals.at(key).users;
+    const uint64_t addr = dtor.empty() ? 0 : version->engine->getFunctionAddress(dtor);
+    version->globals.emplace_back(std::move(key), addr);
+  }
+  using Ctors = void() noexcept;
+  reinterpret_cast<Ctors *>(version->engine->getFunctionAddress("stela.reload.ctors"))();
+  
+  for (size_t f = 0; f != newFuncs.size(); ++f) {
+    const std::string &symbol = newFuncs[f].first;
+    entries.emplace(newKeys[f], Entry{
+      stubEngine->getFunctionAddress(symbol),
+      reinterpret_cast<std::atomic<void *> *>(stubEngine->getGlobalValueAddress(symbol + ".slot")),
+      nullptr
+    });
+  }
+  if (stubEngine) {
+    stubEngines.push_back(std::move(stubEngine));
+  }
+  for (const auto &[name, key] : swaps) {
+    Entry &entry = entries.at(key);
+    const uint64_t addr = version->engine->getFunctionAddress(name);
+    entry.slot->store(reinterpret_cast<void *>(addr), std::memory_order_release);
+    if (entry.impl) {
+      --entry.impl->slots;
+    }
+    entry.impl = version.get();
+    ++version->slots;
+    funcNames.insert_or_assign(name, &entry);
+  }
+  varNames.clear();
+  for (const auto &[name, key] : vars) {
+    varNames.emplace(name, &globals.at(key));
+  }
+  
+  versions.push_back(std::move(version));
+  ++reloadCount;
+}
+
+void HotSwapEngine::collect() {
+  std::lock_guard<std::mutex> lock{mutex};
+  if (versions.empty()) {
+    return;
+  }
+  // The current version is always kept
+  std::vector<std::unique_ptr<Version>> kept;
+  for (size_t v = 0; v != versions.size() - 1; ++v) {
+    if (versions[v]->slots == 0) {
+      release(*versions[v]);
+    } else {
+      kept.push_back(std::move(versions[v]));
+    }
+  }
+  kept.push_back(std::move(versions.back()));
+  versions = std::move(kept);
+}
+
+void HotSwapEngine::release(Version &version) {
+  for (auto g = version.globals.rbegin(); g != version.globals.rend(); ++g) {
+    if (--globals.at(g->first).users == 0) {
+      destroy(g->first, g->second);
+    }
+  }
+}
+
+void HotSwapEngine::destroy(const std::string &key, const uint64_t dtor) {
+  using Dtor = void() noexcept;
+  if (dtor) {
+    reinterpret_cast<Dtor *>(dtor)();
+  }
+  const auto global = globals.find(key);
+  freeGlobal(global->second.addr, global->second.align);
+  globals.erase(global);
+}
+
+uint64_t HotSwapEngine::getFunctionAddress(const std::string &name) const {
+  std::lock_guard<std::mutex> lock{mutex};
+  const auto entry = funcNames.find(name);
+  return entry == funcNames.end() ? 0 : entry->second->stub;
+}
+
+uint64_t HotSwapEngine::getGlobalAddress(const std::string &name) const {
+  std::lock_guard<std::mutex> lock{mutex};
+  const auto global = varNames.find(name);
+  return global == varNames.end() ? 0 : reinterpret_cast<uint64_t>(global->second->addr);
+}
+
+size_t HotSwapEngine::reloads() const {
+  std::lock_guard<std::mutex> lock{mutex};
+  return reloadCount;
+}
+
+size_t HotSwapEngine::retained() const {
+  std::lock_guard<std::mutex> lock{mutex};
+  return versions.size();
+}
+
+std::unique_ptr<HotSwapEngine> stela::generateHotSwapCode(
+  const Symbols &syms,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  return std::make_unique<HotSwapEngine>(syms, sink, opt);
+}
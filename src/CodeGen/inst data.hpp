@@ -50,6 +50,10 @@ enum class FGI : size_t {
   panic,
   alloc,
   free,
+  /// Allocate and free array storage and closure data with objectAlloc and
+  /// objectFree. These come from OptFlags::allocator if it is set
+  obj_alloc,
+  obj_free,
   ceil_to_pow_2,
   
   count_
@@ -69,6 +73,9 @@ enum class PFGI : size_t {
   arr_strg_dtor,
   arr_eq,
   arr_lt,
+  /// Copy the storage of an array if it is shared. This is called before an
+  /// array is modified
+  arr_unshare,
   
   srt_dtor,
   srt_def_ctor,
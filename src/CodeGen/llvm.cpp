@@ -8,7 +8,10 @@
 
 #include "llvm.hpp"
 
+#include <mutex>
 #include <memory>
+#include <vector>
+#include <utility>
 #include <cassert>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/Support/TargetSelect.h>
@@ -17,6 +20,13 @@
 namespace {
 
 std::unique_ptr<llvm::LLVMContext> globalContext;
+struct PooledContext {
+  std::unique_ptr<llvm::LLVMContext> context;
+  size_t uses;
+};
+
+std::mutex poolMutex;
+std::vector<PooledContext> contextPool;
 
 void initializeOptimizers() {
   llvm::PassRegistry &registry = *llvm::PassRegistry::getPassRegistry();
@@ -67,6 +77,8 @@ void stela::initLLVM() {
 void stela::quitLLVM() {
   assert(globalContext);
   globalContext.reset();
+  std::lock_guard<std::mutex> lock{poolMutex};
+  contextPool.clear();
 }
 
 llvm::LLVMContext &stela::getLLVM() {
@@ -77,3 +89,47 @@ llvm::LLVMContext &stela::getLLVM() {
 bool stela::hasLLVM() {
   return bool{globalContext};
 }
+
+stela::ContextLease::ContextLease() {
+  assert(hasLLVM());
+  std::lock_guard<std::mutex> lock{poolMutex};
+  if (contextPool.empty()) {
+    context = std::make_unique<llvm::LLVMContext>();
+  } else {
+    context = std::move(contextPool.back().context);
+    uses = contextPool.back().uses;
+    contextPool.pop_back();
+  }
+  ++uses;
+}
+
+stela::ContextLease::~ContextLease() {
+  if (!context) {
+    return;
+  }
+  if (uses < max_uses) {
+    std::lock_guard<std::mutex> lock{poolMutex};
+    if (contextPool.size() < max_pooled) {
+      contextPool.push_back({std::move(context), uses});
+      return;
+    }
+  }
+  // The context is destroyed outside of the lock
+  context.reset();
+}
+
+stela::ContextLease::ContextLease(ContextLease &&other) noexcept
+  : context{std::move(other.context)},
+    uses{std::exchange(other.uses, 0)} {}
+
+stela::ContextLease &stela::ContextLease::operator=(ContextLease &&other) noexcept {
+  ContextLease old{std::move(*this)};
+  context = std::move(other.context);
+  uses = std::exchange(other.uses, 0);
+  return *this;
+}
+
+size_t stela::ContextLease::pooled() {
+  std::lock_guard<std::mutex> lock{poolMutex};
+  return contextPool.size();
+}
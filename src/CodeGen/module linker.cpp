@@ -0,0 +1,83 @@
+//
+//  module linker.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "module linker.hpp"
+
+#include "host machine.hpp"
+#include "object cache.hpp"
+#include "split modules.hpp"
+#include "generate module.hpp"
+#include "optimize module.hpp"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+
+using namespace stela;
+
+ModuleLinker::ModuleLinker(const OptFlags opt)
+  : objects{std::make_unique<ObjectMap>()}, opt{opt} {
+  // the profile tables of each part would collide
+  this->opt.profileGen = false;
+}
+
+ModuleLinker::~ModuleLinker() = default;
+
+Program ModuleLinker::link(const Symbols &syms, LogSink &sink) {
+  Log log{sink, LogCat::generate};
+  
+  auto context = std::make_unique<llvm::LLVMContext>();
+  std::vector<ModuleGlobals> globals;
+  std::unique_ptr<llvm::Module> module = generateModule(*context, syms, log, &globals, opt);
+  std::vector<std::unique_ptr<llvm::Module>> parts = splitModules(*module, syms.modules, globals);
+  std::unique_ptr<llvm::Module> ctorModule = linkCtorLists(*module, parts);
+  
+  llvm::Module *ctorModulePtr = ctorModule.get();
+  std::string str;
+  llvm::ExecutionEngine *engine = llvm::EngineBuilder(std::move(ctorModule))
+    .setErrorStr(&str)
+    .setOptLevel(opt.optimizeASM ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None)
+    .setEngineKind(llvm::EngineKind::JIT)
+    .setMCPU(hostCPU(opt))
+    .setMAttrs(hostFeatures(opt))
+    .create();
+  if (engine == nullptr) {
+    log.error() << str << fatal;
+  }
+  llvm::TargetMachine *machine = engine->getTargetMachine();
+  ctorModulePtr->setModuleIdentifier(ObjectCache::key(*ctorModulePtr, *machine, opt));
+  
+  compiledModules = 0;
+  for (std::unique_ptr<llvm::Module> &part : parts) {
+    const std::string key = ObjectCache::key(*part, *machine, opt);
+    if (!objects->has(key)) {
+      log.status() << "Compiling module \"" << part->getModuleIdentifier() << "\"" << endlog;
+      if (opt.optimizeIR) {
+        if (llvm::Error error = optimizeModule(machine, part.get(), opt, &sink)) {
+          log.error() << llvm::toString(std::move(error)) << fatal;
+        }
+      }
+      ++compiledModules;
+    }
+    part->setModuleIdentifier(key);
+    engine->addModule(std::move(part));
+  }
+  
+  // MCJIT asks the map for the object before compiling each module
+  engine->setObjectCache(objects.get());
+  engine->finalizeObject();
+  engine->setObjectCache(nullptr);
+  objects->removeUnused();
+  
+  using Ctors = void() noexcept;
+  reinterpret_cast<Ctors *>(engine->getFunctionAddress("stela.ctors"))();
+  
+  return {engine, std::move(context)};
+}
+
+size_t ModuleLinker::compiled() const {
+  return compiledModules;
+}
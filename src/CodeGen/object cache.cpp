@@ -0,0 +1,179 @@
+//
+//  object cache.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "object cache.hpp"
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+
+using namespace stela;
+
+namespace {
+
+// Increment this when a change to the optimizer invalidates cached objects
+constexpr uint8_t cache_version = 1;
+
+}
+
+ObjectCache::ObjectCache(const std::string &dir)
+  : dir{dir} {
+  llvm::sys::fs::create_directories(dir);
+}
+
+std::string ObjectCache::key(
+  const llvm::Module &module,
+  const llvm::TargetMachine &machine,
+  const OptFlags opt
+) {
+  llvm::SmallString<0> bitcode;
+  llvm::raw_svector_ostream stream{bitcode};
+  llvm::WriteBitcodeToFile(module, stream);
+  
+  llvm::MD5 hash;
+  hash.update(bitcode);
+  hash.update(machine.getTargetTriple().str());
+  hash.update(machine.getTargetCPU());
+  hash.update(machine.getTargetFeatureString());
+  hash.update(LLVM_VERSION_STRING);
+  const uint8_t flags[] = {
+    cache_version,
+    opt.inliner,
+    opt.vectorize,
+    opt.optimizeIR,
+    opt.optimizeASM,
+    opt.profileGen,
+    static_cast<uint8_t>(opt.level)
+  };
+  hash.update(flags);
+  if (opt.pipeline) {
+    hash.update(opt.pipeline);
+  }
+  if (opt.profileUse) {
+    if (auto profile = llvm::MemoryBuffer::getFile(opt.profileUse)) {
+      hash.update((*profile)->getBuffer());
+    }
+  }
+  
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  return result.digest().str().str();
+}
+
+bool ObjectCache::has(const llvm::StringRef key) const {
+  return llvm::sys::fs::exists(path(key));
+}
+
+size_t ObjectCache::hits() const {
+  return hitCount;
+}
+
+void ObjectCache::notifyObjectCompiled(
+  const llvm::Module *module,
+  const llvm::MemoryBufferRef obj
+) {
+  // Write to a temporary file and then rename it so that other processes
+  // never read a partially written object
+  int fd;
+  llvm::SmallString<128> temp;
+  const std::string objPath = path(module->getModuleIdentifier());
+  if (llvm::sys::fs::createUniqueFile(objPath + "-%%%%%%", fd, temp)) {
+    return;
+  }
+  {
+    llvm::raw_fd_ostream file{fd, true};
+    file << obj.getBuffer();
+    if (file.has_error()) {
+      file.clear_error();
+      llvm::sys::fs::remove(temp);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(temp, objPath)) {
+    llvm::sys::fs::remove(temp);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectCache::getObject(const llvm::Module *module) {
+  auto buffer = llvm::MemoryBuffer::getFile(path(module->getModuleIdentifier()));
+  if (!buffer) {
+    return nullptr;
+  }
+  ++hitCount;
+  return std::move(*buffer);
+}
+
+std::string ObjectCache::path(const llvm::StringRef key) const {
+  llvm::SmallString<128> objPath{dir};
+  llvm::sys::path::append(objPath, key + ".o");
+  return objPath.str().str();
+}
+
+bool ObjectMap::has(const llvm::StringRef key) const {
+  return objects.count(key);
+}
+
+void ObjectMap::removeUnused() {
+  for (auto e = objects.begin(); e != objects.end();) {
+    auto entry = e++;
+    if (entry->second.used) {
+      entry->second.used = false;
+    } else {
+      objects.erase(entry);
+    }
+  }
+}
+
+void ObjectMap::notifyObjectCompiled(
+  const llvm::Module *module,
+  const llvm::MemoryBufferRef obj
+) {
+  objects[module->getModuleIdentifier()] = {
+    llvm::MemoryBuffer::getMemBufferCopy(obj.getBuffer()),
+    true
+  };
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectMap::getObject(const llvm::Module *module) {
+  const auto entry = objects.find(module->getModuleIdentifier());
+  if (entry == objects.end()) {
+    return nullptr;
+  }
+  entry->second.used = true;
+  const llvm::MemoryBufferRef obj = entry->second.object->getMemBufferRef();
+  return llvm::MemoryBuffer::getMemBufferCopy(obj.getBuffer(), obj.getBufferIdentifier());
+}
+
+void stela::lowerCtorList(
+  llvm::Module *module,
+  const llvm::StringRef listName,
+  const llvm::Twine &funcName
+) {
+  llvm::Function *func = llvm::Function::Create(
+    llvm::FunctionType::get(llvm::Type::getVoidTy(module->getContext()), false),
+    llvm::Function::ExternalLinkage,
+    funcName,
+    module
+  );
+  llvm::IRBuilder<> ir{llvm::BasicBlock::Create(module->getContext(), "", func)};
+  if (llvm::GlobalVariable *list = module->getGlobalVariable(listName)) {
+    auto *entries = llvm::cast<llvm::ConstantArray>(list->getInitializer());
+    for (llvm::Use &entry : entries->operands()) {
+      auto *entryStruct = llvm::cast<llvm::ConstantStruct>(entry.get());
+      ir.CreateCall(entryStruct->getOperand(1));
+    }
+    list->eraseFromParent();
+  }
+  ir.CreateRetVoid();
+}
@@ -0,0 +1,74 @@
+//
+//  object cache.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_object_cache_hpp
+#define stela_object_cache_hpp
+
+#include <llvm/ADT/Twine.h>
+#include "code generation.hpp"
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+
+namespace llvm {
+
+class TargetMachine;
+
+}
+
+namespace stela {
+
+/// Stores compiled object files in a directory. Objects are named after the
+/// identifier of the module they were compiled from
+class ObjectCache final : public llvm::ObjectCache {
+public:
+  explicit ObjectCache(const std::string &);
+
+  /// Hash the module along with everything else that affects the object code
+  static std::string key(const llvm::Module &, const llvm::TargetMachine &, OptFlags);
+  /// Whether an object with the key is in the directory
+  bool has(llvm::StringRef) const;
+  /// The number of objects that getObject found in the directory
+  size_t hits() const;
+
+  void notifyObjectCompiled(const llvm::Module *, llvm::MemoryBufferRef) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *) override;
+
+private:
+  std::string dir;
+  size_t hitCount = 0;
+  
+  std::string path(llvm::StringRef) const;
+};
+
+/// Keeps compiled objects in memory. Objects are named after the identifier of
+/// the module they were compiled from
+class ObjectMap final : public llvm::ObjectCache {
+public:
+  bool has(llvm::StringRef) const;
+  /// Remove the objects that haven't been used since the last call
+  void removeUnused();
+
+  void notifyObjectCompiled(const llvm::Module *, llvm::MemoryBufferRef) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *) override;
+
+private:
+  struct Entry {
+    std::unique_ptr<llvm::MemoryBuffer> object;
+    bool used;
+  };
+  llvm::StringMap<Entry> objects;
+};
+
+/// Replace a list of constructors (or destructors) with an external function
+/// that calls each of them. The optimizer is free to remove constructors so
+/// the list in an unoptimized module may not match a cached object
+void lowerCtorList(llvm::Module *, llvm::StringRef, const llvm::Twine &);
+
+}
+
+#endif
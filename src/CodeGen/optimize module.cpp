@@ -8,61 +8,261 @@
 
 #include "optimize module.hpp"
 
+#include "perf map.hpp"
 #include <llvm/IR/Verifier.h>
+#include "Log/log output.hpp"
+#include "Log/phase timer.hpp"
+#include "profile counters.hpp"
 #include "Utils/unreachable.hpp"
-#include <llvm/Transforms/IPO.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/PassTimingInfo.h>
 #include <llvm/Passes/PassBuilder.h>
-#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Analysis/InlineCost.h>
+#include <llvm/Transforms/IPO/SCCP.h>
 #include <llvm/Target/TargetMachine.h>
+#include <llvm/Analysis/GlobalsModRef.h>
+#include <llvm/Transforms/IPO/Inliner.h>
+#include <llvm/Transforms/Scalar/LICM.h>
+#include <llvm/Transforms/Scalar/SROA.h>
 #include <llvm/Transforms/IPO/GlobalDCE.h>
-#include <llvm/Transforms/Utils/CtorUtils.h>
+#include <llvm/Transforms/IPO/GlobalOpt.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
-#include <llvm/Analysis/TargetTransformInfo.h>
-#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/LoopSink.h>
+#include <llvm/Transforms/Scalar/Float2Int.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/IPO/ConstantMerge.h>
+#include <llvm/Transforms/IPO/FunctionAttrs.h>
+#include <llvm/Transforms/Scalar/DivRemPairs.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Scalar/LoopRotation.h>
+#include <llvm/Transforms/IPO/HotColdSplitting.h>
+#include <llvm/Transforms/IPO/ArgumentPromotion.h>
+#include <llvm/Transforms/Scalar/LoopUnrollPass.h>
+#include <llvm/Transforms/IPO/ForceFunctionAttrs.h>
+#include <llvm/Transforms/IPO/InferFunctionAttrs.h>
+#include <llvm/Transforms/Scalar/LoopPassManager.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/InstSimplifyPass.h>
+#include <llvm/Transforms/Vectorize/LoopVectorize.h>
+#include <llvm/Transforms/Vectorize/SLPVectorizer.h>
+#include <llvm/Transforms/Scalar/LoopLoadElimination.h>
+#include <llvm/Transforms/Scalar/LowerExpectIntrinsic.h>
+#include <llvm/Transforms/Scalar/AlignmentFromAssumptions.h>
+#include <llvm/Transforms/Instrumentation/PGOInstrumentation.h>
 
 namespace {
 
-void addOptPasses(
-  llvm::legacy::PassManagerBase &passes,
-  llvm::legacy::FunctionPassManager &fnPasses,
-  llvm::TargetMachine *machine,
-  const stela::OptFlags opt
-) {
-  llvm::PassManagerBuilder builder;
-  builder.OptLevel = 3;
-  builder.SizeLevel = 0;
+llvm::PassBuilder::OptimizationLevel passBuilderLevel(const stela::OptLevel level) {
+  switch (level) {
+    case stela::OptLevel::O1:
+      return llvm::PassBuilder::O1;
+    case stela::OptLevel::O2:
+      return llvm::PassBuilder::O2;
+    case stela::OptLevel::O3:
+      return llvm::PassBuilder::O3;
+    case stela::OptLevel::Os:
+      return llvm::PassBuilder::Os;
+  }
+  UNREACHABLE();
+}
+
+llvm::InlineParams inlineParams(const stela::OptLevel level) {
+  switch (level) {
+    case stela::OptLevel::O1:
+      return llvm::getInlineParams(1, 0);
+    case stela::OptLevel::O2:
+      return llvm::getInlineParams(2, 0);
+    case stela::OptLevel::O3:
+      return llvm::getInlineParams(3, 0);
+    case stela::OptLevel::Os:
+      return llvm::getInlineParams(2, 1);
+  }
+  UNREACHABLE();
+}
+
+unsigned unrollLevel(const stela::OptLevel level) {
+  return level == stela::OptLevel::O1 ? 1 : level == stela::OptLevel::O3 ? 3 : 2;
+}
+
+template <typename Pass>
+auto functionPass(Pass pass) {
+  return llvm::createModuleToFunctionPassAdaptor(std::move(pass));
+}
+
+// PassBuilder in this version of LLVM has no switches for the inliner and the
+// vectorizers. When either is disabled, the preset pipeline is assembled from
+// its parts in the same way as buildPerModuleDefaultPipeline but without them
+llvm::ModulePassManager buildPreset(llvm::PassBuilder &PB, const stela::OptFlags opt) {
+  const llvm::PassBuilder::OptimizationLevel level = passBuilderLevel(opt.level);
+  if (opt.inliner && opt.vectorize) {
+    return PB.buildPerModuleDefaultPipeline(level);
+  }
+  
+  llvm::ModulePassManager MPM;
+  
+  // Simplification
+  MPM.addPass(llvm::ForceFunctionAttrsPass{});
+  MPM.addPass(llvm::InferFunctionAttrsPass{});
+  llvm::FunctionPassManager earlyFPM;
+  earlyFPM.addPass(llvm::SROA{});
+  earlyFPM.addPass(llvm::EarlyCSEPass{});
+  earlyFPM.addPass(llvm::LowerExpectIntrinsicPass{});
+  MPM.addPass(functionPass(std::move(earlyFPM)));
+  MPM.addPass(llvm::IPSCCPPass{});
+  MPM.addPass(llvm::GlobalOptPass{});
+  MPM.addPass(functionPass(llvm::PromotePass{}));
+  llvm::FunctionPassManager cleanupFPM;
+  cleanupFPM.addPass(llvm::InstCombinePass{});
+  cleanupFPM.addPass(llvm::SimplifyCFGPass{});
+  MPM.addPass(functionPass(std::move(cleanupFPM)));
+  MPM.addPass(llvm::RequireAnalysisPass<llvm::GlobalsAA, llvm::Module>{});
+  if (!opt.inliner) {
+    // The runtime helpers must still be inlined
+    MPM.addPass(llvm::AlwaysInlinerPass{});
+  }
+  
+  llvm::CGSCCPassManager CGPM;
   if (opt.inliner) {
-    builder.Inliner = llvm::createFunctionInliningPass(3, 0, false);
+    CGPM.addPass(llvm::InlinerPass{inlineParams(opt.level)});
+  }
+  CGPM.addPass(llvm::PostOrderFunctionAttrsPass{});
+  if (opt.level == stela::OptLevel::O3) {
+    CGPM.addPass(llvm::ArgumentPromotionPass{});
+  }
+  CGPM.addPass(llvm::createCGSCCToFunctionPassAdaptor(
+    PB.buildFunctionSimplificationPipeline(level, llvm::PassBuilder::ThinLTOPhase::None)
+  ));
+  MPM.addPass(llvm::createModuleToPostOrderCGSCCPassAdaptor(std::move(CGPM)));
+  
+  // Optimization
+  MPM.addPass(llvm::GlobalOptPass{});
+  MPM.addPass(llvm::GlobalDCEPass{});
+  MPM.addPass(llvm::ReversePostOrderFunctionAttrsPass{});
+  MPM.addPass(llvm::RequireAnalysisPass<llvm::GlobalsAA, llvm::Module>{});
+  llvm::FunctionPassManager optimizeFPM;
+  optimizeFPM.addPass(llvm::Float2IntPass{});
+  optimizeFPM.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::LoopRotatePass{}));
+  if (opt.vectorize) {
+    optimizeFPM.addPass(llvm::LoopVectorizePass{});
+  }
+  optimizeFPM.addPass(llvm::LoopLoadEliminationPass{});
+  optimizeFPM.addPass(llvm::InstCombinePass{});
+  if (opt.vectorize) {
+    optimizeFPM.addPass(llvm::SLPVectorizerPass{});
   }
-  builder.LoopVectorize = opt.vectorize;
-  builder.SLPVectorize = opt.vectorize;
-  builder.NewGVN = true;
-  builder.PrepareForLTO = true;
-  machine->adjustPassManager(builder);
+  optimizeFPM.addPass(llvm::SimplifyCFGPass{});
+  optimizeFPM.addPass(llvm::InstCombinePass{});
+  optimizeFPM.addPass(llvm::LoopUnrollPass{llvm::LoopUnrollOptions{static_cast<int>(unrollLevel(opt.level))}});
+  optimizeFPM.addPass(llvm::InstCombinePass{});
+  optimizeFPM.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::LICMPass{}));
+  optimizeFPM.addPass(llvm::AlignmentFromAssumptionsPass{});
+  optimizeFPM.addPass(llvm::LoopSinkPass{});
+  optimizeFPM.addPass(llvm::InstSimplifyPass{});
+  optimizeFPM.addPass(llvm::DivRemPairsPass{});
+  optimizeFPM.addPass(llvm::SimplifyCFGPass{});
+  MPM.addPass(functionPass(std::move(optimizeFPM)));
+  MPM.addPass(llvm::GlobalDCEPass{});
+  MPM.addPass(llvm::ConstantMergePass{});
   
-  builder.populateFunctionPassManager(fnPasses);
-  builder.populateModulePassManager(passes);
+  return MPM;
 }
 
-void addLinkPasses(llvm::legacy::PassManagerBase &passes, stela::OptFlags opt) {
-  llvm::PassManagerBuilder builder;
-  builder.PrepareForLTO = true;
-  if (opt.inliner) {
-    builder.Inliner = llvm::createFunctionInliningPass(3, 0, false);
+// Missed optimizations and the analysis that explains them are what a script
+// author can act on. Passed optimizations are much more common
+constexpr stela::LogPri missed_pri = stela::LogPri::status;
+constexpr stela::LogPri passed_pri = stela::LogPri::verbose;
+
+stela::LogPri remarkPri(const llvm::DiagnosticInfoOptimizationBase &remark) {
+  if (remark.getKind() == llvm::DK_OptimizationRemark) {
+    return passed_pri;
+  } else {
+    return missed_pri;
   }
-  builder.populateLTOPassManager(passes);
 }
 
-bool shouldRemoveCtor(llvm::Function *ctor) {
-  if (ctor->size() > 1) {
-    return false;
+class RemarkHandler final : public llvm::DiagnosticHandler {
+public:
+  RemarkHandler(stela::LogSink &sink, std::unique_ptr<llvm::DiagnosticHandler> prev, bool missed, bool passed)
+    : log{sink, stela::LogCat::generate},
+      prev{std::move(prev)},
+      missed{missed},
+      passed{passed} {}
+
+  bool handleDiagnostics(const llvm::DiagnosticInfo &info) override {
+    const auto *remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+    if (!remark) {
+      return prev->handleDiagnostics(info);
+    }
+    llvm::StringRef file;
+    stela::Loc loc;
+    if (remark->isLocationAvailable()) {
+      remark->getLocation(&file, &loc.l, &loc.c);
+    }
+    log.module({file.data(), file.size()});
+    log.log(remarkPri(*remark), loc) << remark->getPassName().str() << " in "
+      << stela::sourceName(remark->getFunction()) << ": "
+      << remark->getMsg() << stela::endlog;
+    return true;
   }
-  llvm::BasicBlock *entry = &ctor->getEntryBlock();
-  if (entry->size() > 1) {
-    return false;
+  
+  bool isAnalysisRemarkEnabled(llvm::StringRef) const override {
+    return missed;
   }
-  return entry->front().isTerminator();
-}
+  bool isMissedOptRemarkEnabled(llvm::StringRef) const override {
+    return missed;
+  }
+  bool isPassedOptRemarkEnabled(llvm::StringRef) const override {
+    return passed;
+  }
+  bool isAnyRemarkEnabled() const override {
+    return missed || passed;
+  }
+  
+  std::unique_ptr<llvm::DiagnosticHandler> release() {
+    return std::move(prev);
+  }
+
+private:
+  stela::Log log;
+  std::unique_ptr<llvm::DiagnosticHandler> prev;
+  bool missed;
+  bool passed;
+};
+
+// Remarks are only created by the passes if the diagnostic handler asks for
+// them so nothing is installed when the sink would drop them
+class RemarkScope {
+public:
+  RemarkScope(llvm::LLVMContext &ctx, stela::LogSink *sink)
+    : ctx{ctx} {
+    if (!sink) {
+      return;
+    }
+    const bool missed = sink->enabled(stela::LogCat::generate, missed_pri);
+    const bool passed = sink->enabled(stela::LogCat::generate, passed_pri);
+    if (!missed && !passed) {
+      return;
+    }
+    auto handler = std::make_unique<RemarkHandler>(
+      *sink, ctx.getDiagnosticHandler(), missed, passed
+    );
+    installed = handler.get();
+    ctx.setDiagnosticHandler(std::move(handler));
+  }
+  ~RemarkScope() {
+    if (installed) {
+      // The handler is owned by the context until it's replaced
+      std::unique_ptr<llvm::DiagnosticHandler> prev = installed->release();
+      ctx.setDiagnosticHandler(std::move(prev));
+    }
+  }
+
+private:
+  llvm::LLVMContext &ctx;
+  RemarkHandler *installed = nullptr;
+};
 
 }
 
@@ -75,54 +275,76 @@ std::unique_ptr<Module> getLazyIRFileModule(StringRef, SMDiagnostic &, LLVMConte
 
 }
 
-void stela::optimizeModule(
+llvm::Error stela::optimizeModule(
   llvm::TargetMachine *machine,
   llvm::Module *module,
-  const OptFlags opt
+  const OptFlags opt,
+  LogSink *sink
 ) {
+  CompileStats *stats = sink ? sink->stats() : nullptr;
+  PhaseTimer phase{stats, "optimize"};
+  RemarkScope remarks{module->getContext(), sink};
+  if (stats) {
+    stats->irBeforeOpt += module->getInstructionCount();
+  }
   module->setTargetTriple(machine->getTargetTriple().str());
   module->setDataLayout(machine->createDataLayout());
   
-  /*
-  
-  // need to link /usr/local/opt/llvm/lib/libLLVMPasses.a
-  // crashes in ModuleAnalysisManager destructor
+  llvm::PassInstrumentationCallbacks callbacks;
+  llvm::TimePassesHandler timer{opt.timePasses};
+  timer.registerCallbacks(callbacks);
   
-  llvm::ModuleAnalysisManager MAM;
-  llvm::FunctionAnalysisManager FAM;
+  // The analysis managers refer to each other through proxies so they need
+  // to be destroyed in this order
   llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
   llvm::CGSCCAnalysisManager CGAM;
-  llvm::PassBuilder PB;
+  llvm::ModuleAnalysisManager MAM;
+  llvm::PassBuilder PB{machine, llvm::None, &callbacks};
   
+  FAM.registerPass([machine] {
+    return llvm::TargetLibraryAnalysis{
+      llvm::TargetLibraryInfoImpl{machine->getTargetTriple()}
+    };
+  });
   PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
   PB.registerFunctionAnalyses(FAM);
   PB.registerLoopAnalyses(LAM);
-  PB.registerCGSCCAnalyses(CGAM);
   PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
   
-  auto MPM = PB.buildModuleOptimizationPipeline(llvm::PassBuilder::O3);
+  llvm::ModulePassManager MPM;
+  
+  // Instrumentation and profile use must see the same CFG. The generated
+  // module hasn't been changed at this point so both are added at the start
+  // of the pipeline (including a custom pipeline)
+  if (opt.profileGen) {
+    MPM.addPass(llvm::PGOInstrumentationGen{});
+  } else if (opt.profileUse) {
+    MPM.addPass(llvm::PGOInstrumentationUse{opt.profileUse});
+  }
+  
+  if (opt.optimizeIR) {
+    if (opt.pipeline) {
+      if (llvm::Error err = PB.parsePassPipeline(MPM, opt.pipeline)) {
+        return err;
+      }
+    } else {
+      MPM.addPass(buildPreset(PB, opt));
+    }
+    if (opt.profileUse) {
+      MPM.addPass(llvm::HotColdSplittingPass{});
+    }
+  }
+  MPM.addPass(llvm::VerifierPass{});
   MPM.run(*module, MAM);
   
-  */
-
-  llvm::legacy::PassManager passes;
-  passes.add(new llvm::TargetLibraryInfoWrapperPass(machine->getTargetTriple()));
-  passes.add(llvm::createTargetTransformInfoWrapperPass(machine->getTargetIRAnalysis()));
-
-  llvm::legacy::FunctionPassManager fnPasses(module);
-  fnPasses.add(llvm::createTargetTransformInfoWrapperPass(machine->getTargetIRAnalysis()));
-
-  addOptPasses(passes, fnPasses, machine, opt);
-  addLinkPasses(passes, opt);
-
-  fnPasses.doInitialization();
-  for (llvm::Function &func : *module) {
-    fnPasses.run(func);
+  if (opt.profileGen) {
+    lowerProfileCounters(*module, opt.atomicRefs);
+  }
+  if (stats) {
+    stats->irAfterOpt += module->getInstructionCount();
   }
-  fnPasses.doFinalization();
-
-  passes.add(llvm::createVerifierPass());
-  passes.run(*module);
   
-  //llvm::optimizeGlobalCtorsList(*module, &shouldRemoveCtor);
+  return llvm::Error::success();
 }
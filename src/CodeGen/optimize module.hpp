@@ -10,6 +10,7 @@
 #define stela_optimize_module_hpp
 
 #include "code generation.hpp"
+#include <llvm/Support/Error.h>
 
 namespace llvm {
 
@@ -20,7 +21,18 @@ class Module;
 
 namespace stela {
 
-void optimizeModule(llvm::TargetMachine *, llvm::Module *, OptFlags);
+/// Run the pipeline selected by the OptFlags (if optimizeIR is true) along
+/// with the profile instrumentation. Fails if the pipeline string
+/// cannot be parsed. If the sink is not null, optimization remarks are written
+/// to it and the time taken and the number of instructions before and after
+/// are recorded in its stats
+llvm::Error optimizeModule(llvm::TargetMachine *, llvm::Module *, OptFlags, LogSink * = nullptr);
+
+/// Whether optimizeModule needs to be called. A program compiled with
+/// profileGen is instrumented even if optimizeIR is false
+inline bool shouldOptimize(const OptFlags opt) {
+  return opt.optimizeIR || opt.profileGen;
+}
 
 }
 
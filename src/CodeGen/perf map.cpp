@@ -0,0 +1,135 @@
+//
+//  perf map.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "perf map.hpp"
+
+#include <mutex>
+#include <cstdio>
+#include <cinttypes>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace stela;
+
+namespace {
+
+constexpr char source_name_kind[] = "stela.name";
+
+#ifdef __linux__
+
+class PerfMapListener final : public llvm::JITEventListener {
+public:
+  PerfMapListener() {
+    const std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    file = std::fopen(path.c_str(), "a");
+  }
+  
+  void notifyObjectLoaded(
+    ObjectKey,
+    const llvm::object::ObjectFile &obj,
+    const llvm::RuntimeDyld::LoadedObjectInfo &info
+  ) override {
+    if (!file) {
+      return;
+    }
+    // The debug object has the addresses that the symbols were loaded at
+    llvm::object::OwningBinary<llvm::object::ObjectFile> debugObj = info.getObjectForDebug(obj);
+    if (!debugObj.getBinary()) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock{mutex};
+    for (const auto &pair : llvm::object::computeSymbolSizes(*debugObj.getBinary())) {
+      const llvm::object::SymbolRef &sym = pair.first;
+      llvm::Expected<llvm::object::SymbolRef::Type> type = sym.getType();
+      if (!type || *type != llvm::object::SymbolRef::ST_Function) {
+        llvm::consumeError(type.takeError());
+        continue;
+      }
+      llvm::Expected<llvm::StringRef> name = sym.getName();
+      llvm::Expected<uint64_t> addr = sym.getAddress();
+      if (!name || !addr) {
+        llvm::consumeError(name.takeError());
+        llvm::consumeError(addr.takeError());
+        continue;
+      }
+      const std::string source = takeSourceName(*name);
+      std::fprintf(file, "%" PRIx64 " %" PRIx64 " %s\n", *addr, pair.second, source.c_str());
+    }
+    std::fflush(file);
+  }
+  
+  void recordSourceNames(const llvm::Module &module) {
+    std::lock_guard<std::mutex> lock{mutex};
+    for (const llvm::Function &func : module) {
+      if (!func.isDeclaration()) {
+        sourceNames[func.getName()] = sourceName(func);
+      }
+    }
+  }
+  
+private:
+  std::mutex mutex;
+  std::FILE *file;
+  // Each name is removed when its function is loaded
+  llvm::StringMap<std::string> sourceNames;
+  
+  std::string takeSourceName(const llvm::StringRef symbol) {
+    const auto iter = sourceNames.find(symbol);
+    if (iter == sourceNames.end()) {
+      return symbol.str();
+    }
+    std::string source = std::move(iter->second);
+    sourceNames.erase(iter);
+    return source;
+  }
+};
+
+PerfMapListener *perfMapListener() {
+  // Listeners must outlive every engine so they are never destroyed
+  static PerfMapListener *perfMap = new PerfMapListener;
+  return perfMap;
+}
+
+#endif
+
+}
+
+void stela::setSourceName(llvm::Function *func, const llvm::StringRef name) {
+  llvm::LLVMContext &ctx = func->getContext();
+  func->setMetadata(source_name_kind, llvm::MDNode::get(ctx, llvm::MDString::get(ctx, name)));
+}
+
+std::string stela::sourceName(const llvm::Function &func) {
+  if (llvm::MDNode *node = func.getMetadata(source_name_kind)) {
+    return llvm::cast<llvm::MDString>(node->getOperand(0))->getString().str();
+  }
+  return func.getName().str();
+}
+
+void stela::registerPerfListeners(llvm::ExecutionEngine *engine, const llvm::Module &module) {
+  #ifdef __linux__
+  PerfMapListener *perfMap = perfMapListener();
+  perfMap->recordSourceNames(module);
+  engine->RegisterJITEventListener(perfMap);
+  // This is null if LLVM was built without LLVM_USE_PERF
+  if (llvm::JITEventListener *jitDump = llvm::JITEventListener::createPerfJITEventListener()) {
+    engine->RegisterJITEventListener(jitDump);
+  }
+  #else
+  static_cast<void>(engine);
+  static_cast<void>(module);
+  #endif
+}
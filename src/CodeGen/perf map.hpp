@@ -0,0 +1,40 @@
+//
+//  perf map.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_perf_map_hpp
+#define stela_perf_map_hpp
+
+#include <string>
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+
+class Module;
+class Function;
+class ExecutionEngine;
+
+}
+
+namespace stela {
+
+/// Attach the name and signature that a function has in the source. For
+/// example, "perf_ident(sint) -> sint"
+void setSourceName(llvm::Function *, llvm::StringRef);
+/// Get the name attached by setSourceName or the symbol name if the function
+/// was not declared in the source
+std::string sourceName(const llvm::Function &);
+
+/// Tell perf about the functions in the module compiled by the engine. A
+/// jitdump file is written for perf inject and the source names of the
+/// functions are appended to /tmp/perf-<pid>.map. This does nothing on
+/// platforms other than Linux
+void registerPerfListeners(llvm::ExecutionEngine *, const llvm::Module &);
+
+}
+
+#endif
@@ -0,0 +1,178 @@
+//
+//  profile counters.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "profile counters.hpp"
+
+#include <unordered_map>
+#include "Log/log output.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include "code generation.hpp"
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+using namespace stela;
+
+namespace {
+
+class CounterLowering {
+public:
+  CounterLowering(llvm::Module &module, const bool atomic)
+    : module{module},
+      atomic{atomic},
+      i64{llvm::Type::getInt64Ty(module.getContext())},
+      recordType{llvm::StructType::get(
+        llvm::Type::getInt8PtrTy(module.getContext()),
+        i64,
+        i64,
+        i64->getPointerTo(),
+        i64
+      )} {}
+
+  void lower() {
+    std::vector<llvm::Instruction *> dead;
+    for (llvm::Function &func : module) {
+      for (llvm::Instruction &inst : llvm::instructions(func)) {
+        if (auto *inc = llvm::dyn_cast<llvm::InstrProfIncrementInst>(&inst)) {
+          lowerIncrement(inc);
+          dead.push_back(inc);
+        } else if (llvm::isa<llvm::InstrProfValueProfileInst>(&inst)) {
+          // value profiling needs the runtime
+          dead.push_back(&inst);
+        }
+      }
+    }
+    for (llvm::Instruction *inst : dead) {
+      inst->eraseFromParent();
+    }
+    createTable();
+  }
+
+private:
+  llvm::Module &module;
+  bool atomic;
+  llvm::Type *i64;
+  llvm::StructType *recordType;
+  std::unordered_map<llvm::GlobalVariable *, llvm::GlobalVariable *> counters;
+  std::vector<llvm::Constant *> records;
+  
+  llvm::GlobalVariable *getCounters(llvm::InstrProfIncrementInst *inc) {
+    llvm::GlobalVariable *nameVar = inc->getName();
+    llvm::GlobalVariable *&array = counters[nameVar];
+    if (array) {
+      return array;
+    }
+    
+    const uint64_t numCounters = inc->getNumCounters()->getZExtValue();
+    llvm::ArrayType *arrayType = llvm::ArrayType::get(i64, numCounters);
+    array = new llvm::GlobalVariable{
+      module,
+      arrayType,
+      false,
+      llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantAggregateZero::get(arrayType),
+      "stela.prof." + nameVar->getName()
+    };
+    
+    auto *name = llvm::cast<llvm::ConstantDataArray>(nameVar->getInitializer());
+    records.push_back(llvm::ConstantStruct::get(
+      recordType,
+      llvm::ConstantExpr::getPointerCast(nameVar, recordType->getElementType(0)),
+      llvm::ConstantInt::get(i64, name->getNumElements()),
+      inc->getHash(),
+      llvm::ConstantExpr::getPointerCast(array, recordType->getElementType(3)),
+      llvm::ConstantInt::get(i64, numCounters)
+    ));
+    return array;
+  }
+  
+  void lowerIncrement(llvm::InstrProfIncrementInst *inc) {
+    llvm::GlobalVariable *array = getCounters(inc);
+    llvm::IRBuilder<> ir{inc};
+    llvm::Value *addr = ir.CreateConstInBoundsGEP2_64(
+      array, 0, inc->getIndex()->getZExtValue()
+    );
+    if (atomic) {
+      // Programs that share values between threads may run on several
+      // threads. The counts only need to add up
+      ir.CreateAtomicRMW(
+        llvm::AtomicRMWInst::Add,
+        addr,
+        inc->getStep(),
+        llvm::AtomicOrdering::Monotonic
+      );
+    } else {
+      ir.CreateStore(ir.CreateAdd(ir.CreateLoad(addr), inc->getStep()), addr);
+    }
+  }
+  
+  void createTable() {
+    llvm::ArrayType *tableType = llvm::ArrayType::get(recordType, records.size());
+    new llvm::GlobalVariable{
+      module,
+      tableType,
+      true,
+      llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantArray::get(tableType, records),
+      "stela.profile"
+    };
+    new llvm::GlobalVariable{
+      module,
+      i64,
+      true,
+      llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantInt::get(i64, records.size()),
+      "stela.profile.size"
+    };
+  }
+};
+
+}
+
+void stela::lowerProfileCounters(llvm::Module &module, const bool atomic) {
+  CounterLowering{module, atomic}.lower();
+}
+
+void stela::writeProfile(
+  llvm::ExecutionEngine *engine,
+  const std::string &path,
+  LogSink &sink
+) {
+  Log log{sink, LogCat::generate};
+  
+  const uint64_t tableAddr = engine->getGlobalValueAddress("stela.profile");
+  const uint64_t sizeAddr = engine->getGlobalValueAddress("stela.profile.size");
+  if (tableAddr == 0 || sizeAddr == 0) {
+    log.error() << "Program was not compiled with profileGen" << fatal;
+  }
+  const auto *table = reinterpret_cast<const ProfileRecord *>(tableAddr);
+  const uint64_t size = *reinterpret_cast<const uint64_t *>(sizeAddr);
+  
+  llvm::InstrProfWriter writer;
+  if (llvm::Error err = writer.setIsIRLevelProfile(true)) {
+    log.error() << llvm::toString(std::move(err)) << fatal;
+  }
+  for (const ProfileRecord &record : llvm::makeArrayRef(table, size)) {
+    writer.addRecord({
+      llvm::StringRef{record.name, record.nameSize},
+      record.hash,
+      {record.counters, record.counters + record.numCounters}
+    }, [&](llvm::Error err) {
+      log.warn() << llvm::toString(std::move(err)) << endlog;
+    });
+  }
+  
+  std::error_code error;
+  llvm::raw_fd_ostream file{path, error, llvm::sys::fs::F_None};
+  if (error) {
+    log.error() << "Failed to open \"" << path << "\": " << error.message() << fatal;
+  }
+  writer.write(file);
+}
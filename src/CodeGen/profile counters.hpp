@@ -0,0 +1,39 @@
+//
+//  profile counters.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_profile_counters_hpp
+#define stela_profile_counters_hpp
+
+#include <cstdint>
+
+namespace llvm {
+
+class Module;
+
+}
+
+namespace stela {
+
+/// An element of the stela.profile table
+struct ProfileRecord {
+  const char *name;
+  uint64_t nameSize;
+  uint64_t hash;
+  const uint64_t *counters;
+  uint64_t numCounters;
+};
+
+/// Replace the profile intrinsics inserted by the PGO instrumentation pass with
+/// plain counters. There is no profile runtime in the JIT so the counters are
+/// listed in a table (stela.profile and stela.profile.size) that is read by
+/// writeProfile. The counters are incremented atomically if the flag is true
+void lowerProfileCounters(llvm::Module &, bool);
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+//
+//  program.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "program.hpp"
+
+#include <utility>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+using namespace stela;
+
+Program::Program(llvm::ExecutionEngine *engine) noexcept
+  : engine{engine} {}
+
+Program::Program(
+  llvm::ExecutionEngine *engine,
+  std::unique_ptr<llvm::LLVMContext> context
+) noexcept
+  : context{std::move(context)}, engine{engine} {}
+
+Program::~Program() {
+  reset();
+}
+
+Program::Program(Program &&other) noexcept
+  : context{std::move(other.context)},
+    engine{std::exchange(other.engine, nullptr)} {}
+
+Program &Program::operator=(Program &&other) noexcept {
+  reset();
+  context = std::move(other.context);
+  engine = std::exchange(other.engine, nullptr);
+  return *this;
+}
+
+void Program::reset() noexcept {
+  if (engine == nullptr) {
+    return;
+  }
+  // generateCode lowers the destructor list to stela.dtors
+  using Dtors = void() noexcept;
+  if (const uint64_t dtors = engine->getFunctionAddress("stela.dtors")) {
+    reinterpret_cast<Dtors *>(dtors)();
+  }
+  delete engine;
+  engine = nullptr;
+  context.reset();
+}
+
+Program stela::generateProgram(
+  const Symbols &syms,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  auto context = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> module = generateIR(syms, sink, *context, opt);
+  return {generateCode(std::move(module), sink, opt), std::move(context)};
+}
+
+Program stela::generateProgram(
+  std::unique_ptr<llvm::Module> module,
+  LogSink &sink,
+  const OptFlags opt
+) {
+  return Program{generateCode(std::move(module), sink, opt)};
+}
@@ -8,11 +8,14 @@
 
 #include "reflection.hpp"
 
+#include <mutex>
 #include <unordered_map>
 
 std::string stela::mangledName(const std::string_view name) {
-  static std::unordered_map<std::string_view, size_t> indicies;
-  size_t &index = indicies[name];
+  static std::mutex mutex;
+  static std::unordered_map<std::string, size_t> indicies;
+  std::lock_guard<std::mutex> lock{mutex};
+  size_t &index = indicies[std::string{name}];
   std::string mangled = "stela_ext_fun_";
   mangled += name;
   mangled += '_';
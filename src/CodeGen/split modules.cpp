@@ -0,0 +1,180 @@
+//
+//  split modules.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "split modules.hpp"
+
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+using namespace stela;
+
+namespace {
+
+// LLVM appends .N to names to make them unique. The suffix depends on every
+// other global in the module so it is removed to keep the parts stable
+std::string stripSuffix(const llvm::StringRef name) {
+  const auto [base, suffix] = name.rsplit('.');
+  if (suffix.empty() || !std::all_of(suffix.begin(), suffix.end(), llvm::isDigit)) {
+    return name.str();
+  }
+  return base.str();
+}
+
+void exportGlobals(
+  llvm::Module &module,
+  const std::string &name,
+  ModuleGlobals &globals
+) {
+  for (llvm::GlobalValue *global : globals.globals) {
+    if (global->hasLocalLinkage()) {
+      global->setLinkage(llvm::GlobalValue::ExternalLinkage);
+      global->setName(name + "." + stripSuffix(global->getName()));
+    }
+  }
+  std::vector<llvm::Function *> dtors{globals.dtors.rbegin(), globals.dtors.rend()};
+  globals.globals.push_back(createCallList(module, name + ".ctors", globals.ctors));
+  globals.globals.push_back(createCallList(module, name + ".dtors", dtors));
+}
+
+// Every part starts as a copy of the whole module so it has to be trimmed down
+// to the globals that it actually uses
+void removeUnused(llvm::Module &module) {
+  std::vector<llvm::GlobalValue *> unused;
+  do {
+    unused.clear();
+    for (llvm::GlobalValue &global : module.global_values()) {
+      if (!global.hasLocalLinkage() && !global.isDeclaration()) {
+        continue;
+      }
+      global.removeDeadConstantUsers();
+      if (global.use_empty()) {
+        unused.push_back(&global);
+      }
+    }
+    for (llvm::GlobalValue *global : unused) {
+      global->eraseFromParent();
+    }
+  } while (!unused.empty());
+}
+
+void renameLocals(llvm::Module &module) {
+  std::vector<std::pair<llvm::GlobalValue *, std::string>> locals;
+  for (llvm::GlobalValue &global : module.global_values()) {
+    if (global.hasLocalLinkage()) {
+      locals.emplace_back(&global, stripSuffix(global.getName()));
+      global.setName("");
+    }
+  }
+  for (auto &[global, name] : locals) {
+    global->setName(name);
+  }
+}
+
+}
+
+llvm::Function *stela::createCallList(
+  llvm::Module &module,
+  const llvm::Twine &name,
+  const std::vector<llvm::Function *> &funcs
+) {
+  llvm::Function *func = llvm::Function::Create(
+    llvm::FunctionType::get(llvm::Type::getVoidTy(module.getContext()), false),
+    llvm::Function::ExternalLinkage,
+    name,
+    &module
+  );
+  llvm::IRBuilder<> ir{llvm::BasicBlock::Create(module.getContext(), "", func)};
+  for (llvm::Function *callee : funcs) {
+    if (callee) {
+      ir.CreateCall(callee);
+    }
+  }
+  ir.CreateRetVoid();
+  return func;
+}
+
+std::vector<std::unique_ptr<llvm::Module>> stela::splitModules(
+  llvm::Module &module,
+  const std::vector<ModuleDecls> &modules,
+  std::vector<ModuleGlobals> &globals
+) {
+  // Each part calls its own constructors
+  if (llvm::GlobalVariable *ctors = module.getGlobalVariable("llvm.global_ctors")) {
+    ctors->eraseFromParent();
+  }
+  if (llvm::GlobalVariable *dtors = module.getGlobalVariable("llvm.global_dtors")) {
+    dtors->eraseFromParent();
+  }
+  
+  std::vector<std::string> names;
+  std::unordered_set<std::string> usedNames;
+  for (size_t m = 0; m != modules.size(); ++m) {
+    std::string name = modules[m].name;
+    if (!usedNames.insert(name).second) {
+      name += '.';
+      name += std::to_string(m);
+      usedNames.insert(name);
+    }
+    exportGlobals(module, name, globals[m]);
+    names.push_back(std::move(name));
+  }
+  
+  std::unordered_map<const llvm::GlobalValue *, size_t> owners;
+  for (size_t m = 0; m != globals.size(); ++m) {
+    for (const llvm::GlobalValue *global : globals[m].globals) {
+      owners.emplace(global, m);
+    }
+  }
+  
+  std::vector<std::unique_ptr<llvm::Module>> parts;
+  parts.reserve(modules.size());
+  for (size_t m = 0; m != modules.size(); ++m) {
+    llvm::ValueToValueMapTy map;
+    parts.push_back(llvm::CloneModule(module, map, [&](const llvm::GlobalValue *global) {
+      const auto owner = owners.find(global);
+      return owner == owners.end() || owner->second == m;
+    }));
+    parts.back()->setModuleIdentifier(names[m]);
+    removeUnused(*parts.back());
+    renameLocals(*parts.back());
+  }
+  return parts;
+}
+
+std::unique_ptr<llvm::Module> stela::linkCtorLists(
+  llvm::Module &module,
+  const std::vector<std::unique_ptr<llvm::Module>> &parts
+) {
+  auto link = std::make_unique<llvm::Module>("stela.link", module.getContext());
+  link->setTargetTriple(module.getTargetTriple());
+  link->setDataLayout(module.getDataLayout());
+  llvm::FunctionType *sig = llvm::FunctionType::get(
+    llvm::Type::getVoidTy(module.getContext()), false
+  );
+  const auto declare = [&](const std::string &name) {
+    return llvm::Function::Create(
+      sig, llvm::Function::ExternalLinkage, name, link.get()
+    );
+  };
+  
+  std::vector<llvm::Function *> ctors;
+  std::vector<llvm::Function *> dtors;
+  for (const std::unique_ptr<llvm::Module> &part : parts) {
+    ctors.push_back(declare(part->getModuleIdentifier() + ".ctors"));
+    dtors.push_back(declare(part->getModuleIdentifier() + ".dtors"));
+  }
+  std::reverse(dtors.begin(), dtors.end());
+  createCallList(*link, "stela.ctors", ctors);
+  createCallList(*link, "stela.dtors", dtors);
+  return link;
+}
@@ -0,0 +1,40 @@
+//
+//  split modules.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_split_modules_hpp
+#define stela_split_modules_hpp
+
+#include "generate decl.hpp"
+#include <llvm/ADT/Twine.h>
+
+namespace stela {
+
+/// Create an external function that calls each of the functions in order.
+/// Null functions are skipped
+llvm::Function *createCallList(
+  llvm::Module &, const llvm::Twine &, const std::vector<llvm::Function *> &
+);
+
+/// Split a module into one module for each Stela module. Each part defines the
+/// globals that are owned by its Stela module and declares the globals that it
+/// uses from other parts. Internal helpers are copied into every part that
+/// uses them. Each part exports "<name>.ctors" and "<name>.dtors" and the name
+/// of the part is its module identifier
+std::vector<std::unique_ptr<llvm::Module>> splitModules(
+  llvm::Module &, const std::vector<ModuleDecls> &, std::vector<ModuleGlobals> &
+);
+
+/// Create a module that exports "stela.ctors" and "stela.dtors" to call the
+/// constructors and destructors of each part in order
+std::unique_ptr<llvm::Module> linkCtorLists(
+  llvm::Module &, const std::vector<std::unique_ptr<llvm::Module>> &
+);
+
+}
+
+#endif
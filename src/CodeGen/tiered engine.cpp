@@ -0,0 +1,210 @@
+//
+//  tiered engine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "tiered engine.hpp"
+
+#include <algorithm>
+#include "trampoline.hpp"
+#include "host machine.hpp"
+#include "Log/log output.hpp"
+#include "optimize module.hpp"
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+
+using namespace stela;
+
+namespace {
+
+void declareGlobals(llvm::Module &module) {
+  if (llvm::GlobalVariable *ctors = module.getGlobalVariable("llvm.global_ctors")) {
+    ctors->eraseFromParent();
+  }
+  if (llvm::GlobalVariable *dtors = module.getGlobalVariable("llvm.global_dtors")) {
+    dtors->eraseFromParent();
+  }
+  for (llvm::GlobalVariable &var : module.globals()) {
+    if (!var.isConstant() && !var.isDeclaration()) {
+      var.setInitializer(nullptr);
+      var.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+}
+
+std::string writeBitcode(const llvm::Module &module) {
+  std::string bitcode;
+  llvm::raw_string_ostream stream{bitcode};
+  llvm::WriteBitcodeToFile(module, stream);
+  stream.flush();
+  return bitcode;
+}
+
+}
+
+TieredEngine::TieredEngine(
+  std::unique_ptr<llvm::Module> module,
+  LogSink &sink,
+  const uint64_t threshold,
+  const OptFlags opt
+) : sink{sink}, threshold{threshold}, opt{opt}, swapped{0}, hot{0}, stop{false} {
+  Log log{sink, LogCat::generate};
+  
+  exportGlobals(*module);
+  bitcode = writeBitcode(*module);
+  std::vector<std::string> names = createTrampolines(*module, std::max(threshold, uint64_t{1}));
+  
+  std::string str;
+  baseEngine.reset(llvm::EngineBuilder(std::move(module))
+                   .setErrorStr(&str)
+                   .setOptLevel(llvm::CodeGenOpt::None)
+                   .setEngineKind(llvm::EngineKind::JIT)
+                   .setMCPU(hostCPU(opt))
+                   .setMAttrs(hostFeatures(opt))
+                   .create());
+  if (!baseEngine) {
+    log.error() << str << fatal;
+  }
+  baseEngine->finalizeObject();
+  // Constructors may call extern functions so the callback must be set first
+  if (const uint64_t hotAddr = baseEngine->getGlobalValueAddress("stela.hot")) {
+    *reinterpret_cast<void (**)(void *)>(hotAddr) = &TieredEngine::notifyHot;
+    const uint64_t selfAddr = baseEngine->getGlobalValueAddress("stela.hot.self");
+    *reinterpret_cast<void **>(selfAddr) = this;
+  }
+  baseEngine->runStaticConstructorsDestructors(false);
+  
+  entries.reserve(names.size());
+  for (std::string &name : names) {
+    const uint64_t count = baseEngine->getGlobalValueAddress(name + ".count");
+    const uint64_t slot = baseEngine->getGlobalValueAddress(name + ".slot");
+    entries.push_back({
+      std::move(name),
+      reinterpret_cast<std::atomic<uint64_t> *>(count),
+      reinterpret_cast<std::atomic<void *> *>(slot),
+      false
+    });
+  }
+  
+  thread = std::thread{&TieredEngine::run, this};
+}
+
+TieredEngine::~TieredEngine() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stop = true;
+  }
+  wake.notify_one();
+  thread.join();
+  baseEngine->runStaticConstructorsDestructors(true);
+}
+
+uint64_t TieredEngine::getFunctionAddress(const std::string &name) const {
+  return baseEngine->getFunctionAddress(name);
+}
+
+uint64_t TieredEngine::getGlobalAddress(const std::string &name) const {
+  return baseEngine->getGlobalValueAddress(name);
+}
+
+size_t TieredEngine::optimized() const {
+  return swapped.load(std::memory_order_relaxed);
+}
+
+void TieredEngine::notifyHot(void *self) {
+  auto *engine = static_cast<TieredEngine *>(self);
+  {
+    std::lock_guard<std::mutex> lock{engine->mutex};
+    ++engine->hot;
+  }
+  engine->wake.notify_one();
+}
+
+void TieredEngine::run() {
+  size_t handled = 0;
+  while (wait(handled)) {
+    bool done = true;
+    for (Entry &entry : entries) {
+      if (entry.swapped) {
+        continue;
+      }
+      if (entry.count->load(std::memory_order_relaxed) < threshold) {
+        done = false;
+        continue;
+      }
+      if (!optEngine && !compileOptimized()) {
+        return;
+      }
+      const uint64_t addr = optEngine->getFunctionAddress(entry.name);
+      entry.slot->store(reinterpret_cast<void *>(addr), std::memory_order_release);
+      entry.swapped = true;
+      swapped.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (done) {
+      return;
+    }
+  }
+}
+
+// Sleep until another function becomes hot or the engine is destroyed
+bool TieredEngine::wait(size_t &handled) {
+  std::unique_lock<std::mutex> lock{mutex};
+  wake.wait(lock, [this, handled] {
+    return stop || hot != handled;
+  });
+  handled = hot;
+  return !stop;
+}
+
+// The whole program is compiled with optimizations the first time a function
+// becomes hot. This is done in a separate context because LLVMContext is not
+// thread-safe
+bool TieredEngine::compileOptimized() {
+  Log log{sink, LogCat::generate};
+  optContext = std::make_unique<llvm::LLVMContext>();
+  auto module = llvm::parseBitcodeFile(
+    llvm::MemoryBufferRef{bitcode, "tiered"}, *optContext
+  );
+  if (!module) {
+    log.error() << "Failed to read the bitcode of the program: "
+      << llvm::toString(module.takeError()) << endlog;
+    return false;
+  }
+  llvm::Module *modulePtr = module->get();
+  declareGlobals(*modulePtr);
+  
+  std::string str;
+  optEngine.reset(llvm::EngineBuilder(std::move(*module))
+                  .setErrorStr(&str)
+                  .setOptLevel(llvm::CodeGenOpt::Aggressive)
+                  .setEngineKind(llvm::EngineKind::JIT)
+                  .setMCPU(hostCPU(opt))
+                  .setMAttrs(hostFeatures(opt))
+                  .setMCJITMemoryManager(std::make_unique<BaseResolver>(*baseEngine))
+                  .create());
+  if (!optEngine) {
+    log.error() << "Failed to create the optimized engine: " << str << endlog;
+    return false;
+  }
+  if (opt.optimizeIR) {
+    if (llvm::Error err = optimizeModule(optEngine->getTargetMachine(), modulePtr, opt)) {
+      log.error() << "Failed to optimize the program: " << llvm::toString(std::move(err)) << endlog;
+      return false;
+    }
+  }
+  optEngine->finalizeObject();
+  return true;
+}
+
+std::unique_ptr<TieredEngine> stela::generateTieredCode(
+  const Symbols &syms,
+  LogSink &sink,
+  const uint64_t threshold,
+  const OptFlags opt
+) {
+  return std::make_unique<TieredEngine>(generateIR(syms, sink, opt), sink, threshold, opt);
+}
@@ -0,0 +1,212 @@
+//
+//  trampoline.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "trampoline.hpp"
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+using namespace stela;
+
+namespace {
+
+llvm::GlobalVariable *getHotGlobal(llvm::Module *module, llvm::Type *type, const char *name) {
+  if (llvm::GlobalVariable *var = module->getGlobalVariable(name)) {
+    return var;
+  }
+  return new llvm::GlobalVariable{
+    *module,
+    type,
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    llvm::Constant::getNullValue(type),
+    name
+  };
+}
+
+// Forward the arguments of func to the callee and return the result
+void tailCall(llvm::IRBuilder<> &ir, llvm::Function *func, llvm::Value *callee) {
+  std::vector<llvm::Value *> args;
+  for (llvm::Argument &arg : func->args()) {
+    args.push_back(&arg);
+  }
+  llvm::CallInst *call = ir.CreateCall(callee, args);
+  call->setAttributes(func->getAttributes());
+  call->setTailCall();
+  if (call->getType()->isVoidTy()) {
+    ir.CreateRetVoid();
+  } else {
+    ir.CreateRet(call);
+  }
+}
+
+/*
+define @name(args) {
+  %impl = load atomic @name.slot
+  %ret = tail call %impl(args)
+  ret %ret
+}
+*/
+void defineTrampoline(llvm::Function *func, llvm::GlobalVariable *slot) {
+  llvm::IRBuilder<> ir{llvm::BasicBlock::Create(func->getContext(), "", func)};
+  llvm::LoadInst *implPtr = ir.CreateLoad(slot);
+  implPtr->setAlignment(alignof(void *));
+  implPtr->setAtomic(llvm::AtomicOrdering::Acquire);
+  tailCall(ir, func, implPtr);
+}
+
+/*
+define internal @name.counting(args) {
+  %count = atomicrmw add @name.count, 1
+  if %count == threshold - 1
+    call @stela.hot(@stela.hot.self)
+  %ret = tail call @name.impl(args)
+  ret %ret
+}
+*/
+llvm::Function *createCounter(
+  llvm::Function *impl,
+  const std::string &name,
+  const uint64_t threshold
+) {
+  llvm::Module *module = impl->getParent();
+  llvm::LLVMContext &ctx = module->getContext();
+  llvm::Function *func = llvm::Function::Create(
+    impl->getFunctionType(),
+    llvm::Function::InternalLinkage,
+    name + ".counting",
+    module
+  );
+  func->setAttributes(impl->getAttributes());
+  llvm::IRBuilder<> ir{llvm::BasicBlock::Create(ctx, "", func)};
+  llvm::Type *countType = llvm::Type::getInt64Ty(ctx);
+  auto *counter = new llvm::GlobalVariable{
+    *module,
+    countType,
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    llvm::ConstantInt::get(countType, 0),
+    name + ".count"
+  };
+  llvm::Value *count = ir.CreateAtomicRMW(
+    llvm::AtomicRMWInst::Add,
+    counter,
+    ir.getInt64(1),
+    llvm::AtomicOrdering::Monotonic
+  );
+  
+  // Only the call that reaches the threshold sees this count
+  llvm::BasicBlock *hotBlock = llvm::BasicBlock::Create(ctx, "", func);
+  llvm::BasicBlock *callBlock = llvm::BasicBlock::Create(ctx, "", func);
+  llvm::Value *isHot = ir.CreateICmpEQ(count, ir.getInt64(threshold - 1));
+  ir.CreateCondBr(isHot, hotBlock, callBlock);
+  
+  ir.SetInsertPoint(hotBlock);
+  llvm::Type *selfType = ir.getInt8PtrTy();
+  llvm::FunctionType *hotType = llvm::FunctionType::get(ir.getVoidTy(), {selfType}, false);
+  llvm::Value *hot = ir.CreateLoad(getHotGlobal(module, hotType->getPointerTo(), "stela.hot"));
+  llvm::Value *self = ir.CreateLoad(getHotGlobal(module, selfType, "stela.hot.self"));
+  ir.CreateCall(hot, {self});
+  ir.CreateBr(callBlock);
+  
+  ir.SetInsertPoint(callBlock);
+  tailCall(ir, func, impl);
+  return func;
+}
+
+void createTrampoline(llvm::Function *impl, const std::string &name, const uint64_t threshold) {
+  llvm::Module *module = impl->getParent();
+  llvm::Function *func = llvm::Function::Create(
+    impl->getFunctionType(),
+    llvm::Function::ExternalLinkage,
+    name,
+    module
+  );
+  func->setAttributes(impl->getAttributes());
+  // Calls from other functions go through the trampoline as well
+  impl->replaceAllUsesWith(func);
+  
+  // Calls are only counted until the slot is swapped. After that, the
+  // trampoline is just a load and a tail call
+  llvm::Function *target = threshold == 0 ? impl : createCounter(impl, name, threshold);
+  auto *slot = new llvm::GlobalVariable{
+    *module,
+    impl->getType(),
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    target,
+    name + ".slot"
+  };
+  defineTrampoline(func, slot);
+}
+
+}
+
+void stela::exportGlobals(llvm::Module &module) {
+  for (llvm::GlobalVariable &var : module.globals()) {
+    if (!var.isConstant() && var.hasLocalLinkage() && var.hasName()) {
+      var.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+}
+
+std::vector<std::string> stela::createTrampolines(llvm::Module &module, const uint64_t threshold) {
+  std::vector<llvm::Function *> entries;
+  for (llvm::Function &func : module) {
+    if (!func.isDeclaration() && func.hasExternalLinkage()) {
+      entries.push_back(&func);
+    }
+  }
+  std::vector<std::string> names;
+  names.reserve(entries.size());
+  for (llvm::Function *impl : entries) {
+    names.push_back(impl->getName().str());
+    impl->setName(names.back() + ".impl");
+    impl->setLinkage(llvm::GlobalValue::InternalLinkage);
+    createTrampoline(impl, names.back(), threshold);
+  }
+  return names;
+}
+
+void stela::createStubs(llvm::Module &module) {
+  std::vector<llvm::Function *> decls;
+  for (llvm::Function &func : module) {
+    if (func.isDeclaration()) {
+      decls.push_back(&func);
+    }
+  }
+  for (llvm::Function *func : decls) {
+    const std::string name = func->getName().str();
+    auto *slot = new llvm::GlobalVariable{
+      module,
+      func->getType(),
+      false,
+      llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantPointerNull::get(func->getType()),
+      name + ".slot"
+    };
+    defineTrampoline(func, slot);
+  }
+}
+
+BaseResolver::BaseResolver(llvm::ExecutionEngine &base)
+  : BaseResolver{std::vector<llvm::ExecutionEngine *>{&base}} {}
+
+BaseResolver::BaseResolver(std::vector<llvm::ExecutionEngine *> bases)
+  : bases{std::move(bases)},
+    prefix{this->bases.front()->getDataLayout().getGlobalPrefix()} {}
+
+uint64_t BaseResolver::getSymbolAddress(const std::string &name) {
+  const bool prefixed = prefix != '\0' && !name.empty() && name[0] == prefix;
+  for (llvm::ExecutionEngine *base : bases) {
+    if (const uint64_t addr = base->getGlobalValueAddress(name.substr(prefixed))) {
+      return addr;
+    }
+  }
+  return llvm::SectionMemoryManager::getSymbolAddress(name);
+}
@@ -0,0 +1,58 @@
+//
+//  trampoline.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_trampoline_hpp
+#define stela_trampoline_hpp
+
+#include <string>
+#include <vector>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+
+namespace llvm {
+
+class Module;
+class ExecutionEngine;
+
+}
+
+namespace stela {
+
+/// Give the global variables external linkage so that they can be used by
+/// code in another engine
+void exportGlobals(llvm::Module &);
+
+/// Rename each extern function to "<name>.impl" and replace it with a
+/// trampoline that calls the function stored in "<name>.slot". Calls between
+/// extern functions also go through the trampolines. If the threshold is not
+/// 0, the slot starts at "<name>.counting" which increments "<name>.count" and
+/// then calls "<name>.impl". The call that reaches the threshold calls the
+/// function in "stela.hot" with "stela.hot.self". Calls are no longer counted
+/// once the slot is swapped. Returns the names of the functions
+std::vector<std::string> createTrampolines(llvm::Module &, uint64_t);
+
+/// Define each function declaration in the module as a trampoline that calls
+/// the function stored in "<name>.slot". The slots are initialized to null
+void createStubs(llvm::Module &);
+
+/// Resolves the symbols of a module to the symbols of other engines so that
+/// the module can use their global variables. The engines are searched in order
+class BaseResolver final : public llvm::SectionMemoryManager {
+public:
+  explicit BaseResolver(llvm::ExecutionEngine &);
+  explicit BaseResolver(std::vector<llvm::ExecutionEngine *>);
+
+  uint64_t getSymbolAddress(const std::string &) override;
+
+private:
+  std::vector<llvm::ExecutionEngine *> bases;
+  char prefix;
+};
+
+}
+
+#endif
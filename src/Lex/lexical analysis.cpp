@@ -12,6 +12,7 @@
 #include <algorithm>
 #include "Log/log output.hpp"
 #include "number literal.hpp"
+#include "Log/phase timer.hpp"
 #include "Utils/parse string.hpp"
 
 using namespace stela;
@@ -176,6 +177,8 @@ bool parseMultiComment(Utils::ParseString &str, Log &log) {
 
 Tokens stela::tokenize(const std::string_view source, LogSink &sink) {
   Log log{sink, LogCat::lexical};
+  CompileStats *stats = sink.stats();
+  PhaseTimer timer{stats, "lexical"};
   log.verbose() << "Parsing " << source.size() << " characters" << endlog;
   
   Utils::ParseString str(source);
@@ -186,6 +189,9 @@ Tokens stela::tokenize(const std::string_view source, LogSink &sink) {
     str.skipWhitespace();
     if (str.empty()) {
       log.verbose() << "Created " << tokens.size() << " tokens" << endlog;
+      if (stats) {
+        stats->tokens += tokens.size();
+      }
       return tokens;
     }
     
@@ -0,0 +1,106 @@
+//
+//  compile stats.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "compile stats.hpp"
+
+#include <ostream>
+#include "phase timer.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace stela;
+
+namespace {
+
+uint64_t micro(const std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+uint64_t peakMemory() {
+  #if defined(__unix__) || defined(__APPLE__)
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  #ifdef __APPLE__
+  return usage.ru_maxrss;
+  #else
+  return usage.ru_maxrss * uint64_t{1024};
+  #endif
+  #else
+  return 0;
+  #endif
+}
+
+}
+
+CompileStats::CompileStats()
+  : epoch{std::chrono::steady_clock::now()} {}
+
+uint64_t CompileStats::time(const std::string_view name) const {
+  uint64_t total = 0;
+  for (const PhaseStats &phase : phases) {
+    if (phase.name == name) {
+      total += phase.duration;
+    }
+  }
+  return total;
+}
+
+void CompileStats::writeTrace(std::ostream &stream) const {
+  stream << "{\"traceEvents\":[";
+  for (size_t p = 0; p != phases.size(); ++p) {
+    const PhaseStats &phase = phases[p];
+    if (p != 0) {
+      stream << ',';
+    }
+    stream << "\n{\"name\":\"" << phase.name << "\",\"cat\":\"stela\",\"ph\":\"X\"";
+    stream << ",\"ts\":" << phase.start << ",\"dur\":" << phase.duration;
+    stream << ",\"pid\":1,\"tid\":1,\"args\":{\"peakMemory\":" << phase.peakMemory << "}}";
+  }
+  stream << "\n],\"otherData\":{";
+  stream << "\"tokens\":" << tokens;
+  stream << ",\"astNodes\":" << astNodes;
+  stream << ",\"irBeforeOpt\":" << irBeforeOpt;
+  stream << ",\"irAfterOpt\":" << irAfterOpt;
+  stream << ",\"machineCode\":" << machineCode;
+  stream << "}}\n";
+}
+
+StatsSink::StatsSink(LogSink &child, CompileStats &compileStats)
+  : child{child}, compileStats{compileStats} {}
+
+bool StatsSink::writeHead(const LogInfo &head) {
+  return child.writeHead(head);
+}
+
+std::streambuf *StatsSink::getBuf(const LogInfo &head) {
+  return child.getBuf(head);
+}
+
+void StatsSink::writeTail(const LogInfo &head) {
+  child.writeTail(head);
+}
+
+CompileStats *StatsSink::stats() {
+  return &compileStats;
+}
+
+PhaseTimer::PhaseTimer(CompileStats *stats, const char *name)
+  : stats{stats}, name{name}, start{std::chrono::steady_clock::now()} {}
+
+PhaseTimer::~PhaseTimer() {
+  if (stats) {
+    const auto end = std::chrono::steady_clock::now();
+    stats->phases.push_back({
+      name, micro(start - stats->epoch), micro(end - start), peakMemory()
+    });
+  }
+}
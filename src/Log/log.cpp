@@ -19,6 +19,14 @@ using namespace stela;
 
 LogSink::~LogSink() = default;
 
+bool LogSink::enabled(LogCat, LogPri) {
+  return true;
+}
+
+CompileStats *LogSink::stats() {
+  return nullptr;
+}
+
 std::ostream &stela::operator<<(std::ostream &stream, const LogCat cat) {
   // Categories are adjectives
   switch (cat) {
@@ -185,6 +193,10 @@ void stela::NullSink::writeTail(const LogInfo &) {
   UNREACHABLE();
 }
 
+bool stela::NullSink::enabled(LogCat, LogPri) {
+  return false;
+}
+
 stela::FilterSink::FilterSink(LogSink &child, LogPri pri)
   : child{child}, priority{pri} {}
 
@@ -207,3 +219,11 @@ std::streambuf *stela::FilterSink::getBuf(const LogInfo &head) {
 void stela::FilterSink::writeTail(const LogInfo &head) {
   return child.writeTail(head);
 }
+
+bool stela::FilterSink::enabled(const LogCat cat, const LogPri pri) {
+  return static_cast<uint8_t>(pri) >= static_cast<uint8_t>(priority) && child.enabled(cat, pri);
+}
+
+CompileStats *stela::FilterSink::stats() {
+  return child.stats();
+}
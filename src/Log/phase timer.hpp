@@ -0,0 +1,34 @@
+//
+//  phase timer.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 16/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_phase_timer_hpp
+#define stela_phase_timer_hpp
+
+#include "compile stats.hpp"
+
+namespace stela {
+
+/// Records a PhaseStats when it is destroyed. This does nothing if the stats
+/// are null
+class PhaseTimer {
+public:
+  PhaseTimer(CompileStats *, const char *);
+  ~PhaseTimer();
+  
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  CompileStats *stats;
+  const char *name;
+  std::chrono::steady_clock::time_point start;
+};
+
+}
+
+#endif
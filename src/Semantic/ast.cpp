@@ -12,6 +12,20 @@
 
 using namespace stela;
 
+namespace {
+
+thread_local uint64_t nodesCreated = 0;
+
+}
+
+ast::Node::Node() {
+  ++nodesCreated;
+}
+
+uint64_t ast::Node::created() {
+  return nodesCreated;
+}
+
 ast::Node::~Node() = default;
 ast::Type::~Type() = default;
 ast::Expression::~Expression() = default;
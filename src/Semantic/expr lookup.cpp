@@ -324,6 +324,7 @@ ast::Func *ExprLookup::pushFunPtr(sym::Scope *scope, const sym::Name &name, cons
       ctx.log.error(loc) << "Function \"" << name << "\" does not match signature" << fatal;
     }
     funcSym->referenced = true;
+    funcNode->closure = true;
     stack.pushExpr(sym::makeLetVal(std::move(funcType)));
     return funcNode;
   } else {
@@ -337,6 +338,7 @@ ast::Func *ExprLookup::pushFunPtr(sym::Scope *scope, const sym::Name &name, cons
       if (compareTypes(ctx, expType, funcType)) {
         stack.pushExpr(sym::makeLetVal(std::move(funcType)));
         funcSym->referenced = true;
+        funcNode->closure = true;
         return funcNode;
       }
     }
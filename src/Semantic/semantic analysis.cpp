@@ -12,6 +12,7 @@
 #include "check scopes.hpp"
 #include "scope manager.hpp"
 #include "Log/log output.hpp"
+#include "Log/phase timer.hpp"
 #include "builtin symbols.hpp"
 #include "syntax analysis.hpp"
 
@@ -36,12 +37,14 @@ void compileModuleImpl(Symbols &syms, AST &ast, Log &log) {
   traverse({syms.builtins, man, log}, ast.global);
   std::move(ast.global.begin(), ast.global.end(), std::back_inserter(syms.decls));
   ast.global.clear();
+  syms.modules.push_back({std::string{ast.name}, syms.decls.size()});
 }
 
 }
 
 void stela::compileModule(Symbols &syms, AST &ast, LogSink &sink) {
   Log log{sink, LogCat::semantic};
+  PhaseTimer timer{sink.stats(), "semantic"};
   compileModuleImpl(syms, ast, log);
   checkScopes(log, syms);
 }
@@ -53,6 +56,7 @@ void stela::compileModule(Symbols &syms, std::string_view source, LogSink &sink)
 
 void stela::compileModules(Symbols &syms, const ModuleOrder &order, ASTs &asts, LogSink &sink) {
   Log log{sink, LogCat::semantic};
+  PhaseTimer timer{sink.stats(), "semantic"};
   for (const size_t index : order) {
     compileModuleImpl(syms, asts[index], log);
   }
@@ -10,12 +10,16 @@
 
 #include "parse decl.hpp"
 #include "Log/log output.hpp"
+#include "Log/phase timer.hpp"
 #include "lexical analysis.hpp"
 
 using namespace stela;
 
 AST stela::createAST(const Tokens &tokens, LogSink &sink) {
   Log log{sink, LogCat::syntax};
+  CompileStats *stats = sink.stats();
+  PhaseTimer timer{stats, "syntax"};
+  const uint64_t nodes = ast::Node::created();
   log.verbose() << "Parsing " << tokens.size() << " tokens" << endlog;
 
   AST ast;
@@ -48,6 +52,9 @@ AST stela::createAST(const Tokens &tokens, LogSink &sink) {
   }
   
   log.verbose() << "Created AST with " << ast.global.size() << " global nodes" << endlog;
+  if (stats) {
+    stats->astNodes += ast::Node::created() - nodes;
+  }
   
   return ast;
 }
@@ -6,18 +6,37 @@
 //  Copyright © 2018 Indi Kernick. All rights reserved.
 //
 
+#include <set>
+#include <thread>
 #include <fstream>
+#include <sstream>
 #include <iostream>
+#include <algorithm>
 #include <gtest/gtest.h>
 #include <STELA/llvm.hpp>
 #include <llvm/IR/Module.h>
 #include <STELA/binding.hpp>
+#include <STELA/program.hpp>
+#include <STELA/allocator.hpp>
 #include <STELA/reflection.hpp>
+#include <STELA/compile stats.hpp>
+#include <STELA/module linker.hpp>
+#include <STELA/tiered engine.hpp>
+#include <llvm/Support/FileSystem.h>
+#include <STELA/hot swap engine.hpp>
 #include <STELA/code generation.hpp>
 #include <STELA/syntax analysis.hpp>
 #include <STELA/native functions.hpp>
+#include <llvm/IR/DebugInfoMetadata.h>
 #include <STELA/semantic analysis.hpp>
 #include <STELA/c standard library.hpp>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
 
 using namespace stela;
 
@@ -719,12 +738,12 @@ TEST(Binding, Structs) {
   s.g = -100000;
   EXPECT_EQ(get(&s), -100000);
   
-  auto get_val = GET_FUNC("get_val", Sint(Structure *));
+  auto get_val = GET_FUNC("get_val", Sint(Structure));
   
   s.g = 4;
-  EXPECT_EQ(get_val(&s), 4);
+  EXPECT_EQ(get_val(s), 4);
   s.g = -100000;
-  EXPECT_EQ(get_val(&s), -100000);
+  EXPECT_EQ(get_val(s), -100000);
   
   auto identity = GET_FUNC("identity", Structure(Structure));
   
@@ -908,6 +927,10 @@ TEST(Binding, Arrays) {
       a[0] = val;
     }
     
+    extern func setFirstRef(a: ref [real], val: real) {
+      a[0] = val;
+    }
+    
     extern func getFirst(a: [real]) {
       return a[0u];
     }
@@ -938,10 +961,18 @@ TEST(Binding, Arrays) {
   auto setFirst = GET_FUNC("setFirst", Void(Array<Real>, Real));
 
   Array<Real> array1 = makeArray<Real>(1);
+  array1->dat[0] = 0.0f;
   EXPECT_EQ(array1.use_count(), 1);
 
+  // the parameter is a copy
   setFirst(array1, 11.5f);
   EXPECT_EQ(array1.use_count(), 1);
+  EXPECT_EQ(array1->dat[0], 0.0f);
+  
+  auto setFirstRef = GET_FUNC("setFirstRef", Void(Array<Real> &, Real));
+  
+  setFirstRef(array1, 11.5f);
+  EXPECT_EQ(array1.use_count(), 1);
   EXPECT_EQ(array1->cap, 1);
   EXPECT_EQ(array1->len, 1);
   ASSERT_TRUE(array1->dat);
@@ -1296,6 +1327,76 @@ TEST(Lifetime, Copy_elision) {
   EXPECT_EQ(b.use_count(), 1);
 }
 
+TEST(Lifetime, Named_return_value) {
+  EXPECT_SUCCEEDS(R"(
+    type Wrapper struct {
+      arr: [sint];
+      len: uint;
+    };
+    
+    extern func build(n: uint) {
+      var w: Wrapper;
+      if (n == 0u) {
+        return w;
+      }
+      for (i := 0u; i != n; i++) {
+        let retain = w.arr;
+        push_back(w.arr, make sint i);
+        w.len++;
+        if (w.len == 3u) {
+          return w;
+        }
+      }
+      return w;
+    }
+    
+    extern func select(first: bool) {
+      var a: [sint];
+      push_back(a, 1);
+      var b: [sint];
+      push_back(b, 2);
+      if (first) {
+        return a;
+      }
+      return b;
+    }
+  )");
+  
+  struct Wrapper {
+    Array<Sint> arr;
+    Uint len;
+  };
+  
+  auto build = GET_FUNC("build", Wrapper(Uint));
+  
+  Wrapper zero = build(0);
+  EXPECT_EQ(zero.len, 0);
+  
+  Wrapper two = build(2);
+  ASSERT_TRUE(two.arr);
+  EXPECT_EQ(two.arr.use_count(), 1);
+  EXPECT_EQ(two.len, 2);
+  EXPECT_EQ(two.arr->len, 2);
+  
+  Wrapper five = build(5);
+  ASSERT_TRUE(five.arr);
+  EXPECT_EQ(five.arr.use_count(), 1);
+  EXPECT_EQ(five.len, 3);
+  EXPECT_EQ(five.arr->dat[2], 2);
+  
+  auto select = GET_FUNC("select", Array<Sint>(Bool));
+  
+  Array<Sint> a = select(true);
+  ASSERT_TRUE(a);
+  EXPECT_EQ(a.use_count(), 1);
+  EXPECT_EQ(a->dat[0], 1);
+  
+  Array<Sint> b = select(false);
+  ASSERT_TRUE(b);
+  EXPECT_EQ(b.use_count(), 1);
+  EXPECT_EQ(b->dat[0], 2);
+}
+
 TEST(Lifetime, Nontrivial_global_variable) {
   EXPECT_SUCCEEDS(R"(
     var array: [real];
@@ -1799,7 +1900,7 @@ TEST(Compare, Sort_strings) {
       b = t;
     }
     
-    extern func bubbles(arr: [[char]], len: sint) {
+    extern func bubbles(arr: ref [[char]], len: sint) {
       if (len < 2) return;
       let numPairs = len - 1;
       var sorted = false;
@@ -1815,7 +1916,7 @@ TEST(Compare, Sort_strings) {
     }
   )");
   
-  auto sort = GET_FUNC("bubbles", Void(Array<Array<Char>>, Sint));
+  auto sort = GET_FUNC("bubbles", Void(Array<Array<Char>> &, Sint));
   
   Array<Char> stat = makeString("statically");
   Array<Char> type = makeString("typed");
@@ -1965,6 +2066,43 @@ TEST(Btn_func, reserve) {
   EXPECT_EQ(empty->cap, 4);
 }
 
+TEST(Btn_func, reserve_shared) {
+  EXPECT_SUCCEEDS(R"(
+    extern func res(arr: ref [[char]], cap: uint) {
+      reserve(arr, cap);
+    }
+  )");
+  
+  auto res = GET_FUNC("res", Void(Array<Array<Char>> &, Uint));
+  
+  Array<Char> str = makeString("String");
+  Array<Array<Char>> array = makeArrayOf<Array<Char>>(str);
+  Array<Array<Char>> copy = array;
+  EXPECT_EQ(str.use_count(), 2);
+  EXPECT_EQ(array.use_count(), 2);
+  
+  // reserving without growing leaves the storage shared
+  res(copy, 1);
+  
+  EXPECT_EQ(array.use_count(), 2);
+  EXPECT_EQ(copy.get(), array.get());
+  
+  res(copy, 8);
+  
+  EXPECT_EQ(array.use_count(), 1);
+  EXPECT_EQ(copy.use_count(), 1);
+  EXPECT_EQ(str.use_count(), 3);
+  EXPECT_EQ(copy->len, 1);
+  EXPECT_EQ(copy->cap, 8);
+  EXPECT_EQ(copy->dat[0], str);
+  
+  ASSERT_EQ(array->len, 1);
+  EXPECT_EQ(array->cap, 1);
+  EXPECT_EQ(array->dat[0], str);
+  EXPECT_EQ(array->dat[0]->len, 6);
+  EXPECT_EQ(array->dat[0]->dat[0], 'S');
+}
+
 TEST(Btn_func, append) {
   EXPECT_SUCCEEDS(R"(
     extern func app(arr: ref [[char]], other: ref [[char]]) {
@@ -2180,9 +2318,12 @@ TEST(Btn_func, push_back) {
   EXPECT_EQ(arr1->cap, 1);
   EXPECT_EQ(arr1->dat[0], str0);
   
+  // str0 gets its own storage and the arrays keep "String"
   pushChr(str0, 'y');
   
-  EXPECT_EQ(str0.use_count(), 3);
+  EXPECT_EQ(str0.use_count(), 1);
+  EXPECT_EQ(arr0->dat[0].use_count(), 2);
+  EXPECT_EQ(arr0->dat[0]->len, 6);
   EXPECT_EQ(str0->len, 7);
   EXPECT_EQ(str0->cap, 8);
   EXPECT_EQ(str0->dat[0], 'S');
@@ -3263,6 +3404,1292 @@ TEST(External_func, Globals) {
   EXPECT_EQ(*value, 21);
 }
 
+TEST(Lazy, Call_and_globals) {
+  const char *source = R"(
+    extern var value = 7;
+  
+    func square(n: sint) {
+      return n * n;
+    }
+  
+    extern func sumSquares(count: sint) {
+      var sum = 0;
+      for (i := 1; i <= count; i++) {
+        sum += square(i);
+      }
+      return sum;
+    }
+  
+    extern func mulValue(multiplier: sint) {
+      value *= multiplier;
+    }
+  
+    extern func neverCalled() {
+      return [1, 2, 3];
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  CompileStats stats;
+  StatsSink sink{log(), stats};
+  auto jit = generateLazyCode(syms, sink);
+  const auto compiled = [&stats](const std::string &name) {
+    const std::vector<std::string> &funcs = stats.lazyFunctions;
+    return std::find(funcs.begin(), funcs.end(), name) != funcs.end();
+  };
+  EXPECT_FALSE(compiled("sumSquares"));
+  
+  Global value = getGlobal<Sint>(jit.get(), "value");
+  EXPECT_EQ(*value, 7);
+  
+  Function sumSquares = getFunc<Sint(Sint)>(jit.get(), "sumSquares");
+  EXPECT_EQ(sumSquares(3), 1 + 4 + 9);
+  EXPECT_EQ(sumSquares(4), 1 + 4 + 9 + 16);
+  
+  Function mulValue = getFunc<Void(Sint)>(jit.get(), "mulValue");
+  mulValue(3);
+  EXPECT_EQ(*value, 21);
+  
+  EXPECT_TRUE(compiled("sumSquares"));
+  EXPECT_TRUE(compiled("mulValue"));
+  EXPECT_FALSE(compiled("neverCalled"));
+}
+
+TEST(Parallel_codegen, Partitions) {
+  const char *source = R"(
+    extern var value = 7;
+  
+    func square(n: sint) {
+      return n * n;
+    }
+  
+    func cube(n: sint) {
+      return n * square(n);
+    }
+  
+    extern func sumCubes(count: sint) {
+      var sum = 0;
+      for (i := 1; i <= count; i++) {
+        sum += cube(i);
+      }
+      return sum;
+    }
+  
+    extern func mulValue(multiplier: sint) {
+      value *= multiplier;
+      return value;
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  OptFlags opt;
+  opt.codegenThreads = 4;
+  llvm::ExecutionEngine *engine = generateCode(syms, log(), opt);
+  
+  Global value = getGlobal<Sint>(engine, "value");
+  EXPECT_EQ(*value, 7);
+  
+  Function sumCubes = GET_FUNC("sumCubes", Sint(Sint));
+  EXPECT_EQ(sumCubes(3), 1 + 8 + 27);
+  
+  Function mulValue = GET_FUNC("mulValue", Sint(Sint));
+  EXPECT_EQ(mulValue(3), 21);
+  EXPECT_EQ(*value, 21);
+}
+
+TEST(Tiered, Hot_function_is_swapped) {
+  const char *source = R"(
+    extern var value = 7;
+  
+    extern func sumTo(count: sint) {
+      var sum = 0;
+      for (i := 1; i <= count; i++) {
+        sum += i;
+      }
+      return sum;
+    }
+  
+    extern func mulValue(multiplier: sint) {
+      value *= multiplier;
+      return value;
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  auto engine = generateTieredCode(syms, log(), 100);
+  
+  Function sumTo = getFunc<Sint(Sint)>(engine.get(), "sumTo");
+  for (int i = 0; i != 200; ++i) {
+    EXPECT_EQ(sumTo(10), 55);
+  }
+  
+  Function mulValue = getFunc<Sint(Sint)>(engine.get(), "mulValue");
+  EXPECT_EQ(mulValue(3), 21);
+  
+  for (int w = 0; w != 500 && engine->optimized() == 0; ++w) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  EXPECT_EQ(engine->optimized(), 1);
+  EXPECT_EQ(sumTo(100), 5050);
+  EXPECT_EQ(mulValue(2), 42);
+  
+  // Calls are only counted until the function is swapped
+  const auto *count = reinterpret_cast<const std::atomic<uint64_t> *>(
+    engine->getGlobalAddress("sumTo.count")
+  );
+  ASSERT_NE(count, nullptr);
+  const uint64_t swappedCount = count->load();
+  EXPECT_GE(swappedCount, 100u);
+  for (int i = 0; i != 200; ++i) {
+    EXPECT_EQ(sumTo(10), 55);
+  }
+  EXPECT_EQ(count->load(), swappedCount);
+  
+  Global value = getGlobal<Sint>(engine.get(), "value");
+  EXPECT_EQ(*value, 42);
+}
+
+TEST(Profile, Gen_and_use) {
+  const char *source = R"(
+    extern func route(request: sint) {
+      if (request % 100 == 0) {
+        return request / 100;
+      } else if (request % 2 == 0) {
+        return request * 2;
+      } else {
+        return request + 1;
+      }
+    }
+  )";
+  const std::string profilePath = ::testing::TempDir() + "stela_route.profdata";
+  
+  {
+    AST ast = createAST(source, log());
+    Symbols syms = initModules(log());
+    compileModule(syms, ast, log());
+    // The program is instrumented even if it isn't optimized
+    OptFlags opt;
+    opt.profileGen = true;
+    opt.optimizeIR = false;
+    llvm::ExecutionEngine *engine = generateCode(syms, log(), opt);
+    
+    Function route = GET_FUNC("route", Sint(Sint));
+    for (Sint r = 1; r != 1000; ++r) {
+      route(r);
+    }
+    EXPECT_EQ(route(300), 3);
+    writeProfile(engine, profilePath, log());
+  }
+  
+  uint64_t profileSize = 0;
+  ASSERT_FALSE(llvm::sys::fs::file_size(profilePath, profileSize));
+  EXPECT_GT(profileSize, 0u);
+  
+  const auto branchWeights = [source](const OptFlags opt) {
+    AST ast = createAST(source, log());
+    Symbols syms = initModules(log());
+    compileModule(syms, ast, log());
+    std::unique_ptr<llvm::Module> module = generateIR(syms, log(), opt);
+    optimizeForHost(*module, log(), opt);
+    std::string ir;
+    llvm::raw_string_ostream irStream{ir};
+    irStream << *module;
+    return irStream.str().find("branch_weights") != std::string::npos;
+  };
+  OptFlags opt;
+  EXPECT_FALSE(branchWeights(opt));
+  opt.profileUse = profilePath.c_str();
+  EXPECT_TRUE(branchWeights(opt));
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  llvm::ExecutionEngine *engine = generateCode(syms, log(), opt);
+  
+  Function route = GET_FUNC("route", Sint(Sint));
+  EXPECT_EQ(route(300), 3);
+  EXPECT_EQ(route(4), 8);
+  EXPECT_EQ(route(5), 6);
+}
+
+TEST(Pipeline, Presets_and_strings) {
+  const char *source = R"(
+    extern func fib(n: sint) -> sint {
+      if (n < 2) {
+        return n;
+      }
+      return fib(n - 1) + fib(n - 2);
+    }
+  )";
+  
+  const auto compile = [source](const OptFlags opt) {
+    AST ast = createAST(source, log());
+    Symbols syms = initModules(log());
+    compileModule(syms, ast, log());
+    return generateCode(syms, log(), opt);
+  };
+  
+  for (const OptLevel level : {OptLevel::O1, OptLevel::O2, OptLevel::O3, OptLevel::Os}) {
+    OptFlags opt;
+    opt.level = level;
+    llvm::ExecutionEngine *engine = compile(opt);
+    EXPECT_EQ(GET_FUNC("fib", Sint(Sint))(10), 55);
+  }
+  
+  {
+    OptFlags opt;
+    opt.pipeline = "function(sroa,instcombine,simplify-cfg)";
+    llvm::ExecutionEngine *engine = compile(opt);
+    EXPECT_EQ(GET_FUNC("fib", Sint(Sint))(10), 55);
+  }
+  
+  {
+    OptFlags opt;
+    opt.inliner = false;
+    opt.vectorize = false;
+    llvm::ExecutionEngine *engine = compile(opt);
+    EXPECT_EQ(GET_FUNC("fib", Sint(Sint))(10), 55);
+    
+    AST ast = createAST(source, log());
+    Symbols syms = initModules(log());
+    compileModule(syms, ast, log());
+    std::unique_ptr<llvm::Module> module = generateIR(syms, log(), opt);
+    optimizeForHost(*module, log(), opt);
+    for (const llvm::Function &func : *module) {
+      if (func.getName() != "panic") {
+        EXPECT_FALSE(func.hasFnAttribute(llvm::Attribute::NoInline));
+      }
+      EXPECT_FALSE(func.hasFnAttribute(llvm::Attribute::NoImplicitFloat));
+    }
+  }
+  
+  OptFlags opt;
+  opt.pipeline = "not-a-pass";
+  EXPECT_THROW(compile(opt), FatalError);
+}
+
+TEST(Object_cache, Warm_start) {
+  const char *source = R"(
+    extern var value = 7;
+  
+    extern func mulValue(multiplier: sint) {
+      value *= multiplier;
+      return value;
+    }
+  )";
+  llvm::SmallString<128> cacheDir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("stela_object_cache", cacheDir));
+  
+  for (int start = 0; start != 2; ++start) {
+    AST ast = createAST(source, log());
+    Symbols syms = initModules(log());
+    compileModule(syms, ast, log());
+    CompileStats stats;
+    StatsSink sink{log(), stats};
+    llvm::ExecutionEngine *engine = generateCode(syms, sink, cacheDir.str().str());
+    // The first start optimizes, compiles and stores the object. The second
+    // loads it without running the optimizer
+    EXPECT_EQ(stats.cachedObjects, static_cast<uint64_t>(start));
+    EXPECT_EQ(stats.irBeforeOpt == 0, start == 1);
+    
+    Global value = getGlobal<Sint>(engine, "value");
+    EXPECT_EQ(*value, 7);
+    
+    Function mulValue = GET_FUNC("mulValue", Sint(Sint));
+    EXPECT_EQ(mulValue(3), 21);
+    EXPECT_EQ(*value, 21);
+  }
+  
+  llvm::sys::fs::remove_directories(cacheDir);
+}
+
+TEST(Host_target, Triple_and_features) {
+  const char *source = R"(
+    extern func sum(n: uint) {
+      var total = 0u;
+      for (i := 0u; i != n; i = i + 1u) {
+        total += i;
+      }
+      return total;
+    }
+  )";
+  
+  const auto analyse = [source] {
+    AST ast = createAST(source, log());
+    Symbols syms = initModules(log());
+    compileModule(syms, ast, log());
+    return syms;
+  };
+  
+  Symbols irSyms = analyse();
+  std::unique_ptr<llvm::Module> module = generateIR(irSyms, log());
+  EXPECT_FALSE(module->getTargetTriple().empty());
+  EXPECT_FALSE(module->getDataLayout().getStringRepresentation().empty());
+  
+  OptFlags opt;
+  opt.features = "-avx512f";
+  Symbols codeSyms = analyse();
+  llvm::ExecutionEngine *engine = generateCode(codeSyms, log(), opt);
+  EXPECT_EQ(GET_FUNC("sum", Uint(Uint))(5), 10);
+}
+
+TEST(Context_pool, Concurrent_compiles) {
+  constexpr int threadCount = 4;
+  std::vector<std::thread> threads;
+  std::vector<Sint> results(threadCount);
+  
+  for (int t = 0; t != threadCount; ++t) {
+    threads.emplace_back([t, &results] {
+      NullSink sink;
+      const std::string source = R"(
+        extern func get(n: sint) {
+          var total = 0;
+          for (i := 0; i != n; i = i + 1) {
+            total += i;
+          }
+          return total + )" + std::to_string(t) + R"(;
+        }
+      )";
+      AST ast = createAST(source, sink);
+      Symbols syms = initModules(sink);
+      compileModule(syms, ast, sink);
+      
+      ContextLease context;
+      std::unique_ptr<llvm::Module> module = generateIR(syms, sink, *context);
+      std::unique_ptr<llvm::ExecutionEngine> engine{
+        generateCode(std::move(module), sink)
+      };
+      results[t] = getFunc<Sint(Sint)>(engine.get(), "get")(5);
+    });
+  }
+  
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t != threadCount; ++t) {
+    EXPECT_EQ(results[t], 10 + t);
+  }
+}
+
+TEST(Context_pool, Memory_stays_bounded) {
+  const auto compileMany = [](const size_t count) {
+    NullSink sink;
+    for (size_t i = 0; i != count; ++i) {
+      AST ast = createAST("extern func get(n: sint) { return n * 2; }", sink);
+      Symbols syms = initModules(sink);
+      compileModule(syms, ast, sink);
+      
+      ContextLease context;
+      std::unique_ptr<llvm::Module> module = generateIR(syms, sink, *context);
+      std::unique_ptr<llvm::ExecutionEngine> engine{
+        generateCode(std::move(module), sink)
+      };
+      ASSERT_EQ(getFunc<Sint(Sint)>(engine.get(), "get")(3), 6);
+    }
+  };
+  
+  {
+    std::vector<ContextLease> leases(ContextLease::max_pooled * 2);
+  }
+  EXPECT_LE(ContextLease::pooled(), ContextLease::max_pooled);
+  
+  compileMany(ContextLease::max_uses * 2);
+  #ifdef __linux__
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  const long before = usage.ru_maxrss;
+  #endif
+  compileMany(ContextLease::max_uses * 4);
+  EXPECT_LE(ContextLease::pooled(), ContextLease::max_pooled);
+  #ifdef __linux__
+  getrusage(RUSAGE_SELF, &usage);
+  // ru_maxrss is in kilobytes
+  EXPECT_LT(usage.ru_maxrss - before, 32 * 1024);
+  #endif
+}
+
+TEST(Program, Destroys_globals) {
+  const char *source = R"(
+    var stored: [real];
+    var other = make [real] {};
+  
+    extern func store(array: [real]) {
+      stored = array;
+      other = array;
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  
+  Array<Real> array = makeEmptyArray<Real>();
+  {
+    Program program = generateProgram(syms, log());
+    auto store = getFunc<Void(Array<Real>)>(program.get(), "store");
+    store(array);
+    EXPECT_EQ(array.use_count(), 3);
+  }
+  EXPECT_EQ(array.use_count(), 1);
+}
+
+TEST(Module_linker, Recompiles_changed_modules) {
+  const char *libSource = R"(
+    module lib;
+    
+    var offset = 5;
+    
+    func add(a: sint, b: sint) -> sint {
+      return a + b + offset;
+    }
+  )";
+  const auto mainSource = [](const int b) {
+    return R"(
+      module main;
+      import lib;
+      
+      extern func run(a: sint) {
+        return add(a, )" + std::to_string(b) + R"();
+      }
+    )";
+  };
+  // The symbols refer to the source so it must outlive them
+  const std::string mainSources[] = {mainSource(1), mainSource(2)};
+  const auto compile = [&](const std::string &source) {
+    ASTs asts;
+    asts.push_back(createAST(libSource, log()));
+    asts.push_back(createAST(source, log()));
+    Symbols syms = initModules(log());
+    compileModules(syms, asts, log());
+    return syms;
+  };
+  
+  ModuleLinker linker;
+  {
+    Program program = linker.link(compile(mainSources[0]), log());
+    EXPECT_EQ(linker.compiled(), 2);
+    EXPECT_EQ(getFunc<Sint(Sint)>(program.get(), "run")(1), 7);
+  }
+  {
+    Program program = linker.link(compile(mainSources[1]), log());
+    EXPECT_EQ(linker.compiled(), 1);
+    EXPECT_EQ(getFunc<Sint(Sint)>(program.get(), "run")(1), 8);
+  }
+  {
+    Program program = linker.link(compile(mainSources[1]), log());
+    EXPECT_EQ(linker.compiled(), 0);
+    EXPECT_EQ(getFunc<Sint(Sint)>(program.get(), "run")(1), 8);
+  }
+}
+
+TEST(Hot_swap, Reload_keeps_handles_and_globals) {
+  const auto compile = [](const char *source) {
+    AST ast = createAST(source, log());
+    Symbols syms = initModules(log());
+    compileModule(syms, ast, log());
+    return syms;
+  };
+  
+  std::unique_ptr<HotSwapEngine> hotSwap = generateHotSwapCode(compile(R"(
+    var calls = 0;
+    
+    extern func get() {
+      calls += 1;
+      return 1;
+    }
+    
+    extern func count() {
+      return calls;
+    }
+  )"), log());
+  HotSwapEngine *engine = hotSwap.get();
+  
+  auto get = GET_FUNC("get", Sint());
+  auto count = GET_FUNC("count", Sint());
+  EXPECT_EQ(get(), 1);
+  EXPECT_EQ(count(), 1);
+  
+  engine->reload(compile(R"(
+    var calls = 0;
+    var extra = 10;
+    
+    extern func get() {
+      calls += 1;
+      return 2;
+    }
+    
+    extern func count() {
+      return calls;
+    }
+    
+    extern func getExtra() {
+      return extra;
+    }
+  )"), log());
+  
+  EXPECT_EQ(engine->reloads(), 1);
+  EXPECT_EQ(get(), 2);
+  EXPECT_EQ(count(), 2);
+  auto getExtra = GET_FUNC("getExtra", Sint());
+  EXPECT_EQ(getExtra(), 10);
+  
+  // extra changes type so it starts again and count changes signature so the
+  // old count keeps calling the previous version
+  engine->reload(compile(R"(
+    var calls = 0;
+    var extra = 20.0;
+    
+    extern func get() {
+      calls += 1;
+      return 3;
+    }
+    
+    extern func count(offset: sint) {
+      return calls + offset;
+    }
+    
+    extern func getExtra() {
+      return 1;
+    }
+    
+    extern func realExtra() {
+      return extra;
+    }
+  )"), log());
+  
+  EXPECT_EQ(engine->reloads(), 2);
+  EXPECT_EQ(get(), 3);
+  EXPECT_EQ(count(), 3);
+  EXPECT_EQ(GET_FUNC("count", Sint(Sint))(10), 13);
+  EXPECT_EQ(getExtra(), 1);
+  EXPECT_EQ(GET_FUNC("realExtra", Real())(), 20.0f);
+  
+  // The first reload is still used by the old count
+  EXPECT_EQ(engine->retained(), 2);
+  engine->collect();
+  EXPECT_EQ(engine->retained(), 2);
+  EXPECT_EQ(count(), 3);
+  
+  engine->reload(compile(R"(
+    var calls = 0;
+    var extra = 20.0;
+    
+    extern func get() {
+      calls += 1;
+      return 4;
+    }
+    
+    extern func count() {
+      return calls * 10;
+    }
+    
+    extern func count(offset: sint) {
+      return calls + offset;
+    }
+    
+    extern func getExtra() {
+      return 2;
+    }
+    
+    extern func realExtra() {
+      return extra;
+    }
+  )"), log());
+  
+  // Nothing refers to the first two reloads anymore
+  EXPECT_EQ(engine->reloads(), 3);
+  EXPECT_EQ(engine->retained(), 3);
+  engine->collect();
+  EXPECT_EQ(engine->retained(), 1);
+  EXPECT_EQ(get(), 4);
+  EXPECT_EQ(count(), 40);
+  EXPECT_EQ(getExtra(), 2);
+  EXPECT_EQ(GET_FUNC("realExtra", Real())(), 20.0f);
+}
+
+TEST(Closure_thunk, Only_for_stored_functions) {
+  const char *source = R"(
+    extern func direct(a: sint) {
+      return a + 1;
+    }
+    extern func stored(a: sint) {
+      return a * 2;
+    }
+    extern func apply(fn: func(sint) -> sint, a: sint) {
+      return fn(a);
+    }
+    extern func test(a: sint) {
+      return apply(stored, direct(a));
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  std::unique_ptr<llvm::Module> module = generateIR(syms, log());
+  EXPECT_EQ(module->getFunction("direct")->arg_size(), 1);
+  EXPECT_EQ(module->getFunction("stored")->arg_size(), 1);
+  EXPECT_EQ(module->getFunction("direct.clo"), nullptr);
+  ASSERT_NE(module->getFunction("stored.clo"), nullptr);
+  EXPECT_EQ(module->getFunction("stored.clo")->arg_size(), 2);
+  
+  llvm::ExecutionEngine *engine = generateCode(std::move(module), log());
+  EXPECT_EQ(GET_FUNC("test", Sint(Sint))(4), 10);
+  EXPECT_EQ(GET_FUNC("direct", Sint(Sint))(4), 5);
+}
+
+TEST(Struct_registers, Pass_and_return) {
+  EXPECT_SUCCEEDS(R"(
+    type Vec2 struct {
+      x: real;
+      y: real;
+    };
+    type Vec3 struct {
+      x: real;
+      y: real;
+      z: real;
+    };
+    type Mixed struct {
+      i: sint;
+      r: real;
+      b: bool;
+    };
+    
+    extern func add(a: Vec2, b: Vec2) {
+      return make Vec2 {a.x + b.x, a.y + b.y};
+    }
+    extern func cross(a: Vec3, b: Vec3) {
+      return make Vec3 {
+        a.y * b.z - a.z * b.y,
+        a.z * b.x - a.x * b.z,
+        a.x * b.y - a.y * b.x
+      };
+    }
+    extern func flip(m: Mixed) {
+      return make Mixed {-m.i, -m.r, !m.b};
+    }
+    extern func sum(a: Vec2, b: Vec2, c: Vec2, d: Vec2, e: Vec2, f: Vec2, g: Vec2, h: Vec2, i: Vec2) {
+      return a.x + b.x + c.x + d.x + e.x + f.x + g.x + h.x + i.x + i.y;
+    }
+    func apply(fn: func(Vec2, Vec2) -> Vec2, a: Vec2, b: Vec2) {
+      return fn(a, b);
+    }
+    extern func applyAdd(a: Vec2, b: Vec2) {
+      return apply(add, a, b);
+    }
+  )");
+  
+  struct Vec2 {
+    Real x, y;
+  };
+  struct Vec3 {
+    Real x, y, z;
+  };
+  struct Mixed {
+    Sint i;
+    Real r;
+    Bool b;
+  };
+  
+  auto add = GET_FUNC("add", Vec2(Vec2, Vec2));
+  const Vec2 v = add(Vec2{1.0f, 2.0f}, Vec2{3.0f, 4.0f});
+  EXPECT_EQ(v.x, 4.0f);
+  EXPECT_EQ(v.y, 6.0f);
+  
+  auto cross = GET_FUNC("cross", Vec3(Vec3, Vec3));
+  const Vec3 z = cross(Vec3{1.0f, 0.0f, 0.0f}, Vec3{0.0f, 1.0f, 0.0f});
+  EXPECT_EQ(z.x, 0.0f);
+  EXPECT_EQ(z.y, 0.0f);
+  EXPECT_EQ(z.z, 1.0f);
+  
+  auto flip = GET_FUNC("flip", Mixed(Mixed));
+  const Mixed m = flip(Mixed{3, 1.5f, true});
+  EXPECT_EQ(m.i, -3);
+  EXPECT_EQ(m.r, -1.5f);
+  EXPECT_FALSE(m.b);
+  
+  // the last parameter doesn't fit in a register so it's passed on the stack
+  auto sum = GET_FUNC("sum", Real(Vec2, Vec2, Vec2, Vec2, Vec2, Vec2, Vec2, Vec2, Vec2));
+  const Vec2 one{1.0f, 0.0f};
+  EXPECT_EQ(sum(one, one, one, one, one, one, one, one, Vec2{1.0f, 2.0f}), 11.0f);
+  
+  auto applyAdd = GET_FUNC("applyAdd", Vec2(Vec2, Vec2));
+  const Vec2 w = applyAdd(Vec2{1.0f, 2.0f}, Vec2{3.0f, 4.0f});
+  EXPECT_EQ(w.x, 4.0f);
+  EXPECT_EQ(w.y, 6.0f);
+}
+
+} // namespace
+
+struct Extent {
+  Sint w, h;
+};
+
+template <>
+struct stela::reflect<Extent> {
+  STELA_REFLECT(Extent);
+  STELA_CLASS(
+    STELA_FIELD(w),
+    STELA_FIELD(h)
+  );
+};
+
+namespace {
+
+TEST(Struct_registers, Reflected_fields) {
+  struct Point {
+    Real x, y;
+  };
+  struct Line {
+    Point a;
+    Sint width;
+  };
+  struct Handle {
+    ::Vec2 pos;
+    Sint id;
+  };
+  struct Outer {
+    Handle handle;
+  };
+  
+  // ::Vec2 is reflected so it's opaque to Stela and passed by pointer. The
+  // structs that contain it must be passed by pointer too
+  EXPECT_FALSE(pass_in_registers<::Vec2>);
+  EXPECT_FALSE(pass_in_registers<Handle>);
+  EXPECT_FALSE(pass_in_registers<Outer>);
+  EXPECT_EQ(pass_in_registers<Point>, register_structs);
+  EXPECT_EQ(pass_in_registers<Line>, register_structs);
+}
+
+TEST(Struct_registers, Non_intrusive_reflection) {
+  struct Sized {
+    Extent extent;
+  };
+  
+  // Extent is reflected by specializing reflect rather than with members.
+  // It's still opaque to Stela so it's passed by pointer
+  static_assert(sizeof(Extent) == 8);
+  EXPECT_FALSE(pass_in_registers<Extent>);
+  EXPECT_FALSE(pass_in_registers<Sized>);
+  EXPECT_TRUE(std::is_pointer_v<pass_traits<Extent>::type>);
+}
+
+TEST(Lifetime, Folded_global_constructors) {
+  const char *source = R"(
+    type Vec2 struct {
+      x: real;
+      y: real;
+    };
+    
+    let origin = make Vec2 {1.5, -2.0};
+    let twelve = 4 * 3;
+    var counter = twelve + 1;
+    let array = [1, 2, 3];
+    let after = twelve;
+    
+    extern func getOrigin() {
+      return origin.x + origin.y;
+    }
+    extern func next() {
+      counter += 1;
+      return counter;
+    }
+    extern func getLast() {
+      return after + array[2];
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  std::unique_ptr<llvm::Module> module = generateIR(syms, log());
+  EXPECT_EQ(module->getFunction("origin_ctor"), nullptr);
+  EXPECT_EQ(module->getFunction("origin_dtor"), nullptr);
+  EXPECT_EQ(module->getFunction("counter_ctor"), nullptr);
+  // arrays are allocated on the heap so they have to be constructed at runtime
+  EXPECT_NE(module->getFunction("array_ctor"), nullptr);
+  EXPECT_NE(module->getFunction("array_dtor"), nullptr);
+  // folding stops at the first constructor that can't be folded
+  EXPECT_NE(module->getFunction("after_ctor"), nullptr);
+  EXPECT_EQ(module->getFunction("after_dtor"), nullptr);
+  
+  llvm::ExecutionEngine *engine = generateCode(std::move(module), log());
+  EXPECT_EQ(GET_FUNC("getOrigin", Real())(), -0.5f);
+  auto next = GET_FUNC("next", Sint());
+  EXPECT_EQ(next(), 14);
+  EXPECT_EQ(next(), 15);
+  EXPECT_EQ(GET_FUNC("getLast", Sint())(), 15);
+}
+
+TEST(Debug_info, Line_tables) {
+  const char *source = R"(
+    extern func sum(n: sint) {
+      var total = 0;
+      for (i := 0; i < n; i++) {
+        total += i;
+      }
+      return total;
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  OptFlags opt;
+  opt.debugInfo = true;
+  std::unique_ptr<llvm::Module> module = generateIR(syms, log(), opt);
+  llvm::Function *sum = module->getFunction("sum");
+  ASSERT_NE(sum->getSubprogram(), nullptr);
+  EXPECT_EQ(sum->getSubprogram()->getLine(), 2);
+  std::set<unsigned> lines;
+  for (llvm::BasicBlock &block : *sum) {
+    for (llvm::Instruction &inst : block) {
+      if (const llvm::DebugLoc &loc = inst.getDebugLoc()) {
+        lines.insert(loc.getLine());
+      }
+    }
+  }
+  for (const unsigned line : {3u, 4u, 5u, 7u}) {
+    EXPECT_EQ(lines.count(line), 1u) << line;
+  }
+  
+  llvm::ExecutionEngine *engine = generateCode(std::move(module), log(), opt);
+  EXPECT_EQ(GET_FUNC("sum", Sint(Sint))(5), 10);
+}
+
+#ifdef __linux__
+
+TEST(Perf, Map_has_source_names) {
+  const char *source = R"(
+    extern func perf_ident(a: sint) {
+      return a;
+    }
+    extern func perf_ident(a: real) {
+      return a;
+    }
+  )";
+  
+  AST ast = createAST(source, log());
+  Symbols syms = initModules(log());
+  compileModule(syms, ast, log());
+  OptFlags opt;
+  opt.perf = true;
+  llvm::ExecutionEngine *engine = generateCode(syms, log(), opt);
+  EXPECT_EQ(GET_FUNC("perf_ident", Sint(Sint))(3), 3);
+  
+  std::ifstream map{"/tmp/perf-" + std::to_string(getpid()) + ".map"};
+  ASSERT_TRUE(map.is_open());
+  bool first = false;
+  bool second = false;
+  std::string line;
+  while (std::getline(map, line)) {
+    const std::string name = line.substr(line.find(' ', line.find(' ') + 1) + 1);
+    first |= name == "perf_ident(sint) -> sint";
+    second |= name == "perf_ident(real) -> real";
+  }
+  EXPECT_TRUE(first);
+  EXPECT_TRUE(second);
+}
+
+#endif
+
+TEST(Compile_stats, Every_phase) {
+  CompileStats stats;
+  StatsSink sink{log(), stats};
+  Symbols syms = initModules(sink);
+  compileModule(syms, R"(
+    extern func twice(a: sint) {
+      return a * 2;
+    }
+  )", sink);
+  llvm::ExecutionEngine *engine = generateCode(syms, sink);
+  EXPECT_EQ(GET_FUNC("twice", Sint(Sint))(3), 6);
+  
+  for (const char *phase : {"lexical", "syntax", "semantic", "generate", "optimize", "codegen"}) {
+    EXPECT_TRUE(std::any_of(stats.phases.begin(), stats.phases.end(), [phase](const PhaseStats &p) {
+      return std::string_view{p.name} == phase;
+    })) << phase;
+  }
+  EXPECT_GT(stats.tokens, 0u);
+  EXPECT_GT(stats.astNodes, 0u);
+  EXPECT_GT(stats.irBeforeOpt, 0u);
+  EXPECT_GT(stats.irAfterOpt, 0u);
+  EXPECT_GT(stats.machineCode, 0u);
+  
+  std::ostringstream trace;
+  stats.writeTrace(trace);
+  EXPECT_NE(trace.str().find("\"name\":\"optimize\""), std::string::npos);
+  EXPECT_NE(trace.str().find("\"tokens\":" + std::to_string(stats.tokens)), std::string::npos);
+}
+
+TEST(Remarks, Missed_inlining) {
+  std::ostringstream out;
+  StreamSink stream{out};
+  FilterSink sink{stream, LogPri::status};
+  EXPECT_TRUE(sink.enabled(LogCat::generate, LogPri::status));
+  EXPECT_FALSE(sink.enabled(LogCat::generate, LogPri::verbose));
+  
+  Symbols syms = initModules(log());
+  compileModule(syms, R"(
+    func twice(a: sint) {
+      return a * 2;
+    }
+    extern func quad(a: sint) {
+      return twice(twice(a));
+    }
+  )", log());
+  OptFlags opt;
+  opt.inliner = false;
+  opt.debugInfo = true;
+  llvm::ExecutionEngine *engine = generateCode(syms, sink, opt);
+  EXPECT_EQ(GET_FUNC("quad", Sint(Sint))(3), 12);
+  
+  const std::string remarks = out.str();
+  EXPECT_NE(remarks.find("Generative status: inline in quad: "), std::string::npos);
+  EXPECT_NE(remarks.find("not inlined"), std::string::npos);
+  EXPECT_NE(remarks.find(":6:"), std::string::npos);
+}
+
+TEST(Array, Copy_on_write) {
+  EXPECT_SUCCEEDS(R"(
+    extern func modifyCopy(a: [sint]) {
+      var b = a;
+      b[0] = 5;
+      push_back(b, 6);
+      return b;
+    }
+    
+    extern func modifyNested(a: [[sint]]) {
+      var b = a;
+      b[0][0] = 7;
+      return b;
+    }
+    
+    extern func readCopy(a: [sint]) {
+      let b = a;
+      return b[0] + b[1];
+    }
+  )");
+  
+  auto modifyCopy = GET_FUNC("modifyCopy", Array<Sint>(Array<Sint>));
+  
+  Array<Sint> orig = makeArrayOf<Sint>(1, 2);
+  Array<Sint> copy = modifyCopy(orig);
+  EXPECT_EQ(orig.use_count(), 1);
+  EXPECT_EQ(orig->len, 2);
+  EXPECT_EQ(orig->dat[0], 1);
+  EXPECT_EQ(copy.use_count(), 1);
+  EXPECT_EQ(copy->len, 3);
+  EXPECT_EQ(copy->dat[0], 5);
+  EXPECT_EQ(copy->dat[1], 2);
+  EXPECT_EQ(copy->dat[2], 6);
+  
+  auto modifyNested = GET_FUNC("modifyNested", Array<Array<Sint>>(Array<Array<Sint>>));
+  
+  Array<Sint> inner = makeArrayOf<Sint>(1);
+  Array<Array<Sint>> outer = makeArrayOf<Array<Sint>>(inner);
+  Array<Array<Sint>> changed = modifyNested(outer);
+  EXPECT_EQ(inner.use_count(), 2);
+  EXPECT_EQ(inner->dat[0], 1);
+  EXPECT_EQ(outer.use_count(), 1);
+  EXPECT_EQ(outer->dat[0], inner);
+  EXPECT_EQ(changed.use_count(), 1);
+  EXPECT_NE(changed->dat[0], inner);
+  EXPECT_EQ(changed->dat[0]->dat[0], 7);
+  
+  auto readCopy = GET_FUNC("readCopy", Sint(Array<Sint>));
+  
+  const ArrayStorage<Sint> *storage = orig.get();
+  EXPECT_EQ(readCopy(orig), 3);
+  EXPECT_EQ(orig.get(), storage);
+  EXPECT_EQ(orig.use_count(), 1);
+}
+
+TEST(Array, Inline_storage) {
+  EXPECT_SUCCEEDS(R"(
+    extern func getShort() {
+      return "short";
+    }
+    extern func getLong() {
+      return "this string is too long";
+    }
+    extern func grow(str: [char]) {
+      push_back(str, '!');
+      return str;
+    }
+    extern func copy(str: [char]) {
+      var other = str;
+      other[0] = 'S';
+      return other;
+    }
+  )");
+  
+  const auto toString = [](const Array<Char> &str) {
+    return std::string(reinterpret_cast<const char *>(str->dat), str->len);
+  };
+  
+  Array<Char> shortStr = GET_FUNC("getShort", Array<Char>())();
+  EXPECT_EQ(shortStr->dat, shortStr->inlineDat());
+  EXPECT_EQ(shortStr->cap, 5);
+  EXPECT_EQ(toString(shortStr), "short");
+  
+  Array<Char> longStr = GET_FUNC("getLong", Array<Char>())();
+  EXPECT_NE(longStr->dat, longStr->inlineDat());
+  EXPECT_EQ(toString(longStr), "this string is too long");
+  
+  Array<Char> grown = GET_FUNC("grow", Array<Char>(Array<Char>))(makeString("hello"));
+  EXPECT_NE(grown->dat, grown->inlineDat());
+  EXPECT_EQ(toString(grown), "hello!");
+  
+  Array<Char> copied = GET_FUNC("copy", Array<Char>(Array<Char>))(shortStr);
+  EXPECT_EQ(copied->dat, copied->inlineDat());
+  EXPECT_EQ(toString(copied), "Short");
+  EXPECT_EQ(toString(shortStr), "short");
+}
+
+TEST(Atomic_refs, Shared_array) {
+  Symbols syms = initModules(log());
+  compileModule(syms, R"(
+    extern func sum(a: [sint]) {
+      let b = a;
+      var total = 0;
+      for (i := 0u; i != size(b); i = i + 1u) {
+        total += b[i];
+      }
+      return total;
+    }
+    extern func copy(a: [sint]) {
+      return a;
+    }
+  )", log());
+  OptFlags opt;
+  opt.atomicRefs = true;
+  
+  std::string ir;
+  llvm::raw_string_ostream irStream{ir};
+  irStream << *generateIR(syms, log(), opt);
+  EXPECT_NE(irStream.str().find("atomicrmw"), std::string::npos);
+  
+  llvm::ExecutionEngine *engine = generateCode(syms, log(), opt);
+  auto sum = GET_FUNC("sum", Sint(SharedArray<Sint>));
+  auto copy = GET_FUNC("copy", SharedArray<Sint>(SharedArray<Sint>));
+  
+  constexpr int threadCount = 4;
+  SharedArray<Sint> shared{makeArrayOf<Sint>(1, 2, 3).detach()};
+  std::vector<std::thread> threads;
+  std::vector<Sint> results(threadCount);
+  for (int t = 0; t != threadCount; ++t) {
+    threads.emplace_back([t, sum, copy, shared, &results]() mutable {
+      for (int i = 0; i != 1000; ++i) {
+        SharedArray<Sint> local = copy(shared);
+        results[t] += sum(local);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t != threadCount; ++t) {
+    EXPECT_EQ(results[t], 6000);
+  }
+  EXPECT_EQ(shared.use_count(), 1);
+}
+
+TEST(Allocator, Arena_and_pool) {
+  const char *source = R"(
+    extern func greet(name: [char]) {
+      var str = "Hello, ";
+      append(str, name);
+      return str;
+    }
+  )";
+  
+  {
+    ArenaAllocator arena;
+    Symbols syms = initModules(log());
+    compileModule(syms, source, log());
+    OptFlags opt;
+    opt.allocator = &arena.table();
+    llvm::ExecutionEngine *engine = generateCode(syms, log(), opt);
+    
+    Function greet = GET_FUNC("greet", Array<Char>(Array<Char>));
+    for (int r = 0; r != 3; ++r) {
+      AllocatorScope scope{arena.table()};
+      Array<Char> greeting = greet(makeString("world"));
+      EXPECT_EQ(greeting->len, 12);
+      EXPECT_EQ(greeting->dat[7], 'w');
+      EXPECT_GT(arena.used(), 0);
+      greeting = nullptr;
+      arena.reset();
+      EXPECT_EQ(arena.used(), 0);
+    }
+  }
+  
+  PoolAllocator pool;
+  void *block = pool.alloc(24);
+  pool.free(block);
+  EXPECT_EQ(pool.alloc(32), block);
+  pool.free(block);
+  
+  Symbols syms = initModules(log());
+  compileModule(syms, source, log());
+  OptFlags opt;
+  opt.allocator = &pool.table();
+  llvm::ExecutionEngine *engine = generateCode(syms, log(), opt);
+  
+  Function greet = GET_FUNC("greet", Array<Char>(Array<Char>));
+  AllocatorScope scope{pool.table()};
+  for (int r = 0; r != 3; ++r) {
+    Array<Char> greeting = greet(makeString("pool"));
+    EXPECT_EQ(greeting->len, 11);
+    EXPECT_EQ(greeting->dat[7], 'p');
+  }
+}
+
+TEST(Allocator, Scope_and_flags) {
+  const char *source = R"(
+    extern func triple() {
+      return [1, 2, 3];
+    }
+  )";
+  
+  ArenaAllocator arena;
+  PoolAllocator pool;
+  
+  const auto irFor = [source](const OptFlags opt) {
+    Symbols syms = initModules(log());
+    compileModule(syms, source, log());
+    std::unique_ptr<llvm::Module> module = generateIR(syms, log(), opt);
+    std::string ir;
+    llvm::raw_string_ostream irStream{ir};
+    irStream << *module;
+    return irStream.str();
+  };
+  
+  // The table is referenced by a symbol so the IR doesn't change between
+  // compilations
+  OptFlags opt;
+  opt.allocator = &arena.table();
+  const std::string ir = irFor(opt);
+  EXPECT_EQ(ir.find("inttoptr"), std::string::npos);
+  EXPECT_NE(ir.find("@stela_allocator_"), std::string::npos);
+  EXPECT_EQ(irFor(opt), ir);
+  
+  {
+    // The allocator is taken from the scope
+    AllocatorScope scope{arena.table()};
+    EXPECT_EQ(irFor({}), ir);
+    
+    Symbols syms = initModules(log());
+    compileModule(syms, source, log());
+    llvm::ExecutionEngine *engine = generateCode(syms, log());
+    Array<Sint> array = GET_FUNC("triple", Array<Sint>())();
+    EXPECT_EQ(array->dat[2], 3);
+    EXPECT_GT(arena.used(), 0);
+    array = nullptr;
+    
+    opt.allocator = &pool.table();
+    EXPECT_THROW(irFor(opt), FatalError);
+  }
+  arena.reset();
+}
+
+TEST(Allocator, Object_free_lists) {
+  EXPECT_SUCCEEDS(R"(
+    extern func makeAdder(n: sint) {
+      return func(x: sint) {
+        return x + n;
+      };
+    }
+    extern func makeTriple() {
+      return [1, 2, 3];
+    }
+  )");
+  
+  auto makeAdder = GET_FUNC("makeAdder", Closure<Sint(Sint)>(Sint));
+  auto makeTriple = GET_FUNC("makeTriple", Array<Sint>());
+  
+  const ClosureData *data;
+  {
+    auto addOne = makeAdder(1);
+    EXPECT_EQ(addOne(2), 3);
+    data = addOne.dat.get();
+  }
+  for (Sint n = 0; n != 1000; ++n) {
+    auto add = makeAdder(n);
+    EXPECT_EQ(add(1), n + 1);
+    EXPECT_EQ(add.dat.get(), data);
+  }
+  
+  Array<Sint> triple = makeTriple();
+  const ArrayStorage<Sint> *storage = triple.get();
+  triple = nullptr;
+  Array<Sint> hostTriple = makeArray<Sint>(3);
+  EXPECT_EQ(hostTriple.get(), storage);
+  
+  std::vector<Array<Sint>> arrays;
+  for (int i = 0; i != 100; ++i) {
+    arrays.push_back(makeTriple());
+  }
+  std::thread{[&arrays] {
+    arrays.clear();
+  }}.join();
+  EXPECT_EQ(makeTriple()->dat[2], 3);
+  
+  // The free lists of a thread are flushed when it exits. Objects released by
+  // thread local objects that are destroyed later go straight to free
+  std::thread{[makeTriple]() mutable {
+    static thread_local Array<Sint> held;
+    Array<Sint> &heldRef = held;
+    heldRef = makeTriple();
+    makeTriple();
+  }}.join();
+}
+
+TEST(Allocator, Free_to_origin) {
+  EXPECT_SUCCEEDS(R"(
+    extern func replace(arr: ref [sint]) {
+      arr = [4, 5];
+    }
+  )");
+  
+  auto replace = GET_FUNC("replace", Void(Array<Sint> &));
+  
+  PoolAllocator pool;
+  Array<Sint> array;
+  {
+    AllocatorScope scope{pool.table()};
+    array = makeArrayOf<Sint>(1, 2, 3);
+  }
+  const ArrayStorage<Sint> *storage = array.get();
+  
+  // The code was compiled without an allocator but the storage is given back
+  // to the pool that it came from
+  replace(array);
+  EXPECT_EQ(array->len, 2);
+  EXPECT_EQ(array->dat[1], 5);
+  {
+    AllocatorScope scope{pool.table()};
+    Array<Sint> again = makeArrayOf<Sint>(1, 2, 3);
+    EXPECT_EQ(again.get(), storage);
+    
+    // Storage from the free lists goes back to the free lists even when it's
+    // released inside a scope
+    array = nullptr;
+  }
+  
+  Array<Sint> fromLists = makeArrayOf<Sint>(4, 5);
+  EXPECT_EQ(fromLists->dat[0], 4);
+  fromLists = nullptr;
+  flushObjectFreeLists();
+}
+
 #undef EXPECT_FAILS
 #undef EXPECT_SUCCEEDS
 #undef GET_MEM_FUNC